@@ -0,0 +1,87 @@
+# Compare two captures of the bench firmware (test/bench/README) and flag regressions.
+#
+# A capture is whatever the serial monitor printed: lines holding a JSON object with a "bench"
+# key are results, everything else is ignored, so monitor timestamps and log lines can stay in.
+# Every unit is lower-is-better. Exits with 1 when a case got slower by more than --threshold.
+#   python3 scripts/bench_compare.py baseline.log current.log
+#   python3 scripts/bench_compare.py baseline.log current.log --metric p99 --threshold 10
+import argparse
+import json
+import sys
+
+
+def load(path):
+    results = {}
+    meta = {}
+    with open(path, errors="replace") as f:
+        for line in f:
+            start = line.find("{")
+            if start < 0:
+                continue
+            try:
+                record = json.loads(line[start:])
+            except ValueError:
+                continue
+            if not isinstance(record, dict) or "bench" not in record:
+                continue
+            if record["bench"] == "meta":
+                meta = record
+            elif "unit" in record:
+                results[(record["bench"], record.get("case", ""))] = record
+    return meta, results
+
+
+def describe(meta):
+    if not meta:
+        return "(no meta line)"
+    return "%s @ %s MHz, app %s, IDF %s, built %s" % (
+        meta.get("chip"), meta.get("cpu_mhz"), meta.get("app"), meta.get("idf"), meta.get("built"))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare two bench captures")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--metric", default="p50", help="mean, p50, p90, p99 or max (default p50)")
+    parser.add_argument("--threshold", type=float, default=5.0, help="allowed slowdown in percent (default 5)")
+    args = parser.parse_args()
+
+    base_meta, base = load(args.baseline)
+    cur_meta, cur = load(args.current)
+    print("baseline: " + describe(base_meta))
+    print("current:  " + describe(cur_meta))
+    print()
+
+    rows = []
+    regressions = 0
+    for key in sorted(set(base) | set(cur)):
+        name = "%s/%s" % key if key[1] else key[0]
+        old = base.get(key, {}).get(args.metric)
+        new = cur.get(key, {}).get(args.metric)
+        unit = (cur.get(key) or base.get(key)).get("unit", "")
+        if old is None or new is None:
+            rows.append((name, unit, old, new, None, "only in " + ("baseline" if new is None else "current")))
+            continue
+        delta = (new - old) / old * 100.0 if old else 0.0
+        verdict = ""
+        if delta > args.threshold:
+            verdict = "REGRESSION"
+            regressions += 1
+        elif delta < -args.threshold:
+            verdict = "faster"
+        rows.append((name, unit, old, new, delta, verdict))
+
+    width = max([len(r[0]) for r in rows] + [4])
+    print("%-*s  %-18s %12s %12s %8s" % (width, "case", "unit", "baseline", "current", "delta"))
+    for name, unit, old, new, delta, verdict in rows:
+        fmt = lambda v: "-" if v is None else "%.2f" % v
+        print("%-*s  %-18s %12s %12s %8s  %s" % (
+            width, name, unit, fmt(old), fmt(new), "" if delta is None else "%+.1f%%" % delta, verdict))
+
+    if regressions:
+        print("\n%d case(s) slower than %.1f%% on %s" % (regressions, args.threshold, args.metric))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,50 @@
+# WebSocket echo server for the loopback case of the bench firmware (test/bench/README).
+#
+# Every binary message goes straight back to the sender, text messages are ignored. Build the
+# bench with BENCH_WS_HOST set to the address of the machine this runs on:
+#   pip install websockets
+#   python3 scripts/bench_echo_server.py --port 8765
+import argparse
+import asyncio
+import sys
+
+try:
+    import websockets
+except ImportError:
+    sys.exit("bench_echo_server: needs the websockets package (pip install websockets)")
+
+
+async def echo(socket, path=None):
+    peer = socket.remote_address
+    print("bench_echo_server: %s:%d connected" % peer[:2])
+    frames = 0
+    try:
+        async for message in socket:
+            if isinstance(message, bytes):
+                await socket.send(message)
+                frames += 1
+    except websockets.ConnectionClosed:
+        pass
+    print("bench_echo_server: %s:%d gone after %d frames" % (peer[0], peer[1], frames))
+
+
+async def serve(host, port):
+    # no compression: the frames are Opus, deflating them only adds latency
+    async with websockets.serve(echo, host, port, compression=None, max_size=2 ** 16):
+        print("bench_echo_server: listening on %s:%d" % (host, port))
+        await asyncio.Future()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="WebSocket echo server for the bench loopback case")
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8765)
+    args = parser.parse_args()
+    try:
+        asyncio.run(serve(args.host, args.port))
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,105 @@
+# Pre-build step: gzip everything in ui/ into include/UiAssets.h as PROGMEM arrays.
+#
+# Each file is served under the WifiManager UI prefix: index.html at the prefix itself,
+# anything else at <prefix>/<name>. The ETag is a hash of the source, so browsers only
+# download the page again after it changed.
+#
+# Runs from platformio.ini (extra_scripts = pre:scripts/embed_ui.py) or on its own:
+#   python3 scripts/embed_ui.py
+import gzip
+import hashlib
+import os
+import sys
+
+CONTENT_TYPES = {
+    ".html": "text/html",
+    ".js": "application/javascript",
+    ".css": "text/css",
+    ".svg": "image/svg+xml",
+    ".json": "application/json",
+    ".ico": "image/x-icon",
+}
+
+
+def symbol_for(name):
+    return "UI_" + "".join(c.upper() if c.isalnum() else "_" for c in name) + "_GZ"
+
+
+def render(assets):
+    lines = [
+        "// Generated by scripts/embed_ui.py from ui/, do not edit",
+        "#pragma once",
+        "",
+        "#include <Arduino.h>",
+        "",
+        "struct UiAsset",
+        "{",
+        "    const char *path;         // below the UI prefix, \"\" for index.html",
+        "    const char *contentType;",
+        "    const uint8_t *data;      // gzip",
+        "    size_t length;",
+        "    const char *etag;",
+        "};",
+        "",
+    ]
+    for asset in assets:
+        lines.append("static const uint8_t %s[] PROGMEM = {" % asset["symbol"])
+        data = asset["data"]
+        for i in range(0, len(data), 20):
+            lines.append("    " + ", ".join("0x%02x" % b for b in data[i:i + 20]) + ",")
+        lines.append("};")
+        lines.append("")
+
+    lines.append("// longest path first, the async server also matches a path as a prefix")
+    lines.append("static const UiAsset UI_ASSETS[] = {")
+    for asset in assets:
+        lines.append('    {"%s", "%s", %s, sizeof(%s), "\\"%s\\""},' % (
+            asset["path"], asset["type"], asset["symbol"], asset["symbol"], asset["etag"]))
+    lines.append("};")
+    lines.append("")
+    return "\n".join(lines)
+
+
+def embed(project_dir):
+    ui_dir = os.path.join(project_dir, "ui")
+    out_path = os.path.join(project_dir, "include", "UiAssets.h")
+
+    assets = []
+    for name in sorted(os.listdir(ui_dir)):
+        source = os.path.join(ui_dir, name)
+        ext = os.path.splitext(name)[1].lower()
+        if not os.path.isfile(source) or ext not in CONTENT_TYPES:
+            continue
+        with open(source, "rb") as f:
+            raw = f.read()
+        assets.append({
+            "path": "" if name == "index.html" else "/" + name,
+            "type": CONTENT_TYPES[ext],
+            "symbol": symbol_for(name),
+            # mtime=0 keeps the output identical for identical input
+            "data": gzip.compress(raw, compresslevel=9, mtime=0),
+            "etag": hashlib.sha1(raw).hexdigest()[:16],
+            "raw": len(raw),
+        })
+    assets.sort(key=lambda a: -len(a["path"]))
+
+    header = render(assets)
+    previous = None
+    if os.path.exists(out_path):
+        with open(out_path) as f:
+            previous = f.read()
+    if header != previous:
+        # only rewritten on change, so an unchanged UI does not rebuild WifiManager.cpp
+        with open(out_path, "w") as f:
+            f.write(header)
+    for asset in assets:
+        print("embed_ui: %s%s %d -> %d bytes" % ("ui", asset["path"] or "/", asset["raw"], len(asset["data"])))
+
+
+try:
+    Import("env")  # noqa: F821 (provided by PlatformIO)
+    PROJECT_DIR = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(sys.argv[0])))
+
+embed(PROJECT_DIR)
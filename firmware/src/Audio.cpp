@@ -3,12 +3,58 @@
 #include "AudioTools.h"
 #include "AudioTools/AudioCodecs/CodecOpus.h"
 #include <WebSocketsClient.h>
+#include <opus.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include "esp_vfs_eventfd.h"
 #include "Audio.h"
-#include "PitchShift.h"
+#include "Log.h"
+#include "DspPipeline.h"
+#include "JitterBuffer.h"
+#include "JsonArena.h"
+#include "Memory.h"
+#include "Doze.h"
+#include "Ota.h"
+#include "Prompts.h"
 
 // WEBSOCKET
-SemaphoreHandle_t wsMutex;
-WebSocketsClient webSocket;
+SelectableWebSocketsClient webSocket; //access from networkTask only (isConnected() is read from other tasks)
+WsTxQueue wsTxQueue; //producer: micTask, consumer: networkTask
+volatile uint32_t wsTxDropped = 0;
+volatile bool wsDisconnectScheduled = false;
+
+// websocketSetup() runs on discoveryTask, the connection itself is opened by networkTask
+static String pendingWsHost;
+static int pendingWsPort = 0;
+static String pendingWsPath;
+static volatile bool websocketSetupScheduled = false;
+
+// The server may have moved since it was cached: after a while without a connection wifiTask
+// runs discovery again
+volatile bool serverRediscoveryScheduled = false; //set by networkTask, consumed by wifiTask
+static const uint32_t SERVER_REDISCOVERY_MS = 15000;
+static bool wsConfigured = false; //access from networkTask only
+static unsigned long wsDownSince = 0; //access from networkTask only
+
+// SESSION RESUMPTION
+// With a "resume_token" in auth the server keeps the session for resume_window_ms after the
+// socket drops. Until then the device keeps its state, reconnects with the token and the last
+// sequence numbers it has seen, and the server answers with "resumed" in its next auth and
+// sends the downlink again from the first packet we had not acked.
+static char resumeToken[65] = ""; //access from networkTask only
+static uint32_t resumeWindowMs = 10000; //access from networkTask only
+static bool sessionSuspended = false; //access from networkTask only
+static unsigned long sessionLostAt = 0; //access from networkTask only
+
+// DOWNLINK SEQUENCE (the header is only parsed when the server asked for it in auth)
+static bool downlinkHeaderEnabled = false; //access from networkTask only
+static bool downlinkSequenceStarted = false; //access from networkTask only
+static uint32_t lastDownlinkSequence = 0; //access from networkTask only
+static uint32_t ackedDownlinkSequence = 0; //access from networkTask only
+static unsigned long lastAckTime = 0; //access from networkTask only
+
+// networkTask sleeps in select() on the socket and this eventfd, other tasks write to it to hand over work
+static int networkWakeFd = -1;
 
 // TASK HANDLES
 TaskHandle_t speakerTaskHandle = NULL;
@@ -17,9 +63,20 @@ TaskHandle_t networkTaskHandle = NULL;
 
 // TIMING REGISTERS
 volatile bool scheduleListeningRestart = false;
-unsigned long scheduledTime = 0;
+volatile unsigned long scheduledTime = 0;
 unsigned long speakingStartTime = 0;
 
+// After RESPONSE.COMPLETE listening starts once the last sample has left the speaker,
+// plus listenTailMs so the end of the reply is not picked up by the mic
+volatile bool listenAfterDrainScheduled = false; //set by networkTask, consumed by audioStreamTask
+volatile int listenTailMs = 100;
+static volatile unsigned long responseCompleteTime = 0;
+static volatile unsigned long playoutEndTime = 0;
+
+// METRICS (turn records live in metrics, these feed its counters)
+volatile uint32_t opusDecodeErrors = 0; //written by audioStreamTask
+volatile bool metricsPushEnabled = false; //send every finished turn over the websocket
+
 // AUDIO SETTINGS
 int currentVolume = 70;
 float currentPitchFactor = 1.0f;
@@ -27,48 +84,38 @@ const int CHANNELS = 1;         // Mono
 const int BITS_PER_SAMPLE = 16; // 16-bit audio
 
 // AUDIO OUTPUT
-class BufferPrint : public Print {
-public:
-  BufferPrint(BufferRTOS<uint8_t>& buf) : _buffer(buf) {}
-
-  // networkTask -> webSocket.loop() -> webSocketEvent(WStype_BIN, ...) -> opusDecoder.write() -> bufferPrint.write()
-  virtual size_t write(uint8_t data) override {
-    if (webSocket.isConnected() && deviceState == SPEAKING) {
-        return _buffer.writeArray(&data, 1);
-    }
-    return 1; //let opusDecoder write, otherwise thread will stuck
-  }
-
-  // networkTask -> webSocket.loop() -> webSocketEvent(WStype_BIN, ...) -> opusDecoder.write() -> bufferPrint.write()
-  virtual size_t write(const uint8_t *buffer, size_t size) override {
-    if (webSocket.isConnected() && deviceState == SPEAKING) {
-        return _buffer.writeArray(buffer, size);
-    }
-    return size; //let opusDecoder write, otherwise thread will stuck
-  }
-
-private:
-  BufferRTOS<uint8_t>& _buffer;
-};
-
-BufferPrint bufferPrint(audioBuffer);
-OpusAudioDecoder opusDecoder;  //access guarded by wsmutex
-BufferRTOS<uint8_t> audioBuffer(AUDIO_BUFFER_SIZE, AUDIO_CHUNK_SIZE);  //producer: networkTask, consumer: audioStreamTask. Thread safe in single producer->single consumer scenario.
+JitterBuffer jitterBuffer; //producer: networkTask, consumer: audioStreamTask
+OpusDecoder *opusDecoder = nullptr; //access from audioStreamTask only
+static int16_t decodedFrame[MAX_DECODED_SAMPLES]; //access from audioStreamTask only
 I2SStream i2s; //access from audioStreamTask only
 
-// OLD with no pitch shift
-VolumeStream volume(i2s); //access from audioStreamTask only
-QueueStream<uint8_t> queue(audioBuffer); //access from audioStreamTask only
-StreamCopy copier(volume, queue);
-
-// NEW for pitch shift (lossy)
-PitchShiftFixedOutput pitchShift(i2s);
-VolumeStream volumePitch(pitchShift); //access from audioStreamTask only
-StreamCopy pitchCopier(volumePitch, queue);
+// gain, pitch shift and resampling in one in place pass, stages picked from the auth message
+DspPipeline playbackDsp(i2s); //access from audioStreamTask only
+// prompts and other local sounds on top of the response, producers: any task, consumer: audioStreamTask
+AudioMixer playbackMixer;
+volatile uint32_t playbackDmaMs = 64; //written by audioStreamTask
+volatile bool playbackDspConfigScheduled = false;
+volatile bool requestedSoftLimiter = false;
 
 AudioInfo info(SAMPLE_RATE, CHANNELS, BITS_PER_SAMPLE);
 volatile bool i2sOutputFlushScheduled = false;
 
+// AUDIO FORMAT
+volatile uint32_t playbackSampleRate = SAMPLE_RATE;
+volatile uint32_t downlinkSampleRate = SAMPLE_RATE;
+volatile uint32_t requestedDownlinkRate = SAMPLE_RATE;
+volatile uint32_t micSampleRate = INPUT_SAMPLE_RATE;
+I2sRequest requestedPlaybackFormat = {SAMPLE_RATE, 0, 0};
+I2sRequest requestedMicFormat = {INPUT_SAMPLE_RATE, 0, 0};
+volatile bool playbackFormatScheduled = false;
+static I2sFormat playbackFormat = {}; //access from audioStreamTask only
+static I2sFormat micFormat = {}; //access from micTask only
+
+// audioStreamTask / micTask: how much audio the DMA chain of a port holds
+static uint32_t dmaDepthMs(uint32_t count, uint32_t size, uint32_t sampleRate) {
+    return count * size * 1000UL / (sampleRate * sizeof(int16_t) * CHANNELS);
+}
+
 unsigned long getSpeakingDuration() {
     if (deviceState == SPEAKING && speakingStartTime > 0) {
         return millis() - speakingStartTime;
@@ -78,143 +125,696 @@ unsigned long getSpeakingDuration() {
 
 // networkTask -> webSocket.loop() -> webSocketEvent(WStype_TEXT, ...) -> transitionToSpeaking()
 void transitionToSpeaking() {
-    vTaskDelay(50);
-
     i2sInputFlushScheduled = true;
     
-    deviceState = SPEAKING;
+    setDeviceState(SPEAKING);
     digitalWrite(I2S_SD_OUT, HIGH);
     speakingStartTime = millis();
+    xTaskNotifyGive(speakerTaskHandle);
+    if (duplexMode) {
+        xTaskNotifyGive(micTaskHandle); // keep listening for a barge in
+    }
     
     // webSocket.enableHeartbeat(30000, 15000, 3);
     
-    Serial.println("Transitioned to speaking mode");
+    LOG_I("Transitioned to speaking mode");
+}
+
+// networkTask -> transitionToListening() / webSocketEvent() -> sendMetrics()
+static void sendMetrics(size_t maxTurns) {
+    static char json[2560]; // fits the full history
+    FixedBufferPrint out(json, sizeof(json));
+    out.print("{\"type\":\"metrics\",\"data\":");
+    metrics.writeJson(out, currentTurnCounters(), maxTurns);
+    out.print("}");
+    if (out.overflowed()) {
+        LOG_W("Metrics message truncated, not sent");
+        return;
+    }
+    if (webSocket.isConnected()) {
+        webSocket.sendTXT(json, out.len());
+    }
 }
 
 // networkTask -> transitionToListening()
 // ( networkTask -> webSocket.loop() -> webSocketEvent(WStype_TEXT, ...) -> (sets scheduleListeningRestart) -> networkTask -> transitionToListening() )
-void transitionToListening() {
-    deviceState = PROCESSING;   
+// ( networkTask -> (bargeInScheduled) -> transitionToListening(false) keeps the speech that interrupted )
+void transitionToListening(bool flushMic = true) {
+    setDeviceState(PROCESSING);   
     scheduleListeningRestart = false;
-    Serial.println("Transitioning to listening mode");
+    listenAfterDrainScheduled = false;
+    LOG_I("Transitioning to listening mode");
 
-    i2sInputFlushScheduled = true;
+    metrics.mark(TURN_LISTENING);
+    metrics.endTurn(currentTurnCounters());
+    if (metricsPushEnabled) {
+        sendMetrics(1);
+    }
+
+    if (responseCompleteTime != 0) {
+        unsigned long now = millis();
+        LOG_I("[TURN] complete -> listening %lu ms, playout ended %ld ms before (tail %d ms)",
+            now - responseCompleteTime, (long)(now - playoutEndTime), listenTailMs);
+        responseCompleteTime = 0;
+    }
+
+    wsTxQueue.clear();
+    if (flushMic) {
+        i2sInputFlushScheduled = true;
+    }
     i2sOutputFlushScheduled = true;
+    xTaskNotifyGive(speakerTaskHandle);
 
-    Serial.println("Transitioned to listening mode");
+    LOG_I("Transitioned to listening mode");
 
-    deviceState = LISTENING;
-    digitalWrite(I2S_SD_OUT, LOW);
+    setDeviceState(LISTENING);
+    if (!playbackMixer.active()) {
+        digitalWrite(I2S_SD_OUT, LOW); // otherwise audioStreamTask once the mixer played out
+    }
+    xTaskNotifyGive(micTaskHandle);
     // webSocket.disableHeartbeat();
 }
 
-// audioStreamTask -> copier.copy() (conditional on webSocket.isConnected())
-void audioStreamTask(void *parameter) {
-    Serial.println("Starting I2S stream pipeline...");
-    
-    pinMode(I2S_SD_OUT, OUTPUT);
+// audioStreamTask -> playDecoded() -> playbackDsp -> i2s
+static void playDecoded(int samples) {
+    if (samples <= 0) {
+        return;
+    }
+    playbackDsp.write(decodedFrame, samples * CHANNELS);
+    metrics.mark(TURN_FIRST_I2S);
+}
 
-    OpusSettings cfg;
-    cfg.sample_rate = SAMPLE_RATE;
-    cfg.channels = CHANNELS;
-    cfg.bits_per_sample = BITS_PER_SAMPLE;
-    cfg.max_buffer_size = 6144;
+// audioStreamTask -> playMixerOnly() -> playbackDsp -> i2s
+// while no response plays: one block of silence for the mixer inputs to be added to
+static void playMixerOnly() {
+    memset(decodedFrame, 0, DspPipeline::BLOCK_SIZE * sizeof(int16_t));
+    playbackDsp.write(decodedFrame, DspPipeline::BLOCK_SIZE);
+}
 
-    xSemaphoreTake(wsMutex, portMAX_DELAY);
-    opusDecoder.setOutput(bufferPrint);
-    opusDecoder.begin(cfg);
-    xSemaphoreGive(wsMutex);
+// audioStreamTask: pick up volume/pitch changes from the auth and RESPONSE.CREATED messages
+static void applyPlaybackDspConfig() {
+    playbackDspConfigScheduled = false;
+    DspPipeline::Config dcfg;
+    dcfg.inputRate = downlinkSampleRate;  // resampled to the port rate when the two differ
+    dcfg.outputRate = playbackSampleRate;
+    dcfg.gain = currentVolume / 100.0f;
+    dcfg.pitch = currentPitchFactor;
+    dcfg.softLimiter = requestedSoftLimiter;
+    playbackDsp.configure(dcfg);
+}
 
-    audioBuffer.setReadMaxWait(0);
-    
-    queue.begin();
+// audioStreamTask -> beginPlaybackI2s()
+// The decoder runs at the downlink rate and the DSP resamples to the port rate, so a new
+// downlink rate only re-inits the decoder; the port itself restarts only when its own rate or
+// DMA geometry changed. Anything still queued for playback is dropped either way, so the auth
+// message asks for it before the first response.
+static void beginPlaybackI2s(bool restart) {
+    playbackFormatScheduled = false;
+    I2sRequest request = requestedPlaybackFormat;
+    uint32_t downlinkRate = requestedDownlinkRate;
 
     auto config = i2s.defaultConfig(TX_MODE);
-    config.bits_per_sample = BITS_PER_SAMPLE;
-    config.sample_rate = SAMPLE_RATE;
-    config.channels = CHANNELS;
-    config.pin_bck = I2S_BCK_OUT;
-    config.pin_ws = I2S_WS_OUT;
-    config.pin_data = I2S_DATA_OUT;
-    config.port_no = I2S_PORT_OUT;
-
-    config.copyFrom(info);  
-    i2s.begin(config);  
-
-    // Initialize both volume streams once
-    auto vcfg = volume.defaultConfig();
-    vcfg.copyFrom(info);
-    vcfg.allow_boost = false;
-    volume.begin(vcfg);
+    uint32_t dmaCount = request.dmaCount ? request.dmaCount : config.buffer_count;
+    uint32_t dmaSize = request.dmaSize ? request.dmaSize : config.buffer_size;
+    bool portChanged = !restart || request.sampleRate != playbackFormat.sampleRate
+        || dmaCount != playbackFormat.dmaCount || dmaSize != playbackFormat.dmaSize;
+    bool downlinkChanged = !restart || downlinkRate != downlinkSampleRate;
+    if (!portChanged && !downlinkChanged) {
+        return;
+    }
+
+    if (downlinkChanged) {
+        if (opus_decoder_init(opusDecoder, downlinkRate, CHANNELS) != OPUS_OK) {
+            LOG_W("Unsupported downlink rate %u Hz, keeping %u Hz", downlinkRate, downlinkSampleRate);
+            downlinkRate = downlinkSampleRate;
+            opus_decoder_init(opusDecoder, downlinkRate, CHANNELS);
+        }
+        downlinkSampleRate = downlinkRate;
+    }
+
+    if (portChanged) {
+        info.sample_rate = request.sampleRate;
+        config.copyFrom(info);
+        config.pin_bck = I2S_BCK_OUT;
+        config.pin_ws = I2S_WS_OUT;
+        config.pin_data = I2S_DATA_OUT;
+        config.port_no = I2S_PORT_OUT;
+        config.buffer_count = dmaCount;
+        config.buffer_size = dmaSize;
+        if (restart) {
+            i2s.end();
+        }
+        i2s.begin(config);
+
+        playbackFormat = {request.sampleRate, dmaCount, dmaSize, dmaDepthMs(dmaCount, dmaSize, request.sampleRate)};
+        playbackSampleRate = request.sampleRate;
+        playbackDmaMs = playbackFormat.dmaMs;
+        echoReference.restart();
+        metrics.setI2sFormat(I2S_PLAYBACK, playbackFormat);
+    }
+
+    // packets queued so far were timed at the old rate
+    jitterBuffer.clear();
+    jitterBuffer.begin(downlinkSampleRate);
+    playbackDsp.reset();
+    applyPlaybackDspConfig();
+    LOG_I("Playback I2S: %u Hz, %u x %u DMA (%u ms), decoding %u Hz", playbackSampleRate, dmaCount, dmaSize,
+        playbackDmaMs, downlinkSampleRate);
+
+    if (restart && portChanged && duplexMode) {
+        uplinkConfigScheduled = true; // the echo reference follows the playback rate and depth
+        xTaskNotifyGive(micTaskHandle);
+    }
+}
+
+// audioStreamTask -> jitterBuffer.next() -> opus_decode() -> playDecoded()
+void audioStreamTask(void *parameter) {
+    LOG_I("Starting I2S stream pipeline...");
     
-    auto vcfgPitch = volumePitch.defaultConfig();
-    vcfgPitch.copyFrom(info);
-    vcfgPitch.allow_boost = false;
-    volumePitch.begin(vcfgPitch);
+    pinMode(I2S_SD_OUT, OUTPUT);
+
+    // opus_decoder_create() would put the ~18 KB state in PSRAM (above the malloc threshold)
+    opusDecoder = (OpusDecoder *)memAlloc(opus_decoder_get_size(CHANNELS), MEM_INTERNAL, "opus decoder");
+    int err = opusDecoder ? opus_decoder_init(opusDecoder, SAMPLE_RATE, CHANNELS) : OPUS_ALLOC_FAIL;
+    if (err != OPUS_OK) {
+        LOG_E("Failed to create Opus decoder: %d", err);
+        vTaskDelete(NULL);
+        return;
+    }
+
+    playbackDsp.setEchoTap(&echoReference);
+    playbackDsp.setMixer(&playbackMixer);
+    beginPlaybackI2s(false);
 
     while (1) {
+        if (playbackFormatScheduled) {
+            beginPlaybackI2s(true);
+        }
+        // How long a late packet may take before we conceal: about half of what the DMA still holds
+        const TickType_t lateWait = pdMS_TO_TICKS(max(1, (int)playbackDmaMs / 2));
+
+        if (playbackDspConfigScheduled) {
+            applyPlaybackDspConfig();
+        }
+
         if ( i2sOutputFlushScheduled) {
             i2sOutputFlushScheduled = false;
             i2s.flush();
-            volume.flush();
-            volumePitch.flush();
-            queue.flush();
+            playbackDsp.reset();
+            echoReference.restart();
+            jitterBuffer.clear();
+            opus_decoder_ctl(opusDecoder, OPUS_RESET_STATE);
+        }
+
+        // the amplifier stays on until the last mixer input played out
+        static bool mixerWasActive = false;
+        bool mixerActive = playbackMixer.active();
+        if (mixerWasActive && !mixerActive && deviceState != SPEAKING) {
+            digitalWrite(I2S_SD_OUT, LOW);
+        }
+        mixerWasActive = mixerActive;
+
+        if (!webSocket.isConnected() || deviceState != SPEAKING) {
+            // nothing is queued outside SPEAKING, the BIN handler drops those packets; sleep
+            // until transitionToSpeaking()/transitionToListening() or a mixer input wake us
+            if (mixerActive) {
+                playMixerOnly();
+            } else {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            }
+            continue;
+        }
+
+        // while the response buffers the mixer inputs go on alone (WAIT below); once it plays
+        // they are only mixed into its frames, so silence is never wedged between two packets
+        bool mixerAlone = mixerActive && !jitterBuffer.playing();
+        if (jitterBuffer.empty() && !mixerAlone) {
+            // every pushed packet wakes us; only a late packet while playing ends in a timeout
+            ulTaskNotifyTake(pdTRUE, jitterBuffer.playing() ? lateWait : portMAX_DELAY);
         }
 
-        if (webSocket.isConnected() && deviceState == SPEAKING) {
-            if (currentPitchFactor != 1.0f) {
-                pitchCopier.copy();
+        const uint8_t *packet = nullptr;
+        size_t length = 0;
+        bool recoverLost = false;
+        switch (jitterBuffer.next(packet, length, recoverLost)) {
+        case JitterBuffer::DECODE:
+        {
+            if (recoverLost) {
+                int frameSamples = opus_packet_get_nb_samples(packet, length, downlinkSampleRate);
+                playDecoded(opus_decode(opusDecoder, packet, length, decodedFrame, frameSamples, 1));
+            }
+            int samples = opus_decode(opusDecoder, packet, length, decodedFrame, MAX_DECODED_SAMPLES, 0);
+            if (samples < 0) {
+                LOG_W_EVERY(1000, "Opus decode failed (%d) for %d byte packet", samples, length);
+                opusDecodeErrors++;
             } else {
-                copier.copy();
+                metrics.mark(TURN_FIRST_DECODE);
+            }
+            bool wasFull = !jitterBuffer.hasRoom();
+            jitterBuffer.release();
+            if (wasFull) {
+                wakeNetworkTask(); // resume reading the socket
             }
+            // blocks in i2s_write until the DMA has room, which is what paces playout
+            playDecoded(samples);
+            break;
         }
-        else {
-            //we should always read from audioBuffer, otherwise writing thread can stuck
-            queue.read();
+        case JitterBuffer::CONCEAL:
+            playDecoded(opus_decode(opusDecoder, NULL, 0, decodedFrame, jitterBuffer.concealmentSamples(), 0));
+            break;
+        case JitterBuffer::WAIT:
+            if (mixerAlone) {
+                playMixerOnly(); // prefilling, the packets so far stay queued
+            }
+            if (listenAfterDrainScheduled && jitterBuffer.drained()) {
+                // the last block is in the DMA now and audible for at most playbackDmaMs more
+                listenAfterDrainScheduled = false;
+                playoutEndTime = millis() + playbackDmaMs;
+                scheduleListeningAt(playoutEndTime + listenTailMs);
+            }
+            if (!mixerAlone && !jitterBuffer.empty()) {
+                // priming: sleep until the next push (or the end of the stream) instead of
+                // spinning above micTask until the target depth is reached
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            }
+            break;
         }
-        vTaskDelay(1); 
     }
 }
 
+// networkTask -> logJitterStats()
+static void logJitterStats() {
+    JitterBuffer::Stats st = jitterBuffer.stats();
+    LOG_I("[JB] target=%ums jitter=%ums peak=%ums underruns=%u overruns=%u plc=%u fec=%u",
+        st.targetMs, st.jitterMs, st.peakJitterMs, st.underruns, st.overruns, st.concealed, st.recovered);
+}
 
+// Mic side of the websocket: frames are only queued here, networkTask does the sendBIN.
+// The mic task never waits for the socket; if the queue is full the frame is dropped.
 class WebsocketStream : public Print {
 public:
-    // micTask -> micToWsCopier.copyBytes() -> wsStream.write()
     virtual size_t write(uint8_t b) override {
-        if (!webSocket.isConnected() || deviceState != LISTENING) {
-            return 1;
-        }
-        
-        xSemaphoreTake(wsMutex, portMAX_DELAY);
-        webSocket.sendBIN(&b, 1);
-        xSemaphoreGive(wsMutex);
-        return 1;
+        return write(&b, 1);
     }
-    
-    // micTask -> micToWsCopier.copyBytes() -> wsStream.write()
+
+    // micTask -> micToWsCopier.copyBytes() -> framer.sendFrame() -> wsStream.write() -> wsTxQueue.push()
     virtual size_t write(const uint8_t *buffer, size_t size) override {
         if (size == 0 || !webSocket.isConnected() || deviceState != LISTENING) {
             return size;
         }
-        
-        xSemaphoreTake(wsMutex, portMAX_DELAY);
-        webSocket.sendBIN(buffer, size);
-        xSemaphoreGive(wsMutex);
+
+        if (!wsTxQueue.push(buffer, size)) {
+            wsTxDropped++;
+        }
+        wakeNetworkTask();
+        return size;
+    }
+
+    // micTask -> framer.sendFrame() -> wsStream.writeFrame() -> wsTxQueue.reserve()
+    // The header is only put on the wire when the server asked for it in the auth message.
+    size_t writeFrame(const UplinkFrameHeader &frameHeader, const uint8_t *payload, size_t size) {
+        if (!uplinkHeaderEnabled) {
+            return write(payload, size);
+        }
+        if (size == 0 || !webSocket.isConnected() || deviceState != LISTENING) {
+            return size;
+        }
+
+        // numbered before the queue can refuse it, so the server sees our own drops as a gap
+        UplinkFrameHeader header = frameHeader;
+        header.sequence = sequence++;
+
+        uint8_t *slot = size + sizeof(header) <= WS_TX_SLOT_SIZE ? wsTxQueue.reserve() : nullptr;
+        if (slot == nullptr) {
+            wsTxDropped++;
+        } else {
+            memcpy(slot, &header, sizeof(header));
+            memcpy(slot + sizeof(header), payload, size);
+            wsTxQueue.commit(sizeof(header) + size);
+        }
+        wakeNetworkTask();
+        return size;
+    }
+
+    bool uplinkHeaderEnabled = false;
+    volatile uint32_t sequence = 0;  // networkTask reads it for the resume headers
+};
+
+WebsocketStream wsStream; //access from micTask only
+
+volatile UplinkVadMode uplinkVadMode = UPLINK_VAD_OFF; //access from micTask only
+VoiceActivityDetector uplinkVad; //access from micTask only
+
+// DUPLEX
+EchoReference echoReference; //producer: audioStreamTask, consumer: micTask
+EchoCanceller echoCanceller; //access from micTask only
+volatile bool duplexMode = false; //set from the auth message
+volatile int requestedAecDelayMs = -1; // -1: derived from the DMA depths
+volatile int requestedBargeInMs = 200;
+volatile bool bargeInScheduled = false; //set by micTask, handled by networkTask
+static bool bargeInActive = false; //access from networkTask only
+static uint32_t aecDelaySamples = 0; //access from micTask only
+volatile uint32_t micDmaMs = 10; //written by micTask
+
+// Accumulates mic PCM into whole frames (10/20/40 ms) so every WS message carries one frame
+// instead of one small StreamCopy chunk. With the VAD on, every frame is classified first;
+// in gate mode silence is held back in a short preroll instead of being sent, and the preroll
+// goes out in front of the first speech frame so the onset of a word is not clipped.
+class UplinkFramer : public Print {
+public:
+    static constexpr size_t MAX_FRAME_SAMPLES = (WS_TX_SLOT_SIZE - sizeof(UplinkFrameHeader)) / sizeof(int16_t);
+    static constexpr size_t PREROLL_SAMPLES = 16000 / 1000 * 300;
+
+    // micTask -> applyUplinkConfig() -> framer.setFrame()
+    void setFrame(uint32_t sampleRate, int frameMs) {
+        _frameMs = frameMs;
+        _frameBytes = (sampleRate / 1000) * frameMs * sizeof(int16_t) * CHANNELS;
+        if (_frameBytes > sizeof(_pcm)) {
+            _frameBytes = sizeof(_pcm);
+        }
+        _fill = 0;
+        _prerollStart = 0;
+        _prerollCount = 0;
+    }
+
+    // drop the partial frame so the next turn starts on a frame boundary
+    void flush() override {
+        _fill = 0;
+        _prerollStart = 0;
+        _prerollCount = 0;
+        _bargeInMs = 0;
+        _prerollOnResume = false;
+    }
+
+    virtual size_t write(uint8_t b) override {
+        return write(&b, 1);
+    }
+
+    // micTask -> micToWsCopier.copyBytes() -> micUplink.write() -> framer.write()
+    virtual size_t write(const uint8_t *buffer, size_t size) override {
+        if (_frameBytes == 0) {
+            return size;
+        }
+
+        size_t consumed = 0;
+        while (consumed < size) {
+            size_t n = min(size - consumed, _frameBytes - _fill);
+            memcpy(((uint8_t *)_pcm) + _fill, buffer + consumed, n);
+            _fill += n;
+            consumed += n;
+
+            if (_fill == _frameBytes) {
+                emitFrame(_pcm, _frameBytes / (sizeof(int16_t) * CHANNELS));
+                _fill = 0;
+            }
+        }
         return size;
     }
+
+protected:
+    virtual void sendFrame(const int16_t *samples, size_t sampleCount, UplinkFrameHeader &header) = 0;
+
+    size_t _frameBytes = 0;
+
+private:
+    // micTask -> framer.write() -> emitFrame() -> uplinkVad.process() -> sendFrame()
+    void emitFrame(const int16_t *samples, size_t sampleCount) {
+        UplinkFrameHeader header = { UPLINK_HEADER_VERSION, 0, 0, 0, 0, (uint32_t)millis() };
+        if (deviceState == SPEAKING) {
+            if (duplexMode) {
+                listenForBargeIn(samples, sampleCount);
+            }
+            return;
+        }
+        if (_prerollOnResume && deviceState != LISTENING) {
+            holdPreroll(samples, sampleCount); // networkTask is still switching over
+            return;
+        }
+        if (_prerollOnResume) {
+            // the speech that interrupted playback goes out first
+            _prerollOnResume = false;
+            header.flags = UPLINK_FLAG_VAD | UPLINK_FLAG_SPEECH;
+            header.speechProbability = 255;
+            sendPreroll(sampleCount, header);
+            header.flags = 0;
+            header.speechProbability = 0;
+        }
+        if (uplinkVadMode == UPLINK_VAD_OFF) {
+            // without the VAD nothing tells speech from silence, so streaming counts as activity
+            noteActivity();
+            sendFrame(samples, sampleCount, header);
+            return;
+        }
+
+        VoiceActivityDetector::Result vad = uplinkVad.process(samples, sampleCount);
+        if (vad.ended) {
+            vadEndScheduled = true;
+            wakeNetworkTask();
+        }
+
+        if (vad.speech) {
+            noteActivity();
+        }
+        header.flags = UPLINK_FLAG_VAD | (vad.speech ? UPLINK_FLAG_SPEECH : 0);
+        header.speechProbability = vad.probability;
+
+        if (uplinkVadMode == UPLINK_VAD_GATE) {
+            if (!vad.speech) {
+                holdPreroll(samples, sampleCount);
+                return;
+            }
+            if (vad.started) {
+                sendPreroll(sampleCount, header);
+            }
+        }
+        sendFrame(samples, sampleCount, header);
+    }
+
+    // Duplex only: nothing is sent while the assistant talks, the echo cancelled mic is kept in
+    // the preroll and enough continuous speech asks networkTask to interrupt the response.
+    // micTask -> framer.write() -> emitFrame() -> listenForBargeIn()
+    void listenForBargeIn(const int16_t *samples, size_t sampleCount) {
+        VoiceActivityDetector::Result vad = uplinkVad.process(samples, sampleCount);
+        holdPreroll(samples, sampleCount);
+
+        _bargeInMs = vad.speech && vad.probability >= BARGE_IN_PROBABILITY ? _bargeInMs + _frameMs : 0;
+        if (_bargeInMs >= (uint32_t)requestedBargeInMs && !_prerollOnResume) {
+            LOG_I("Barge in after %u ms of speech (ERLE %.1f dB)", _bargeInMs, echoCanceller.erleDb());
+            _prerollOnResume = true;
+            bargeInScheduled = true;
+            wakeNetworkTask();
+        }
+    }
+
+    // keeps the newest frames up to PREROLL_SAMPLES, the oldest one is overwritten
+    void holdPreroll(const int16_t *samples, size_t sampleCount) {
+        size_t slots = PREROLL_SAMPLES / sampleCount;
+        if (slots == 0) {
+            return;
+        }
+        if (_prerollCount == slots) {
+            _prerollStart = (_prerollStart + 1) % slots;
+            _prerollCount--;
+        }
+        size_t slot = (_prerollStart + _prerollCount) % slots;
+        memcpy(_preroll + slot * sampleCount, samples, sampleCount * sizeof(int16_t));
+        _prerollCount++;
+    }
+
+    void sendPreroll(size_t sampleCount, const UplinkFrameHeader &onset) {
+        size_t slots = PREROLL_SAMPLES / sampleCount;
+        for (size_t i = 0; i < _prerollCount; i++) {
+            UplinkFrameHeader header = onset;
+            header.timestampMs = onset.timestampMs - (_prerollCount - i) * _frameMs;
+            sendFrame(_preroll + ((_prerollStart + i) % slots) * sampleCount, sampleCount, header);
+        }
+        _prerollStart = 0;
+        _prerollCount = 0;
+    }
+
+    static constexpr uint8_t BARGE_IN_PROBABILITY = 160;
+
+    int16_t _pcm[MAX_FRAME_SAMPLES];
+    size_t _fill = 0;
+    uint32_t _frameMs = 20;
+    uint32_t _bargeInMs = 0;
+    bool _prerollOnResume = false;
+
+    // only one framer is active at a time, so they share the preroll
+    static inline int16_t _preroll[PREROLL_SAMPLES];
+    static inline size_t _prerollStart = 0;
+    static inline size_t _prerollCount = 0;
+};
+
+// Raw PCM uplink: one WS message per frame.
+class PcmUplinkFramer : public UplinkFramer {
+public:
+    PcmUplinkFramer(WebsocketStream &out) : _out(out) {}
+
+protected:
+    void sendFrame(const int16_t *samples, size_t sampleCount, UplinkFrameHeader &header) override {
+        _out.writeFrame(header, (const uint8_t *)samples, sampleCount * sizeof(int16_t) * CHANNELS);
+    }
+
+private:
+    WebsocketStream &_out;
 };
 
-WebsocketStream wsStream; //guard with wsMutex
+// Opus uplink: every frame is encoded and sent as its own WS message.
+// Raw libopus instead of OpusAudioEncoder so the frame boundary is exactly one sendBIN.
+class OpusUplinkEncoder : public UplinkFramer {
+public:
+    OpusUplinkEncoder(WebsocketStream &out) : _out(out) {}
+
+    // micTask -> applyUplinkConfig() -> opusUplinkEncoder.begin()
+    bool begin(uint32_t sampleRate, int frameMs, int bitrate, int complexity) {
+        end();
+
+        // the state is encoded into every frame, keep it out of PSRAM and reuse it across auths
+        if (_encoderState == nullptr) {
+            _encoderState = (OpusEncoder *)memAlloc(opus_encoder_get_size(CHANNELS), MEM_INTERNAL, "opus encoder");
+            if (_encoderState == nullptr) {
+                return false;
+            }
+        }
+        int err = opus_encoder_init(_encoderState, sampleRate, CHANNELS, OPUS_APPLICATION_VOIP);
+        if (err != OPUS_OK) {
+            LOG_E("Failed to create uplink Opus encoder: %d", err);
+            return false;
+        }
+        _encoder = _encoderState;
+        opus_encoder_ctl(_encoder, OPUS_SET_BITRATE(bitrate));
+        opus_encoder_ctl(_encoder, OPUS_SET_COMPLEXITY(complexity));
+        opus_encoder_ctl(_encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+
+        setFrame(sampleRate, frameMs);
+        return true;
+    }
+
+    void end() {
+        _encoder = nullptr;
+        _frameBytes = 0;
+    }
+
+    // drop the partial frame and the encoder history so the next turn starts clean
+    void flush() override {
+        UplinkFramer::flush();
+        if (_encoder) {
+            opus_encoder_ctl(_encoder, OPUS_RESET_STATE);
+        }
+    }
+
+protected:
+    void sendFrame(const int16_t *samples, size_t sampleCount, UplinkFrameHeader &header) override {
+        int len = opus_encode(_encoder, samples, sampleCount, _packet, sizeof(_packet));
+        if (len > 0) {
+            header.flags |= UPLINK_FLAG_OPUS;
+            _out.writeFrame(header, _packet, len);
+        } else if (len < 0) {
+            LOG_W_EVERY(1000, "Uplink Opus encode failed: %d", len);
+        }
+    }
+
+private:
+    static constexpr size_t MAX_PACKET_SIZE = 512;
+
+    WebsocketStream &_out;
+    OpusEncoder *_encoder = nullptr;       // _encoderState once begin() succeeded
+    OpusEncoder *_encoderState = nullptr;  // internal RAM, allocated once
+    uint8_t _packet[MAX_PACKET_SIZE];
+};
+
+// Routes mic PCM either to the PCM framer or through the Opus encoder,
+// depending on what the server negotiated in the auth message.
+class MicUplink : public Print {
+public:
+    MicUplink(Print &pcmOut, Print &opusOut) : _pcmOut(pcmOut), _opusOut(opusOut) {}
+
+    virtual size_t write(uint8_t b) override {
+        return write(&b, 1);
+    }
+
+    // micTask -> micToWsCopier.copyBytes() -> micUplink.write()
+    virtual size_t write(const uint8_t *buffer, size_t size) override {
+        if (!echoReference.enabled()) {
+            return route(buffer, size);
+        }
+
+        // duplex: subtract what the speaker played before anything else sees the mic
+        size_t samplesLeft = size / sizeof(int16_t);
+        const int16_t *in = (const int16_t *)buffer;
+        while (samplesLeft > 0) {
+            size_t n = min(samplesLeft, AEC_CHUNK);
+            memcpy(_mic, in, n * sizeof(int16_t));
+            echoReference.read(_ref, n, aecDelaySamples);
+            echoCanceller.process(_mic, _ref, n);
+            route((const uint8_t *)_mic, n * sizeof(int16_t));
+            in += n;
+            samplesLeft -= n;
+        }
+        return size;
+    }
+
+private:
+    static constexpr size_t AEC_CHUNK = 160;
+
+    size_t route(const uint8_t *buffer, size_t size) {
+        if (uplinkCodec == UPLINK_CODEC_OPUS) {
+            return _opusOut.write(buffer, size);
+        }
+        return _pcmOut.write(buffer, size);
+    }
+
+    Print &_pcmOut;
+    Print &_opusOut;
+    int16_t _mic[AEC_CHUNK];
+    int16_t _ref[AEC_CHUNK];
+};
+
+PcmUplinkFramer pcmUplinkFramer(wsStream); //access from micTask only
+OpusUplinkEncoder opusUplinkEncoder(wsStream); //access from micTask only
+MicUplink micUplink(pcmUplinkFramer, opusUplinkEncoder); //access from micTask only
 I2SStream i2sInput; //access from micTask only
-StreamCopy micToWsCopier(wsStream, i2sInput);
+StreamCopy micToWsCopier(micUplink, i2sInput);
 volatile bool i2sInputFlushScheduled = false;
-const int MIC_COPY_SIZE = 64;
+static size_t micCopySize = 320; // 10 ms at micSampleRate, framers assemble whole frames from this
+
+// UPLINK CODEC (requested by networkTask in the auth message, applied by micTask)
+volatile UplinkCodec uplinkCodec = UPLINK_CODEC_PCM;
+volatile UplinkCodec requestedUplinkCodec = UPLINK_CODEC_PCM;
+volatile int requestedUplinkBitrate = 24000;
+volatile int requestedUplinkComplexity = 3;
+volatile int requestedUplinkFrameMs = 20;
+volatile bool uplinkConfigScheduled = false;
+volatile UplinkVadMode requestedUplinkVadMode = UPLINK_VAD_OFF;
+volatile int requestedUplinkVadEndMs = 700;
+volatile bool requestedUplinkHeader = false;
+volatile bool requestedUplinkSequenceReset = false;
+volatile bool vadEndScheduled = false; //set by micTask, sent by networkTask
+
+// the filter starts this much before the bulk delay, so early echo still falls inside it
+static constexpr int AEC_LEAD_MS = 4;
+
+// micTask -> (applyUplinkConfig()) -> beginMicI2s()
+// (re)starts the input port at the requested rate and DMA geometry
+static void beginMicI2s(bool restart) {
+    I2sRequest request = requestedMicFormat;
+    if (request.sampleRate != 8000 && request.sampleRate != 16000) {
+        // the uplink slots, the echo reference and the preroll are sized for 16 kHz at most
+        LOG_W("Unsupported uplink rate %u Hz, keeping %u Hz", request.sampleRate, micSampleRate);
+        request.sampleRate = micSampleRate;
+    }
 
-void micTask(void *parameter) {
-    // Configure and start I2S input stream.
     auto i2sConfig = i2sInput.defaultConfig(RX_MODE);
+    uint32_t dmaCount = request.dmaCount ? request.dmaCount : i2sConfig.buffer_count;
+    uint32_t dmaSize = request.dmaSize ? request.dmaSize : i2sConfig.buffer_size;
+    if (restart && request.sampleRate == micFormat.sampleRate
+        && dmaCount == micFormat.dmaCount && dmaSize == micFormat.dmaSize) {
+        return;
+    }
+
     i2sConfig.bits_per_sample = BITS_PER_SAMPLE;
-    i2sConfig.sample_rate = INPUT_SAMPLE_RATE;
+    i2sConfig.sample_rate = request.sampleRate;
     i2sConfig.channels = CHANNELS;
     i2sConfig.i2s_format = I2S_LEFT_JUSTIFIED_FORMAT;
     i2sConfig.channel_format = I2S_CHANNEL_FMT_ONLY_LEFT;
@@ -223,26 +823,497 @@ void micTask(void *parameter) {
     i2sConfig.pin_ws  = I2S_WS;
     i2sConfig.pin_data = I2S_SD;
     i2sConfig.port_no = I2S_PORT_IN;
+    i2sConfig.buffer_count = dmaCount;
+    i2sConfig.buffer_size = dmaSize;
+    if (restart) {
+        i2sInput.end();
+    }
     i2sInput.begin(i2sConfig);
 
+    // a sample waits in at most one DMA buffer before i2s_read gets it
+    micFormat = {request.sampleRate, dmaCount, dmaSize, dmaDepthMs(1, dmaSize, request.sampleRate)};
+    micSampleRate = request.sampleRate;
+    micDmaMs = micFormat.dmaMs;
+    micCopySize = request.sampleRate / 100 * sizeof(int16_t) * CHANNELS;
+    metrics.setI2sFormat(I2S_MIC, micFormat);
+    LOG_I("Mic I2S: %u Hz, %u x %u DMA", request.sampleRate, dmaCount, dmaSize);
+}
+
+// micTask -> applyUplinkConfig()
+static void applyUplinkConfig() {
+    uplinkConfigScheduled = false;
+    beginMicI2s(true);
+
+    int frameMs = requestedUplinkFrameMs;
+    if (frameMs != 10 && frameMs != 20 && frameMs != 40) {
+        LOG_W("Unsupported uplink frame of %d ms, using 20 ms", frameMs);
+        frameMs = 20;
+    }
+
+    // Duplex: the reference is only captured while the canceller is in use
+    echoReference.setEnabled(false);
+    if (duplexMode) {
+        int delayMs = requestedAecDelayMs >= 0 ? requestedAecDelayMs
+                    : max(0, (int)(playbackDmaMs + micDmaMs) - AEC_LEAD_MS);
+        aecDelaySamples = micSampleRate / 1000 * delayMs;
+        echoReference.configure(playbackSampleRate, micSampleRate, playbackDmaMs);
+        echoCanceller.reset();
+        echoReference.setEnabled(true);
+        LOG_I("Duplex: AEC bulk delay %d ms, barge in after %d ms", delayMs, requestedBargeInMs);
+    }
+
+    wsStream.uplinkHeaderEnabled = requestedUplinkHeader;
+    if (requestedUplinkSequenceReset) {
+        requestedUplinkSequenceReset = false;
+        wsStream.sequence = 0;
+    }
+    uplinkVadMode = requestedUplinkVadMode;
+    uplinkVad.begin(micSampleRate, frameMs, requestedUplinkVadEndMs);
+    if (uplinkVadMode != UPLINK_VAD_OFF) {
+        LOG_I("Uplink VAD: %s, vad_end after %d ms",
+            uplinkVadMode == UPLINK_VAD_GATE ? "gate" : "flag", requestedUplinkVadEndMs);
+    }
+
+    if (requestedUplinkCodec == UPLINK_CODEC_OPUS) {
+        if (opusUplinkEncoder.begin(micSampleRate, frameMs, requestedUplinkBitrate, requestedUplinkComplexity)) {
+            uplinkCodec = UPLINK_CODEC_OPUS;
+            LOG_I("Uplink codec: opus (%d bps, %d ms frames)", requestedUplinkBitrate, frameMs);
+            return;
+        }
+        LOG_W("Falling back to PCM uplink");
+    }
+
+    opusUplinkEncoder.end();
+    pcmUplinkFramer.setFrame(micSampleRate, frameMs);
+    uplinkCodec = UPLINK_CODEC_PCM;
+    LOG_I("Uplink codec: pcm (%d ms frames)", frameMs);
+}
+
+void micTask(void *parameter) {
+    // Configure and start I2S input stream.
+    beginMicI2s(false);
+
     micToWsCopier.setDelayOnNoData(0);
+    applyUplinkConfig();
 
     while (1) {
+        if ( uplinkConfigScheduled ) {
+            applyUplinkConfig();
+        }
+
         if ( i2sInputFlushScheduled ) {
             i2sInputFlushScheduled = false;
             i2sInput.flush();
+            pcmUplinkFramer.flush();
+            opusUplinkEncoder.flush();
+            uplinkVad.reset();
         }
 
-        if (deviceState == LISTENING && webSocket.isConnected()) {
-            // Use smaller chunk size to avoid blocking too long
-            micToWsCopier.copyBytes(MIC_COPY_SIZE);
-            
-            // Yield more frequently
-            vTaskDelay(1);
+        if ((deviceState == LISTENING || (duplexMode && deviceState == SPEAKING)) && webSocket.isConnected()) {
+            // Read in 10 ms chunks; i2s_read blocks until the DMA has them, the framers
+            // only hit the websocket once per whole frame
+            micToWsCopier.copyBytes(micCopySize);
         } else {
-            vTaskDelay(10);
+            // sleep until transitionToListening() wakes us
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+}
+
+// CONTROL MESSAGES
+// Text frames are parsed into a fixed arena through a filter that keeps only the fields below,
+// so transcripts and other long texts the device does not read cost nothing, then routed by
+// type (and msg for "server") through CONTROL_ROUTES. New messages need a route, and their
+// fields listed in CONTROL_FIELDS.
+static const char *const CONTROL_FIELDS[] = {
+    "type", "msg", "volume_control", "pitch_factor", "is_reset",
+    "uplink_codec", "uplink_bitrate", "uplink_complexity", "uplink_frame_ms", "uplink_header",
+    "vad", "vad_end_ms", "duplex", "aec_delay_ms", "barge_in_ms",
+    "listen_tail_ms", "metrics", "soft_limiter", "doze_after_ms",
+    "resume_token", "resume_window_ms", "resumed", "downlink_header",
+    "size", "sha256", "offset", "prompts", "hash", "name",
+    "downlink_rate", "playback_rate", "uplink_rate", "playback_dma_count", "playback_dma_size", "mic_dma_count", "mic_dma_size",
+};
+
+static StaticJsonArena<4096> controlArena; //access from networkTask only
+// ArduinoJson 7 takes its first variant pool (128 slots, 1 to 2 KB on 32 bit) in one block and
+// copies every key next to it; buildControlFilter() logs the peak so the size can follow the list
+static StaticJsonArena<4096> controlFilterArena; //written by setup() only
+static JsonDocument controlFilterDoc(&controlFilterArena);
+static bool controlFilterReady = false;
+
+// networkTask -> applyWebsocketSetup() / webSocketEvent() -> setWsHeaders()
+// the resume headers go out with every reconnect until the server has answered
+static void setWsHeaders(bool resume)
+{
+    String headers = "Authorization: Bearer " + String(authTokenGlobal);
+    if (resume) {
+        headers += "\r\nX-Resume-Token: " + String(resumeToken);
+        headers += "\r\nX-Resume-Downlink-Seq: " + String(downlinkSequenceStarted ? lastDownlinkSequence : 0);
+        headers += "\r\nX-Resume-Uplink-Seq: " + String(wsStream.sequence);
+    }
+    webSocket.setExtraHeaders(headers.c_str());
+}
+
+// networkTask -> webSocketEvent() / networkTask() -> forgetSession()
+static void forgetSession()
+{
+    resumeToken[0] = '\0';
+    if (sessionSuspended) {
+        sessionSuspended = false;
+        setWsHeaders(false);
+    }
+}
+
+// networkTask -> webSocketEvent() -> onAuth() -> dmaRequest()
+// 0 (not asked for) keeps the AudioTools default, anything else is clamped to what the driver takes
+static uint16_t dmaRequest(JsonVariantConst value, uint16_t low, uint16_t high)
+{
+    uint32_t requested = value | 0u;
+    return requested == 0 ? 0 : (uint16_t)constrain(requested, (uint32_t)low, (uint32_t)high);
+}
+
+// networkTask -> webSocketEvent() -> onAuth()
+static void onAuth(JsonDocument &doc)
+{
+    // Resumption: the auth after a reconnect says whether the server still had our session
+    bool resumed = sessionSuspended && (doc["resumed"] | false);
+    if (resumed) {
+        LOG_I("[WSc] Session resumed after %lu ms", millis() - sessionLostAt);
+    } else {
+        if (sessionSuspended) {
+            LOG_I("[WSc] Session was not resumed, starting over");
+            setDeviceState(PROCESSING);
+            i2sOutputFlushScheduled = true;
+        }
+        downlinkSequenceStarted = false;
+        ackedDownlinkSequence = 0;
+        requestedUplinkSequenceReset = true;
+    }
+    sessionSuspended = false;
+    otaMarkValid(); // this image got as far as the server
+    strlcpy(resumeToken, doc["resume_token"] | "", sizeof(resumeToken));
+    resumeWindowMs = doc["resume_window_ms"] | 10000;
+    downlinkHeaderEnabled = doc["downlink_header"] | false;
+    setWsHeaders(false);
+
+    currentVolume = doc["volume_control"].as<int>();
+    currentPitchFactor = doc["pitch_factor"].as<float>();
+
+    bool is_reset = doc["is_reset"].as<bool>();
+
+    // Uplink codec: servers that don't send "uplink_codec" keep receiving raw PCM
+    const char *codec = doc["uplink_codec"] | "pcm";
+    requestedUplinkCodec = strcmp(codec, "opus") == 0 ? UPLINK_CODEC_OPUS : UPLINK_CODEC_PCM;
+    requestedUplinkBitrate = doc["uplink_bitrate"] | 24000;
+    requestedUplinkComplexity = doc["uplink_complexity"] | 3;
+    requestedUplinkFrameMs = doc["uplink_frame_ms"] | 20;
+
+    // On-device VAD: "flag" marks speech and sends vad_end, "gate" also holds back silence
+    const char *vad = doc["vad"] | "off";
+    requestedUplinkVadMode = strcmp(vad, "gate") == 0 ? UPLINK_VAD_GATE
+                           : strcmp(vad, "flag") == 0 ? UPLINK_VAD_FLAG : UPLINK_VAD_OFF;
+    requestedUplinkVadEndMs = doc["vad_end_ms"] | 700;
+    requestedUplinkHeader = doc["uplink_header"] | false;
+
+    // Duplex: keep the mic open while speaking so the user can interrupt
+    duplexMode = doc["duplex"] | false;
+    requestedAecDelayMs = doc["aec_delay_ms"] | -1;
+    requestedBargeInMs = doc["barge_in_ms"] | 200;
+
+    // Quiet time between the end of playout and reopening the mic
+    listenTailMs = doc["listen_tail_ms"] | 100;
+
+    // Local clips, the missing ones are requested right away
+    promptsConfigure(doc["prompts"].as<JsonObjectConst>());
+
+    // Push the latency record of every turn once listening resumes
+    metricsPushEnabled = doc["metrics"] | false;
+
+    // Audio format: rates and I2S DMA depth per port, small buffers trade robustness for
+    // latency. A port only restarts when its format changed, so a resumed session keeps playing.
+    // downlink_rate is what the server encodes at, playback_rate what the speaker port runs at
+    // (up to 3x the downlink rate); the DSP resamples between the two.
+    requestedDownlinkRate = doc["downlink_rate"] | SAMPLE_RATE;
+    requestedPlaybackFormat = {doc["playback_rate"] | SAMPLE_RATE,
+        dmaRequest(doc["playback_dma_count"], I2S_DMA_COUNT_MIN, I2S_DMA_COUNT_MAX),
+        dmaRequest(doc["playback_dma_size"], I2S_DMA_SIZE_MIN, I2S_DMA_SIZE_MAX)};
+    requestedMicFormat = {doc["uplink_rate"] | INPUT_SAMPLE_RATE,
+        dmaRequest(doc["mic_dma_count"], I2S_DMA_COUNT_MIN, I2S_DMA_COUNT_MAX),
+        dmaRequest(doc["mic_dma_size"], I2S_DMA_SIZE_MIN, I2S_DMA_SIZE_MAX)};
+    playbackFormatScheduled = true;
+    xTaskNotifyGive(speakerTaskHandle);
+
+    // Low power idle after this long without activity; opt-in, 0 keeps the device awake
+    dozeAfterMs = doc["doze_after_ms"] | 0;
+    uplinkConfigScheduled = true;
+
+    // The playback stages are rebuilt on audioStreamTask before the next frame
+    requestedSoftLimiter = doc["soft_limiter"] | false;
+    playbackDspConfigScheduled = true;
+
+    if (is_reset) {
+        LOG_I("Factory reset received");
+        // setFactoryResetStatusInNVS(true);
+        ESP.restart();
+    }
+}
+
+// networkTask -> webSocketEvent() -> onMetricsRequest()
+// the server asks for the latency records
+static void onMetricsRequest(JsonDocument &)
+{
+    sendMetrics(Metrics::TURN_HISTORY);
+}
+
+// networkTask -> webSocketEvent() -> onResponseComplete()
+// RESPONSE.COMPLETE and RESPONSE.ERROR
+static void onResponseComplete(JsonDocument &)
+{
+    metrics.mark(TURN_COMPLETE);
+    jitterBuffer.endStream();
+    logJitterStats();
+    if (bargeInActive) {
+        // already listening since the barge in, restarting would cut the user off
+        bargeInActive = false;
+    } else if (deviceState == SPEAKING) {
+        // audioStreamTask schedules the restart once the queued audio has played out
+        LOG_I("Received RESPONSE.COMPLETE or RESPONSE.ERROR, listening after playout");
+        responseCompleteTime = millis();
+        listenAfterDrainScheduled = true;
+        xTaskNotifyGive(speakerTaskHandle);
+    } else {
+        LOG_I("Received RESPONSE.COMPLETE or RESPONSE.ERROR, starting listening again");
+        responseCompleteTime = millis();
+        playoutEndTime = responseCompleteTime;
+        scheduleListeningAt(responseCompleteTime + listenTailMs);
+    }
+}
+
+// networkTask -> webSocketEvent() -> onAudioCommitted()
+static void onAudioCommitted(JsonDocument &)
+{
+    metrics.beginTurn(currentTurnCounters());
+    metrics.mark(TURN_COMMITTED);
+    setDeviceState(PROCESSING);
+    promptPlayNamed(PROMPT_THINKING); // fills the wait for the response, if the server set one
+}
+
+// networkTask -> webSocketEvent() -> onResponseCreated()
+static void onResponseCreated(JsonDocument &doc)
+{
+    LOG_I("Received RESPONSE.CREATED, transitioning to speaking");
+    if (!metrics.turnOpen()) {
+        metrics.beginTurn(currentTurnCounters()); // e.g. the greeting, nothing was committed
+    }
+    metrics.mark(TURN_CREATED);
+    exitDoze(false); // e.g. a server initiated message, I2S has to run again
+    bargeInActive = false;
+    jitterBuffer.startStream();
+
+    // Check if volume_control is included in the message
+    if (doc["volume_control"].is<int>()) {
+        currentVolume = doc["volume_control"].as<int>();
+        playbackDspConfigScheduled = true;
+    }
+
+    promptStop(); // the thinking clip fades out under the response
+    transitionToSpeaking();
+}
+
+// networkTask -> webSocketEvent() -> onSessionEnd()
+static void onSessionEnd(JsonDocument &)
+{
+    LOG_I("Received SESSION.END, entering sleep");
+    sleepRequested = true;
+}
+
+// networkTask -> onOta*() -> sendOtaStatus()
+static void sendOtaStatus(const char *msg)
+{
+    char text[160];
+    snprintf(text, sizeof(text), "{\"type\":\"ota\",\"msg\":\"%s\",\"offset\":%u,\"error\":\"%s\"}",
+             msg, (unsigned)otaReceived(), otaError());
+    webSocket.sendTXT(text);
+}
+
+// networkTask -> onPrompt*() -> sendPromptStatus()
+static void sendPromptStatus(const char *msg, const char *hash)
+{
+    char text[128];
+    snprintf(text, sizeof(text), "{\"type\":\"prompt\",\"msg\":\"%s\",\"hash\":\"%s\"}", msg, hash);
+    webSocket.sendTXT(text);
+}
+
+// networkTask -> webSocketEvent() -> onPromptStore()
+static void onPromptStore(JsonDocument &doc)
+{
+    const char *hash = doc["hash"] | "";
+    if (promptCached(hash)) {
+        sendPromptStatus("cached", hash);
+    } else if (!promptStoreBegin(hash, doc["size"] | 0u)) {
+        sendPromptStatus("error", hash);
+    }
+}
+
+// networkTask -> webSocketEvent() -> onPromptCommit()
+static void onPromptCommit(JsonDocument &doc)
+{
+    const char *hash = doc["hash"] | "";
+    sendPromptStatus(promptStoreCommit() ? "cached" : "error", hash);
+}
+
+// networkTask -> webSocketEvent() -> onPromptPlay()
+static void onPromptPlay(JsonDocument &doc)
+{
+    const char *hash = doc["hash"] | "";
+    bool played = doc["name"].is<const char *>() ? promptPlayNamed(doc["name"].as<const char *>()) : promptPlay(hash);
+    if (!played && !promptCached(hash) && hash[0] != '\0') {
+        sendPromptStatus("missing", hash);
+    }
+}
+
+static size_t otaReportedOffset = 0; //access from networkTask only
+
+// networkTask -> webSocketEvent() -> onOtaBegin()
+// answered with "ready" and the offset to continue from, see Ota.h
+static void onOtaBegin(JsonDocument &doc)
+{
+    bool ok = otaBegin(OTA_SOURCE_WEBSOCKET, doc["size"] | 0u, doc["sha256"] | "", doc["offset"] | 0u);
+    otaReportedOffset = otaReceived();
+    sendOtaStatus(ok ? "ready" : "error");
+}
+
+// networkTask -> webSocketEvent(WStype_BIN, ...) -> onOtaChunk()
+static void onOtaChunk(uint32_t offset, const uint8_t *data, size_t length)
+{
+    if (!otaWrite(OTA_SOURCE_WEBSOCKET, offset, data, length)) {
+        sendOtaStatus("error");
+        return;
+    }
+    if (otaReceived() - otaReportedOffset >= OTA_PROGRESS_BYTES) {
+        otaReportedOffset = otaReceived();
+        sendOtaStatus("progress");
+    }
+}
+
+// networkTask -> webSocketEvent() -> onOtaEnd()
+static void onOtaEnd(JsonDocument &)
+{
+    sendOtaStatus(otaFinish(OTA_SOURCE_WEBSOCKET) ? "done" : "error");
+}
+
+// networkTask -> webSocketEvent() -> onOtaAbort()
+static void onOtaAbort(JsonDocument &)
+{
+    otaAbort("aborted by the server");
+    sendOtaStatus("aborted");
+}
+
+struct ControlRoute
+{
+    const char *type;
+    const char *msg;  // nullptr: any msg
+    void (*handler)(JsonDocument &doc);
+};
+
+static constexpr ControlRoute CONTROL_ROUTES[] = {
+    {"auth",    nullptr,             onAuth},
+    {"metrics", nullptr,             onMetricsRequest},
+    {"server",  "RESPONSE.COMPLETE", onResponseComplete},
+    {"server",  "RESPONSE.ERROR",    onResponseComplete},
+    {"server",  "AUDIO.COMMITTED",   onAudioCommitted},
+    {"server",  "RESPONSE.CREATED",  onResponseCreated},
+    {"server",  "SESSION.END",       onSessionEnd},
+    {"ota",     "begin",             onOtaBegin},
+    {"ota",     "end",               onOtaEnd},
+    {"ota",     "abort",             onOtaAbort},
+    {"prompt",  "store",             onPromptStore},
+    {"prompt",  "commit",            onPromptCommit},
+    {"prompt",  "play",              onPromptPlay},
+};
+
+// setup() -> allocateAudioBuffers() -> buildControlFilter()
+// once, networkTask only ever reads the filter
+static bool buildControlFilter()
+{
+    for (const char *field : CONTROL_FIELDS) {
+        controlFilterDoc[field] = true;
+    }
+    controlFilterReady = !controlFilterDoc.overflowed();
+    if (!controlFilterReady) {
+        // parsed unfiltered instead, long messages may then run out of controlArena
+        LOG_E("Control filter does not fit: %u of %u bytes used", (unsigned)controlFilterArena.peak(),
+              (unsigned)controlFilterArena.capacity());
+    } else {
+        LOG_D("Control filter: %u of %u bytes", (unsigned)controlFilterArena.peak(), (unsigned)controlFilterArena.capacity());
+    }
+    return controlFilterReady;
+}
+
+// networkTask -> webSocketEvent(WStype_TEXT, ...) -> dispatchControlMessage()
+static void dispatchControlMessage(const uint8_t *payload, size_t length)
+{
+    LOG_D("[WSc] get text: %.*s", (int)length, (const char *)payload);
+
+    controlArena.reset();
+    JsonDocument doc(&controlArena);
+    DeserializationError error = controlFilterReady
+        ? deserializeJson(doc, (const char *)payload, length, DeserializationOption::Filter(controlFilterDoc))
+        : deserializeJson(doc, (const char *)payload, length);
+    if (error) {
+        LOG_E("Error deserializing JSON: %s (%u byte message)", error.c_str(), (unsigned)length);
+        setDeviceState(IDLE);
+        return;
+    }
+
+    const char *type = doc["type"] | "";
+    const char *msg = doc["msg"] | "";
+    noteActivity();
+    LOG_D("[WSc] %s: %s", type, msg);
+
+    for (const ControlRoute &route : CONTROL_ROUTES) {
+        if (strcmp(route.type, type) == 0 && (route.msg == nullptr || strcmp(route.msg, msg) == 0)) {
+            route.handler(doc);
+            return;
+        }
+    }
+}
+
+// networkTask -> webSocketEvent(WStype_BIN, ...) -> acceptDownlinkSequence()
+// false for a packet we already have, e.g. replayed after a resume; gap when some went missing
+static bool acceptDownlinkSequence(uint32_t sequence, bool &gap)
+{
+    if (downlinkSequenceStarted) {
+        int32_t delta = (int32_t)(sequence - lastDownlinkSequence);
+        if (delta <= 0) {
+            LOG_D("Dropped duplicate downlink packet %u", (unsigned)sequence);
+            return false;
+        }
+        if (delta > 1) {
+            LOG_W_EVERY(1000, "Downlink gap: %d packets missing before %u", (int)(delta - 1), (unsigned)sequence);
+            gap = true;
         }
     }
+    downlinkSequenceStarted = true;
+    lastDownlinkSequence = sequence;
+    return true;
+}
+
+// networkTask -> sendDownlinkAck()
+static void sendDownlinkAck()
+{
+    if (!downlinkSequenceStarted || lastDownlinkSequence == ackedDownlinkSequence || !webSocket.isConnected()) {
+        return;
+    }
+    if (millis() - lastAckTime < DOWNLINK_ACK_INTERVAL_MS) {
+        return;
+    }
+    char ack[48];
+    snprintf(ack, sizeof(ack), "{\"type\":\"ack\",\"seq\":%u}", (unsigned)lastDownlinkSequence);
+    webSocket.sendTXT(ack);
+    ackedDownlinkSequence = lastDownlinkSequence;
+    lastAckTime = millis();
 }
 
 // WEBSOCKET EVENTS
@@ -252,100 +1323,89 @@ void webSocketEvent(WStype_t type, uint8_t *payload, size_t length)
     switch (type)
     {
     case WStype_DISCONNECTED:
-        Serial.printf("[WSc] Disconnected!\n");
-        deviceState = IDLE;
+        LOG_I("[WSc] Disconnected!");
+        if (resumeToken[0] != '\0' && deviceState != SLEEP) {
+            // keep the state, networkTask gives up once the resume window has passed
+            if (!sessionSuspended) {
+                sessionSuspended = true;
+                sessionLostAt = millis();
+                setWsHeaders(true);
+                LOG_I("[WSc] Keeping the session for %u ms", (unsigned)resumeWindowMs);
+            }
+            break;
+        }
+        if (deviceState != SLEEP) {
+            promptPlayNamed(PROMPT_CONNECTION_ERROR);
+        }
+        setDeviceState(IDLE);
         break;
     case WStype_CONNECTED:
-        Serial.printf("[WSc] Connected to url: %s\n", payload);
-        deviceState = PROCESSING;
+        LOG_I("[WSc] Connected to url: %s", payload);
+        if (!sessionSuspended) {
+            setDeviceState(PROCESSING);
+        }
         break;
     case WStype_TEXT:
+        dispatchControlMessage(payload, length);
+        break;
+    case WStype_BIN:
     {
-        Serial.printf("[WSc] get text: %s\n", payload);
-
-        JsonDocument doc;
-        DeserializationError error = deserializeJson(doc, (char *)payload);
-
-        if (error)
-        {
-            Serial.println("Error deserializing JSON");
-            deviceState = IDLE;
-            return;
-        }
-
-        String type = doc["type"];
-
-        // auth messages
-        if (strcmp((char*)type.c_str(), "auth") == 0) {
-            currentVolume = doc["volume_control"].as<int>();
-            currentPitchFactor = doc["pitch_factor"].as<float>();
-
-            bool is_reset = doc["is_reset"].as<bool>();
-
-            // Update volumes on both streams
-            volume.setVolume(currentVolume / 100.0f);
-            volumePitch.setVolume(currentVolume / 100.0f);
-            
-            // Only initialize pitch shift if needed
-            if (currentPitchFactor != 1.0f) {
-                auto pcfg = pitchShift.defaultConfig();
-                pcfg.copyFrom(info);
-                pcfg.pitch_shift = currentPitchFactor;
-                pcfg.buffer_size = 512;
-                pitchShift.begin(pcfg);
-            }
-
-            if (is_reset) {
-                Serial.println("Factory reset received");
-                // setFactoryResetStatusInNVS(true);
-                ESP.restart();
+        // firmware chunks share the binary channel with audio, told apart by their magic
+        if (otaActive() && length >= sizeof(OtaChunkHeader)) {
+            OtaChunkHeader chunk;
+            memcpy(&chunk, payload, sizeof(chunk));
+            if (chunk.magic == OTA_CHUNK_MAGIC) {
+                onOtaChunk(chunk.offset, payload + sizeof(chunk), length - sizeof(chunk));
+                break;
             }
         }
-
-        // oai messages
-        if (strcmp((char*)type.c_str(), "server") == 0) {
-            String msg = doc["msg"];
-            Serial.println(msg);
-
-            if (strcmp((char*)msg.c_str(), "RESPONSE.COMPLETE") == 0 || strcmp((char*)msg.c_str(), "RESPONSE.ERROR") == 0) {
-                Serial.println("Received RESPONSE.COMPLETE or RESPONSE.ERROR, starting listening again");
-                scheduleListeningRestart = true;
-                scheduledTime = millis() + 1000; // 1 second delay
-            } else if (strcmp((char*)msg.c_str(), "AUDIO.COMMITTED") == 0) {
-                deviceState = PROCESSING; 
-            } else if (strcmp((char*)msg.c_str(), "RESPONSE.CREATED") == 0) {
-                Serial.println("Received RESPONSE.CREATED, transitioning to speaking");
-
-                                // Check if volume_control is included in the message
-                if (doc.containsKey("volume_control")) {
-                    int newVolume = doc["volume_control"].as<int>();
-                    volume.setVolume(newVolume / 100.0f);
+        if (promptStoring() && length >= sizeof(PromptChunkHeader)) {
+            PromptChunkHeader chunk;
+            memcpy(&chunk, payload, sizeof(chunk));
+            if (chunk.magic == PROMPT_CHUNK_MAGIC) {
+                if (!promptStoreWrite(chunk.offset, payload + sizeof(chunk), length - sizeof(chunk))) {
+                    LOG_W_EVERY(1000, "Prompt chunk at %u refused", (unsigned)chunk.offset);
                 }
+                break;
+            }
+        }
 
-                transitionToSpeaking();
-            } else if (strcmp((char*)msg.c_str(), "SESSION.END") == 0) {
-                Serial.println("Received SESSION.END, entering sleep");
-                sleepRequested = true;
+        // skipped packets still count as seen, the ack tells the server not to send them again
+        bool gap = false;
+        if (downlinkHeaderEnabled) {
+            if (length < sizeof(DownlinkFrameHeader)) {
+                LOG_W_EVERY(1000, "Dropped %d byte audio packet, shorter than its header", length);
+                break;
+            }
+            DownlinkFrameHeader header;
+            memcpy(&header, payload, sizeof(header));
+            payload += sizeof(header);
+            length -= sizeof(header);
+            if (!acceptDownlinkSequence(header.sequence, gap)) {
+                break;
             }
         }
-    }
-        break;
-    case WStype_BIN:
-    {
+
         if (scheduleListeningRestart || deviceState != SPEAKING) {
-            Serial.println("Skipping audio data due to touch interrupt.");
+            LOG_I_EVERY(1000, "Skipping audio data due to touch interrupt");
             break;
         }
 
-        // Otherwise process the audio data normally
-        size_t processed = opusDecoder.write(payload, length);
-        if (processed != length) {
-            Serial.printf("Warning: Only processed %d/%d bytes\n", processed, length);
+        metrics.mark(TURN_FIRST_BIN);
+        if (gap) {
+            jitterBuffer.markLost();
+        }
+
+        // Only hand the packet over, decoding happens on audioStreamTask
+        if (!jitterBuffer.push(payload, length)) {
+            LOG_W_EVERY(1000, "Dropped %d byte audio packet, jitter buffer full", length);
+            break;
         }
+        xTaskNotifyGive(speakerTaskHandle);
         break;
       }
     case WStype_ERROR:
-        Serial.printf("[WSc] Error: %s\n", payload);    
+        LOG_E("[WSc] Error: %s", payload);    
         break;
     case WStype_FRAGMENT_TEXT_START:
     case WStype_FRAGMENT_BIN_START:
@@ -357,36 +1417,225 @@ void webSocketEvent(WStype_t type, uint8_t *payload, size_t length)
     }
 }
 
-// wifiTask -> WIFIMANAGER::loop() -> WIFIMANAGER::tryConnect() -> connectCb() -> websocketSetup()
+// discoveryTask -> onServerDiscovered() -> websocketSetup()
 void websocketSetup(const String& server_domain, int port, const String& path)
 {
-    // Include both auth token and client type header
-    String headers = "Authorization: Bearer " + String(authTokenGlobal);
+    while (websocketSetupScheduled) {
+        vTaskDelay(1);
+    }
+    pendingWsHost = server_domain;
+    pendingWsPort = port;
+    pendingWsPath = path;
+    websocketSetupScheduled = true;
+    wakeNetworkTask();
+}
 
-    xSemaphoreTake(wsMutex, portMAX_DELAY);
+// networkTask / async_tcp (/api/metrics) -> currentTurnCounters()
+TurnCounters currentTurnCounters()
+{
+    JitterBuffer::Stats st = jitterBuffer.stats();
+    TurnCounters counters;
+    counters.underruns = st.underruns;
+    counters.overruns = st.overruns;
+    counters.concealed = st.concealed;
+    counters.recovered = st.recovered;
+    counters.decodeErrors = opusDecodeErrors;
+    counters.uplinkDrops = wsTxDropped;
+    return counters;
+}
 
-    webSocket.setExtraHeaders(headers.c_str());
+// setup() -> allocateAudioBuffers(), before the audio and network tasks start
+// The jitter buffer is deep and read once per packet, so it goes to PSRAM; the uplink queue is
+// read by lwIP on every send and stays internal. The control message filter is built here too.
+bool allocateAudioBuffers()
+{
+    bool ok = jitterBuffer.attach(memAlloc(JitterBuffer::storageBytes(), MEM_PSRAM, "jitter buffer"));
+    ok = wsTxQueue.begin(memAlloc(WsTxQueue::storageBytes(), MEM_INTERNAL, "uplink queue")) && ok;
+    ok = playbackMixer.begin(memAlloc(AudioMixer::storageBytes(), MEM_INTERNAL, "mixer rings")) && ok;
+    ok = buildControlFilter() && ok;
+    return ok;
+}
+
+// audioStreamTask / networkTask / touchTask -> scheduleListeningAt()
+// networkTask runs transitionToListening() once millis() reaches when
+void scheduleListeningAt(unsigned long when)
+{
+    noteActivity();
+    scheduledTime = when;
+    scheduleListeningRestart = true;
+    wakeNetworkTask();
+}
+
+// micTask / audioStreamTask / discoveryTask / main -> wakeNetworkTask()
+void wakeNetworkTask()
+{
+    if (networkWakeFd >= 0) {
+        uint64_t one = 1;
+        write(networkWakeFd, &one, sizeof(one));
+    }
+}
+
+// networkTask -> waitForNetworkWork()
+// Blocks until the socket has data, another task called wakeNetworkTask() or timeoutMs passed.
+static void waitForNetworkWork(uint32_t timeoutMs)
+{
+    int sock = webSocket.socketFd();
+    bool readSocket = sock >= 0 && jitterBuffer.hasRoom();
+    if (readSocket && webSocket.hasBufferedData()) {
+        return; // already read out of the socket by WiFiClient, select() would not see it
+    }
+
+    fd_set readFds;
+    FD_ZERO(&readFds);
+    int maxFd = -1;
+    if (readSocket) {
+        FD_SET(sock, &readFds);
+        maxFd = sock;
+    }
+    if (networkWakeFd >= 0) {
+        FD_SET(networkWakeFd, &readFds);
+        maxFd = max(maxFd, networkWakeFd);
+    }
+    if (maxFd < 0) {
+        vTaskDelay(1); // no eventfd: fall back to polling
+        return;
+    }
+
+    struct timeval tv = { (time_t)(timeoutMs / 1000), (suseconds_t)((timeoutMs % 1000) * 1000) };
+    if (select(maxFd + 1, &readFds, NULL, NULL, &tv) > 0 && networkWakeFd >= 0 && FD_ISSET(networkWakeFd, &readFds)) {
+        uint64_t count;
+        read(networkWakeFd, &count, sizeof(count));
+    }
+}
+
+// networkTask -> applyWebsocketSetup()
+static void applyWebsocketSetup()
+{
+    // a new server or Wi-Fi connection can still resume a suspended session
+    setWsHeaders(sessionSuspended);
     webSocket.onEvent(webSocketEvent);
     webSocket.setReconnectInterval(1000);
     webSocket.disableHeartbeat();
-    webSocket.begin(server_domain.c_str(), port, path.c_str());
-    xSemaphoreGive(wsMutex);
+    webSocket.begin(pendingWsHost.c_str(), pendingWsPort, pendingWsPath.c_str());
+    websocketSetupScheduled = false;
+}
+
+// networkTask -> drainWsTxQueue() -> webSocket.sendBIN()
+static void drainWsTxQueue()
+{
+    size_t len;
+    const uint8_t *frame;
+    while ((frame = wsTxQueue.peek(len)) != nullptr) {
+        if (webSocket.isConnected() && deviceState == LISTENING) {
+            webSocket.sendBIN(frame, len);
+        }
+        wsTxQueue.pop();
+    }
 }
 
 // networkTask -> webSocket.loop()
+// networkTask is the only owner of webSocket: other tasks hand work over through
+// wsTxQueue and the *Scheduled flags instead of locking.
 void networkTask(void *parameter) {
+    esp_vfs_eventfd_config_t eventfdConfig = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+    if (esp_vfs_eventfd_register(&eventfdConfig) == ESP_OK) {
+        networkWakeFd = eventfd(0, 0);
+    }
+    if (networkWakeFd < 0) {
+        LOG_E("Failed to create network eventfd, falling back to polling");
+    }
+
     while (1) {
-        xSemaphoreTake(wsMutex, portMAX_DELAY);
+        if (websocketSetupScheduled) {
+            applyWebsocketSetup();
+            wsConfigured = true;
+            wsDownSince = millis();
+        }
+
+        if (webSocket.isConnected()) {
+            wsDownSince = 0;
+        } else if (wsConfigured && deviceState != SLEEP) {
+            if (wsDownSince == 0) {
+                wsDownSince = millis();
+            } else if (millis() - wsDownSince > SERVER_REDISCOVERY_MS && !serverRediscoveryScheduled) {
+                serverRediscoveryScheduled = true;
+                wsDownSince = millis();
+            }
+        }
+
+        // the server did not take us back in time, whatever was going on is over
+        if (sessionSuspended && !webSocket.isConnected() && millis() - sessionLostAt > resumeWindowMs) {
+            LOG_I("[WSc] Resume window of %u ms passed, session dropped", (unsigned)resumeWindowMs);
+            forgetSession();
+            setDeviceState(IDLE);
+            promptPlayNamed(PROMPT_CONNECTION_ERROR);
+        }
+
+        if (wsDisconnectScheduled) {
+            // on purpose, nothing to resume
+            forgetSession();
+            if (webSocket.isConnected()) {
+                webSocket.disconnect();
+            }
+            wsTxQueue.clear();
+            wsDisconnectScheduled = false;
+        }
 
         // Check to see if a transition to listening mode is scheduled.
         if (scheduleListeningRestart && millis() >= scheduledTime) {
-            Serial.println("FOOBAR: Transitioning to listening mode");
+            LOG_D("Scheduled listening restart reached");
             transitionToListening();
         }
 
-        webSocket.loop();
-        xSemaphoreGive(wsMutex);
+        drainWsTxQueue();
+        sendDownlinkAck();
+        promptService();
 
-        vTaskDelay(1);
+        // the user talked over the response: stop playback now and tell the server to cancel it
+        if (bargeInScheduled) {
+            bargeInScheduled = false;
+            if (webSocket.isConnected() && deviceState == SPEAKING) {
+                webSocket.sendTXT("{\"type\":\"instruction\",\"msg\":\"INTERRUPT\"}");
+                bargeInActive = true;
+                transitionToListening(false);
+            }
+        }
+
+        // after the frames that led up to it, so the server has the whole utterance
+        if (vadEndScheduled) {
+            vadEndScheduled = false;
+            if (webSocket.isConnected() && deviceState == LISTENING) {
+                webSocket.sendTXT("{\"type\":\"vad_end\"}");
+            }
+        }
+
+        // While the jitter buffer is full, leave the data in the socket so TCP pushes back on
+        // the server instead of us dropping speech
+        if (jitterBuffer.hasRoom()) {
+            webSocket.loop();
+        }
+
+        // While dozing the heartbeat keeps the session (and the NAT mapping) alive
+        static bool heartbeatEnabled = false;
+        if (dozing() != heartbeatEnabled) {
+            heartbeatEnabled = dozing();
+            if (heartbeatEnabled) {
+                webSocket.enableHeartbeat(DOZE_PING_INTERVAL_MS, 10000, 2);
+            } else {
+                webSocket.disableHeartbeat();
+            }
+        }
+
+        // webSocket.loop() still needs a regular tick for reconnects and heartbeats
+        uint32_t timeoutMs = webSocket.isConnected() ? NETWORK_IDLE_WAIT_MS : NETWORK_DISCONNECTED_WAIT_MS;
+        if (dozing()) {
+            timeoutMs = NETWORK_DOZE_WAIT_MS;
+        }
+        if (scheduleListeningRestart) {
+            long untilRestart = (long)(scheduledTime - millis());
+            timeoutMs = untilRestart <= 0 ? 0 : min(timeoutMs, (uint32_t)untilRestart);
+        }
+        waitForNetworkWork(timeoutMs);
     }
-}
\ No newline at end of file
+}
+
@@ -5,16 +5,78 @@
 // #include "AudioTools/Concurrency/RTOS.h"
 #include "AudioTools/AudioCodecs/CodecOpus.h"
 #include <WebSocketsClient.h>
+#include <opus.h>
+#include "PacketQueue.h"
+#include "JitterBuffer.h"
+#include "DspPipeline.h"
+#include "Mixer.h"
+#include "Vad.h"
+#include "EchoCanceller.h"
+#include "Metrics.h"
 
-extern SemaphoreHandle_t wsMutex;
-extern WebSocketsClient webSocket;
+// Optional header in front of every uplink BIN frame, enabled with "uplink_header" in auth
+struct __attribute__((packed)) UplinkFrameHeader {
+    uint8_t version;
+    uint8_t flags;
+    uint8_t speechProbability;  // 0..255, valid with UPLINK_FLAG_VAD
+    uint8_t reserved;
+    uint32_t sequence;          // v2: +1 per frame, a jump means frames were dropped on the device
+    uint32_t timestampMs;       // v2: device millis() at the end of the frame's capture
+};
+
+constexpr uint8_t UPLINK_HEADER_VERSION = 2;
+constexpr uint8_t UPLINK_FLAG_SPEECH = 0x01;  // the VAD counts this frame as speech
+constexpr uint8_t UPLINK_FLAG_OPUS   = 0x02;  // payload is an Opus packet, otherwise PCM
+constexpr uint8_t UPLINK_FLAG_VAD    = 0x04;  // the VAD ran on this frame
+
+// Optional header in front of every downlink BIN frame, enabled with "downlink_header" in auth
+struct __attribute__((packed)) DownlinkFrameHeader {
+    uint8_t version;
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t sequence;          // +1 per Opus packet over the whole session, acked with {"type":"ack"}
+    uint32_t timestampMs;       // media time of the packet within its response
+};
+
+constexpr uint8_t DOWNLINK_HEADER_VERSION = 1;
+
+// Outgoing mic frames, one slot holds a whole 40 ms frame of 16 kHz mono PCM plus its header
+constexpr size_t WS_TX_SLOT_SIZE  = 16000 / 1000 * 40 * sizeof(int16_t) + sizeof(UplinkFrameHeader);
+constexpr size_t WS_TX_SLOT_COUNT = 8;
+typedef PacketQueue<WS_TX_SLOT_SIZE, WS_TX_SLOT_COUNT> WsTxQueue;
+
+// WebSocketsClient that exposes its socket so networkTask can sleep in select() instead of polling
+class SelectableWebSocketsClient : public WebSocketsClient {
+public:
+    int socketFd() {
+        return (_client.tcp && _client.tcp->connected()) ? _client.tcp->fd() : -1;
+    }
+
+    bool hasBufferedData() {
+        return _client.tcp && _client.tcp->available() > 0;
+    }
+};
+
+constexpr uint32_t NETWORK_IDLE_WAIT_MS = 50;
+constexpr uint32_t NETWORK_DISCONNECTED_WAIT_MS = 100;
+constexpr uint32_t NETWORK_DOZE_WAIT_MS = 1000;
+constexpr uint32_t DOWNLINK_ACK_INTERVAL_MS = 250;
+constexpr uint32_t DOZE_PING_INTERVAL_MS = 25000;
+
+extern SelectableWebSocketsClient webSocket;
+extern WsTxQueue wsTxQueue;
+extern volatile uint32_t wsTxDropped;
+extern volatile bool wsDisconnectScheduled;
+extern volatile bool serverRediscoveryScheduled;
 
 extern TaskHandle_t speakerTaskHandle;
 extern TaskHandle_t micTaskHandle;
 extern TaskHandle_t networkTaskHandle;
 
 extern volatile bool scheduleListeningRestart;
-extern unsigned long scheduledTime;
+extern volatile unsigned long scheduledTime;
+extern volatile bool listenAfterDrainScheduled;
+extern volatile int listenTailMs;
 extern unsigned long speakingStartTime;
 
 extern int currentVolume;
@@ -22,31 +84,93 @@ extern const int CHANNELS;         // Mono
 extern const int BITS_PER_SAMPLE; // 16-bit audio
 
 // AUDIO OUTPUT
-constexpr size_t AUDIO_BUFFER_SIZE = 1024 * 10;     // total bytes in the buffer
-constexpr size_t AUDIO_CHUNK_SIZE  = 1024;         // ideal read/write chunk size
-extern OpusAudioDecoder opusDecoder;
-extern BufferRTOS<uint8_t> audioBuffer;
+constexpr size_t MAX_DECODED_SAMPLES = 48000 / 1000 * 120;  // longest Opus frame at the highest rate
+extern JitterBuffer jitterBuffer;
+extern OpusDecoder *opusDecoder;
 extern I2SStream i2s; 
-extern VolumeStream volume;
-extern QueueStream<uint8_t> queue;
-extern StreamCopy copier;
-
-// NEW for pitch shift
-extern VolumeStream volumePitch;
-extern StreamCopy pitchCopier;
+extern DspPipeline playbackDsp;
+extern AudioMixer playbackMixer;
+extern volatile bool playbackDspConfigScheduled;
+extern volatile bool requestedSoftLimiter;
 
 extern AudioInfo info;
 extern volatile bool i2sOutputFlushScheduled;
 
+// AUDIO FORMAT (negotiated in the auth message, applied by the task that owns the I2S port)
+// DMA geometry as AudioTools' buffer_count/buffer_size, 0 keeps the AudioTools default
+struct I2sRequest
+{
+    uint32_t sampleRate;
+    uint16_t dmaCount;
+    uint16_t dmaSize;
+};
+
+constexpr uint16_t I2S_DMA_COUNT_MIN = 2;
+constexpr uint16_t I2S_DMA_COUNT_MAX = 16;
+constexpr uint16_t I2S_DMA_SIZE_MIN = 64;
+constexpr uint16_t I2S_DMA_SIZE_MAX = 1024;  // the IDF dma_buf_len limit
+
+extern volatile uint32_t playbackSampleRate;  // speaker port, written by audioStreamTask
+extern volatile uint32_t downlinkSampleRate;  // decoder, jitter buffer and mixer, written by audioStreamTask
+extern volatile uint32_t requestedDownlinkRate;  // written by networkTask before playbackFormatScheduled
+extern volatile uint32_t micSampleRate;       // written by micTask
+extern I2sRequest requestedPlaybackFormat;    // written by networkTask before the flag below
+extern I2sRequest requestedMicFormat;         // applied with uplinkConfigScheduled
+extern volatile bool playbackFormatScheduled;
+
 // AUDIO INPUT
 extern I2SStream i2sInput;
 extern StreamCopy micToWsCopier;
 extern volatile bool i2sInputFlushScheduled;
 
+enum UplinkCodec
+{
+    UPLINK_CODEC_PCM,
+    UPLINK_CODEC_OPUS
+};
+
+extern volatile UplinkCodec uplinkCodec;
+extern volatile UplinkCodec requestedUplinkCodec;
+extern volatile int requestedUplinkBitrate;
+extern volatile int requestedUplinkComplexity;
+extern volatile int requestedUplinkFrameMs;
+extern volatile bool uplinkConfigScheduled;
+
+enum UplinkVadMode
+{
+    UPLINK_VAD_OFF,   // send every frame, the server finds the end of the turn
+    UPLINK_VAD_FLAG,  // send every frame, mark speech and send vad_end
+    UPLINK_VAD_GATE   // like FLAG, but silence frames are not sent at all
+};
+
+extern volatile UplinkVadMode uplinkVadMode;
+extern volatile UplinkVadMode requestedUplinkVadMode;
+extern volatile int requestedUplinkVadEndMs;
+extern volatile bool requestedUplinkHeader;
+extern volatile bool requestedUplinkSequenceReset;
+extern volatile bool vadEndScheduled;
+
+// DUPLEX (mic stays open while speaking, echo cancelled, speech interrupts playback)
+extern EchoReference echoReference;
+extern volatile bool duplexMode;
+extern volatile int requestedAecDelayMs;
+extern volatile int requestedBargeInMs;
+extern volatile bool bargeInScheduled;
+extern volatile uint32_t playbackDmaMs;
+extern volatile uint32_t micDmaMs;
+
+// METRICS
+extern volatile uint32_t opusDecodeErrors;
+extern volatile bool metricsPushEnabled;
+
 // WEBSOCKET
 void webSocketEvent(WStype_t type, uint8_t *payload, size_t length);
 void websocketSetup(const String& server_domain, int port, const String& path);
 void networkTask(void *parameter);
+void wakeNetworkTask();
+TurnCounters currentTurnCounters();
+bool allocateAudioBuffers();
+void scheduleListeningAt(unsigned long when);
 
 // AUDIO OUTPUT
 unsigned long getSpeakingDuration();
@@ -21,10 +21,13 @@ enum DeviceState
     PROCESSING,
     WAITING,
     FACTORY_RESET,
+    DOZE,
     SLEEP
 };
 
 extern volatile DeviceState deviceState;
+// any task: the only way deviceState changes, so the LED engine hears about it
+void setDeviceState(DeviceState state);
 
 // WiFi credentials
 extern const char *EAP_IDENTITY;
@@ -42,9 +45,6 @@ extern String ws_server_ip;  // Dynamically discovered via mDNS
 extern const uint16_t ws_port;
 extern const char *ws_path;
 
-// mDNS discovery
-bool discoverElatoServer(String &outIp, uint16_t &outPort, int timeoutMs = 10000);
-
 // I2S and Audio parameters
 extern const uint32_t SAMPLE_RATE;
 extern const uint32_t INPUT_SAMPLE_RATE;
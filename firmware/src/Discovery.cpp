@@ -0,0 +1,438 @@
+#include "Discovery.h"
+#include "Config.h"
+#include "Log.h"
+#include "Scheduling.h"
+#include <ESPmDNS.h>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <mdns.h>
+#include <lwip/sockets.h>
+
+static constexpr uint16_t BEACON_PORT = 1900;
+static constexpr uint32_t MDNS_QUERY_MS = 3000;  // one round, a new query starts when it ends
+static constexpr uint32_t DISCOVERY_TICK_MS = 20;
+static constexpr size_t MAX_PROBES = 4;
+static constexpr size_t MAX_TRIED = 8;
+
+// A candidate being checked: a TCP connect that is polled instead of waited for
+struct Probe
+{
+    int fd = -1;
+    IPAddress ip;
+    uint16_t port = 0;
+    DiscoverySource source = DISCOVERY_NONE;
+    unsigned long startedAt = 0;
+    uint32_t timeoutMs = 0;
+};
+
+// everything below is touched by discoveryTask only, discoveryStart() hands the request over
+struct DiscoveryRun
+{
+    bool useCache;
+    uint32_t timeoutMs;
+    DiscoveryCallback callback;
+    void *context;
+
+    unsigned long startedAt;
+    bool reported;              // the cache answered, the rest is a background refresh
+    bool confirmed;             // a network source pointed at the cached server too
+    DiscoveryResult result;
+    bool cacheFailed;
+
+    Probe probes[MAX_PROBES];
+    struct { IPAddress ip; uint16_t port; } tried[MAX_TRIED];
+    size_t triedCount;
+
+    WiFiUDP beacon;
+    mdns_search_once_t *serviceQuery;
+    mdns_search_once_t *hostQuery;
+    uint16_t servicePort;       // the elato.local host uses the port the service announced
+};
+
+static DiscoveryRun run;
+static TaskHandle_t discoveryTaskHandle = nullptr;
+static volatile bool discoveryActive = false;
+static bool mdnsStarted = false;
+
+const char *discoverySourceName(DiscoverySource source)
+{
+    switch (source) {
+    case DISCOVERY_CACHE:        return "cache";
+    case DISCOVERY_BEACON:       return "beacon";
+    case DISCOVERY_MDNS_SERVICE: return "mdns service";
+    case DISCOVERY_MDNS_HOST:    return "mdns host";
+    default:                     return "none";
+    }
+}
+
+// CACHE
+// only written from discoveryTask, it has its own Preferences handle instead of the shared one
+static void cacheServer(const IPAddress &ip, uint16_t port)
+{
+    Preferences prefs;
+    prefs.begin("server", false);
+    prefs.putString("ws_ip", ip.toString());
+    prefs.putUInt("ws_port", port);
+    prefs.end();
+}
+
+static void clearCachedServer()
+{
+    Preferences prefs;
+    prefs.begin("server", false);
+    prefs.remove("ws_ip");
+    prefs.remove("ws_port");
+    prefs.end();
+}
+
+static bool loadCachedServer(IPAddress &outIp, uint16_t &outPort)
+{
+    Preferences prefs;
+    prefs.begin("server", true);
+    String ip = prefs.getString("ws_ip", "");
+    outPort = (uint16_t)prefs.getUInt("ws_port", ws_port);
+    prefs.end();
+    return ip.length() > 0 && outIp.fromString(ip);
+}
+
+static bool onLocalSubnet(const IPAddress &ip)
+{
+    IPAddress localIp = WiFi.localIP();
+    IPAddress mask = WiFi.subnetMask();
+    return ((uint32_t)localIp & (uint32_t)mask) == ((uint32_t)ip & (uint32_t)mask);
+}
+
+// PROBES
+static void probeClose(Probe &probe)
+{
+    if (probe.fd >= 0) {
+        close(probe.fd);
+    }
+    probe.fd = -1;
+}
+
+// false when the connect could not even be started
+static bool probeStart(Probe &probe, const IPAddress &ip, uint16_t port, DiscoverySource source, uint32_t timeoutMs)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+        return false;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = (uint32_t)ip;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return false;
+    }
+
+    probe.fd = fd;
+    probe.ip = ip;
+    probe.port = port;
+    probe.source = source;
+    probe.startedAt = millis();
+    probe.timeoutMs = timeoutMs;
+    return true;
+}
+
+// 1: connected, -1: refused or timed out, 0: still connecting
+static int probePoll(Probe &probe)
+{
+    fd_set writable;
+    FD_ZERO(&writable);
+    FD_SET(probe.fd, &writable);
+    struct timeval noWait = {0, 0};
+    if (select(probe.fd + 1, NULL, &writable, NULL, &noWait) > 0) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(probe.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        return error == 0 ? 1 : -1;
+    }
+    return millis() - probe.startedAt > probe.timeoutMs ? -1 : 0;
+}
+
+// discoveryTask -> a source -> addCandidate()
+// every address is only probed once per run, the beacon repeats itself every second
+static void addCandidate(const IPAddress &ip, uint16_t port, DiscoverySource source)
+{
+    for (size_t i = 0; i < run.triedCount; i++) {
+        if (run.tried[i].ip == ip && run.tried[i].port == port) {
+            return;
+        }
+    }
+    if (run.reported && ip == run.result.ip && port == run.result.port) {
+        run.confirmed = true;  // the cached server we are already using
+        return;
+    }
+    if (source == DISCOVERY_MDNS_HOST && !onLocalSubnet(ip)) {
+        LOG_I("[DISC] Ignoring elato.local at %s (different subnet)", ip.toString().c_str());
+        return;
+    }
+
+    for (Probe &probe : run.probes) {
+        if (probe.fd >= 0) {
+            continue;
+        }
+        uint32_t timeoutMs = source == DISCOVERY_CACHE ? DISCOVERY_CACHE_PROBE_MS : DISCOVERY_PROBE_MS;
+        if (!probeStart(probe, ip, port, source, timeoutMs)) {
+            LOG_W("[DISC] Could not probe %s:%d (%d)", ip.toString().c_str(), port, errno);
+            return;
+        }
+        // a cached server that was slow to answer still gets its chance when it is announced
+        if (source != DISCOVERY_CACHE && run.triedCount < MAX_TRIED) {
+            run.tried[run.triedCount++] = {ip, port};
+        }
+        LOG_D("[DISC] Probing %s:%d from %s", ip.toString().c_str(), port, discoverySourceName(source));
+        return;
+    }
+    // all probes busy: not marked as tried, the source offers it again
+}
+
+// SOURCES
+static void pollBeacon()
+{
+    int packetSize = run.beacon.parsePacket();
+    if (packetSize <= 0) {
+        return;
+    }
+    char buf[128];
+    int length = run.beacon.read(buf, sizeof(buf) - 1);
+    if (length <= 0) {
+        return;
+    }
+    buf[length] = '\0';
+
+    char ipText[16];
+    unsigned port = 0;
+    IPAddress ip;
+    if (sscanf(buf, "ELATO_SERVER %15s %u", ipText, &port) == 2 && port > 0 && port <= 0xFFFF && ip.fromString(ipText)) {
+        addCandidate(ip, (uint16_t)port, DISCOVERY_BEACON);
+    }
+}
+
+static mdns_search_once_t *startQuery(const char *name, const char *service, const char *proto, uint16_t type)
+{
+    mdns_search_once_t *search = mdns_query_async_new(name, service, proto, type, MDNS_QUERY_MS, 1);
+    if (search == nullptr) {
+        LOG_W_EVERY(5000, "[DISC] Could not start an mDNS query");
+    }
+    return search;
+}
+
+// the query answers once, on its first result or when its round is over
+static void pollQuery(mdns_search_once_t *&search, DiscoverySource source)
+{
+    if (search == nullptr) {
+        search = source == DISCOVERY_MDNS_SERVICE ? startQuery(NULL, "_elato", "_tcp", MDNS_TYPE_PTR)
+                                                  : startQuery("elato", NULL, NULL, MDNS_TYPE_A);
+        return;
+    }
+    mdns_result_t *results = nullptr;
+    if (!mdns_query_async_get_results(search, 0, &results)) {
+        return;
+    }
+    for (mdns_result_t *r = results; r != nullptr; r = r->next) {
+        if (source == DISCOVERY_MDNS_SERVICE && r->port != 0) {
+            run.servicePort = r->port;
+        }
+        for (mdns_ip_addr_t *a = r->addr; a != nullptr; a = a->next) {
+            if (a->addr.type == ESP_IPADDR_TYPE_V4) {
+                uint16_t port = source == DISCOVERY_MDNS_SERVICE ? r->port : run.servicePort;
+                addCandidate(IPAddress(a->addr.u_addr.ip4.addr), port ? port : ws_port, source);
+                break;
+            }
+        }
+    }
+    mdns_query_results_free(results);
+    mdns_query_async_delete(search);
+    search = nullptr;  // the next poll starts another round
+}
+
+static void stopQuery(mdns_search_once_t *&search)
+{
+    if (search != nullptr) {
+        mdns_query_async_delete(search);
+        search = nullptr;
+    }
+}
+
+// RUN
+static void beginRun()
+{
+    if (!mdnsStarted) {
+        mdnsStarted = MDNS.begin("elato-device");
+        if (!mdnsStarted) {
+            LOG_E("[DISC] Failed to start mDNS responder, beacon and cache only");
+        }
+    }
+
+    run.startedAt = millis();
+    run.reported = false;
+    run.confirmed = false;
+    run.result = {false, IPAddress(), 0, DISCOVERY_NONE, 0};
+    run.cacheFailed = false;
+    run.triedCount = 0;
+    run.serviceQuery = nullptr;
+    run.hostQuery = nullptr;
+    run.servicePort = 0;
+    run.beacon.begin(BEACON_PORT);
+
+    IPAddress cachedIp;
+    uint16_t cachedPort;
+    if (run.useCache && loadCachedServer(cachedIp, cachedPort)) {
+        if (onLocalSubnet(cachedIp)) {
+            addCandidate(cachedIp, cachedPort, DISCOVERY_CACHE);
+        } else {
+            LOG_I("[DISC] Cached server %s is not on this network", cachedIp.toString().c_str());
+        }
+    }
+    LOG_I("[DISC] Looking for the server (%s)", run.useCache ? "cache, beacon, mdns" : "beacon, mdns");
+}
+
+static void endRun()
+{
+    for (Probe &probe : run.probes) {
+        probeClose(probe);
+    }
+    stopQuery(run.serviceQuery);
+    stopQuery(run.hostQuery);
+    run.beacon.stop();
+}
+
+static void report(bool found, const IPAddress &ip, uint16_t port, DiscoverySource source)
+{
+    run.reported = true;
+    run.result = {found, ip, port, source, (uint32_t)(millis() - run.startedAt)};
+    if (run.callback != nullptr) {
+        run.callback(run.result, run.context);
+    }
+}
+
+// discoveryTask -> runDiscovery() -> onProbeConnected()
+// true when the run is over
+static bool onProbeConnected(const Probe &probe)
+{
+    uint32_t elapsed = millis() - run.startedAt;
+    if (!run.reported) {
+        LOG_I("[DISC] Found server %s:%d via %s after %u ms", probe.ip.toString().c_str(), probe.port,
+            discoverySourceName(probe.source), (unsigned)elapsed);
+        if (probe.source != DISCOVERY_CACHE) {
+            cacheServer(probe.ip, probe.port);
+        }
+        report(true, probe.ip, probe.port, probe.source);
+        return probe.source != DISCOVERY_CACHE;
+    }
+
+    // the background refresh behind a cached server
+    if (probe.source == DISCOVERY_CACHE) {
+        return false;
+    }
+    LOG_I("[DISC] Server moved from %s:%d to %s:%d, used from the next connect",
+        run.result.ip.toString().c_str(), run.result.port, probe.ip.toString().c_str(), probe.port);
+    cacheServer(probe.ip, probe.port);
+    return true;
+}
+
+// discoveryTask -> runDiscovery()
+static void runDiscovery()
+{
+    beginRun();
+    for (;;) {
+        pollBeacon();
+        if (mdnsStarted) {
+            pollQuery(run.serviceQuery, DISCOVERY_MDNS_SERVICE);
+            pollQuery(run.hostQuery, DISCOVERY_MDNS_HOST);
+        }
+
+        bool done = false;
+        for (Probe &probe : run.probes) {
+            if (probe.fd < 0) {
+                continue;
+            }
+            int state = probePoll(probe);
+            if (state == 0) {
+                continue;
+            }
+            if (state > 0) {
+                done = onProbeConnected(probe);
+            } else {
+                LOG_I("[DISC] %s:%d from %s not reachable", probe.ip.toString().c_str(), probe.port,
+                    discoverySourceName(probe.source));
+                run.cacheFailed |= probe.source == DISCOVERY_CACHE;
+            }
+            probeClose(probe);
+            if (done) {
+                break;
+            }
+        }
+        if (done || run.confirmed || WiFi.status() != WL_CONNECTED) {
+            break;
+        }
+
+        if (millis() - run.startedAt >= run.timeoutMs) {
+            if (run.reported) {
+                LOG_I("[DISC] Background discovery found nothing, keeping %s:%d", run.result.ip.toString().c_str(), run.result.port);
+            } else {
+                LOG_I("[DISC] No Elato server found on the network");
+                if (run.cacheFailed) {
+                    clearCachedServer();
+                }
+            }
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(DISCOVERY_TICK_MS));
+    }
+    endRun();
+
+    if (!run.reported) {
+        report(false, IPAddress(), 0, DISCOVERY_NONE);
+    }
+}
+
+// discoveryStart() -> discoveryTask
+static void discoveryTask(void *parameter)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        runDiscovery();
+        discoveryActive = false;
+    }
+}
+
+/**
+ * @brief Start looking for the server, without waiting for it
+ * @param useCache Probe the server found last time along with the network sources
+ * @param callback Called on discoveryTask with the result, once
+ * @param context Passed to the callback
+ * @param timeoutMs How long the network sources keep trying
+ * @return false if the previous discovery has not finished yet
+ */
+bool discoveryStart(bool useCache, DiscoveryCallback callback, void *context, uint32_t timeoutMs)
+{
+    if (discoveryTaskHandle == nullptr) {
+        static ProfiledTask<TASK_DISCOVERY> discoveryTaskStack;
+        discoveryTaskHandle = discoveryTaskStack.start(discoveryTask);
+        if (discoveryTaskHandle == nullptr) {
+            LOG_E("[DISC] Failed to start the discovery task");
+            return false;
+        }
+    }
+    if (discoveryActive) {
+        return false;
+    }
+    discoveryActive = true;
+    run.useCache = useCache;
+    run.callback = callback;
+    run.context = context;
+    run.timeoutMs = timeoutMs;
+    xTaskNotifyGive(discoveryTaskHandle);
+    return true;
+}
+
+bool discoveryRunning()
+{
+    return discoveryActive;
+}
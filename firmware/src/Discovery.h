@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+// SERVER DISCOVERY
+// One engine on its own task: the cached server, the UDP beacon on port 1900 ("ELATO_SERVER
+// <ip> <port>"), the _elato._tcp mDNS service and the elato.local host are all tried at the
+// same time, each candidate gets a non-blocking TCP probe and the first one that accepts a
+// connection wins. wifiTask only starts it and gets the result through the callback.
+enum DiscoverySource
+{
+    DISCOVERY_NONE,
+    DISCOVERY_CACHE,
+    DISCOVERY_BEACON,
+    DISCOVERY_MDNS_SERVICE,
+    DISCOVERY_MDNS_HOST,
+};
+
+struct DiscoveryResult
+{
+    bool found;
+    IPAddress ip;
+    uint16_t port;
+    DiscoverySource source;
+    uint32_t elapsedMs;
+};
+
+// discoveryTask, once per discoveryStart(), when a server answered or the time ran out
+typedef void (*DiscoveryCallback)(const DiscoveryResult &result, void *context);
+
+constexpr uint32_t DISCOVERY_TIMEOUT_MS = 10000;
+constexpr uint32_t DISCOVERY_CACHE_PROBE_MS = 500;
+constexpr uint32_t DISCOVERY_PROBE_MS = 1500;
+
+// any task: false if a discovery is still running. With useCache a cached server that
+// answers is reported right away; the network sources keep running in the background
+// until they confirm it or find where it moved, and only the cache is updated then.
+bool discoveryStart(bool useCache, DiscoveryCallback callback, void *context, uint32_t timeoutMs = DISCOVERY_TIMEOUT_MS);
+bool discoveryRunning();
+const char *discoverySourceName(DiscoverySource source);
@@ -0,0 +1,105 @@
+#include "Doze.h"
+#include "Config.h"
+#include "Audio.h"
+#include "Log.h"
+#include <atomic>
+#include <esp_wifi.h>
+#include <esp_pm.h>
+
+volatile uint32_t dozeAfterMs = 0;
+
+static std::atomic<bool> dozeActive{false};
+static volatile unsigned long lastActivityMs = 0;
+
+// automatic light sleep needs CONFIG_PM_ENABLE (and tickless idle) in the core's sdkconfig
+static void setLightSleep(bool enable)
+{
+#if CONFIG_PM_ENABLE
+#if CONFIG_IDF_TARGET_ESP32S3
+    esp_pm_config_esp32s3_t pm = {};
+#else
+    esp_pm_config_esp32_t pm = {};
+#endif
+    pm.max_freq_mhz = 240;
+    pm.min_freq_mhz = enable ? 80 : 240;
+    pm.light_sleep_enable = enable;
+    esp_err_t err = esp_pm_configure(&pm);
+    if (err != ESP_OK) {
+        LOG_W("[DOZE] Light sleep %s failed: %d", enable ? "enable" : "disable", err);
+    }
+#else
+    static bool warned = false;
+    if (enable && !warned) {
+        warned = true;
+        LOG_W("[DOZE] Core built without CONFIG_PM_ENABLE, modem sleep only");
+    }
+#endif
+}
+
+void noteActivity()
+{
+    lastActivityMs = millis();
+}
+
+bool dozing()
+{
+    return dozeActive.load(std::memory_order_acquire);
+}
+
+void dozeCheck()
+{
+    if (dozeAfterMs == 0 || dozing() || !webSocket.isConnected()) {
+        return;
+    }
+    if (deviceState != LISTENING && deviceState != IDLE) {
+        noteActivity();  // idle time only counts while nothing is going on
+        return;
+    }
+    if (millis() - lastActivityMs >= dozeAfterMs) {
+        enterDoze();
+    }
+}
+
+void enterDoze()
+{
+    if (dozeActive.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+    LOG_I("[DOZE] Idle for %u ms, dozing", (unsigned)(millis() - lastActivityMs));
+
+    setDeviceState(DOZE);
+    scheduleListeningRestart = false;
+    i2sInputFlushScheduled = true;
+    vTaskDelay(10);  //let micTask park itself
+
+    // gate the I2S clocks, the drivers and their DMA buffers stay installed
+    i2s_stop(I2S_PORT_IN);
+    i2s_stop(I2S_PORT_OUT);
+
+    // radio sleeps between DTIM beacons, networkTask turns on the websocket heartbeat
+    esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+    setLightSleep(true);
+    wakeNetworkTask();
+}
+
+void exitDoze(bool listenAfter)
+{
+    if (!dozeActive.exchange(false, std::memory_order_acq_rel)) {
+        return;
+    }
+    unsigned long start = micros();
+
+    setLightSleep(false);
+    esp_wifi_set_ps(WIFI_PS_NONE);
+    i2s_start(I2S_PORT_OUT);
+    i2s_start(I2S_PORT_IN);
+
+    setDeviceState(IDLE);
+    noteActivity();
+    wakeNetworkTask();
+    LOG_I("[DOZE] Awake after %lu us", micros() - start);
+
+    if (listenAfter) {
+        scheduleListeningAt(millis());
+    }
+}
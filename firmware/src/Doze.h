@@ -0,0 +1,21 @@
+#pragma once
+
+#include <Arduino.h>
+
+// DOZE: low power idle between SLEEP (deep sleep, full boot on wake) and LISTENING.
+// After dozeAfterMs without activity the I2S clocks are stopped, Wi-Fi drops to modem sleep
+// (the radio wakes for every DTIM beacon) and, when the core is built with power management,
+// the CPU light sleeps whenever all tasks are idle. The websocket stays open with a heartbeat,
+// so leaving doze is an i2s_start and a listening restart instead of a reconnect.
+extern volatile uint32_t dozeAfterMs;  // 0: never doze, set by the auth message
+
+// any task: something happened that should keep the device awake
+void noteActivity();
+// loopTask: doze once the device has been idle for dozeAfterMs
+void dozeCheck();
+bool dozing();
+
+// loopTask -> dozeCheck() -> enterDoze()
+void enterDoze();
+// any task: back to IDLE with I2S and the radio up, listenAfter also schedules listening
+void exitDoze(bool listenAfter);
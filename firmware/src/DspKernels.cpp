@@ -0,0 +1,106 @@
+#include "DspKernels.h"
+#include <math.h>
+
+#if DSP_KERNELS_ESP_DSP
+#include <dsps_mulc.h>
+#include <dsps_dotprod.h>
+#endif
+
+void dspScaleS16(int16_t *samples, size_t sampleCount, int32_t gainQ12) {
+  if (gainQ12 == 4096 || sampleCount == 0) {
+    return;
+  }
+
+#if DSP_KERNELS_ESP_DSP
+  // dsps_mulc_s16 multiplies by a Q15 constant, so it covers everything up to unity gain
+  if (gainQ12 >= 0 && gainQ12 < 4096) {
+    dsps_mulc_s16(samples, samples, (int)sampleCount, (int16_t)(gainQ12 << 3), 1, 1);
+    return;
+  }
+#endif
+
+  for (size_t i = 0; i < sampleCount; i++) {
+    samples[i] = dspSaturateS16((samples[i] * gainQ12) >> 12);
+  }
+}
+
+void dspMixS16(int16_t *acc, const int16_t *in, size_t sampleCount, int32_t gainQ15) {
+  for (size_t i = 0; i < sampleCount; i++) {
+    acc[i] = dspSaturateS16(acc[i] + ((in[i] * gainQ15) >> 15));
+  }
+}
+
+uint32_t dspPeakS16(const int16_t *samples, size_t sampleCount) {
+  int32_t lo = 0;
+  int32_t hi = 0;
+  for (size_t i = 0; i < sampleCount; i++) {
+    int32_t s = samples[i];
+    hi = s > hi ? s : hi;
+    lo = s < lo ? s : lo;
+  }
+  return (uint32_t)(hi > -lo ? hi : -lo);
+}
+
+uint32_t dspRmsS16(const int16_t *samples, size_t sampleCount) {
+  if (sampleCount == 0) {
+    return 0;
+  }
+  // the 64 bit sum keeps full scale frames of any length exact
+  uint64_t sum = 0;
+  for (size_t i = 0; i < sampleCount; i++) {
+    int32_t s = samples[i];
+    sum += (uint32_t)(s * s);
+  }
+  return (uint32_t)sqrtf((float)(sum / sampleCount));
+}
+
+uint32_t dspDiffRmsS16(const int16_t *samples, size_t sampleCount) {
+  if (sampleCount == 0) {
+    return 0;
+  }
+  uint64_t sum = 0;
+  for (size_t i = 1; i < sampleCount; i++) {
+    uint32_t d = (uint32_t)abs(samples[i] - samples[i - 1]);  // d * d overflows int32 at full scale
+    sum += d * d;
+  }
+  return (uint32_t)sqrtf((float)(sum / sampleCount));
+}
+
+float dspDotF32(const float *a, const float *b, size_t count) {
+  float sum = 0.0f;
+#if DSP_KERNELS_ESP_DSP
+  dsps_dotprod_f32(a, b, &sum, (int)count);
+#else
+  for (size_t i = 0; i < count; i++) {
+    sum += a[i] * b[i];
+  }
+#endif
+  return sum;
+}
+
+void LinearResampler::begin(uint32_t inputRate, uint32_t outputRate) {
+  stepQ16 = outputRate > 0 ? (uint32_t)(((uint64_t)inputRate << 16) / outputRate) : (1 << 16);
+  reset();
+}
+
+void LinearResampler::reset() {
+  posQ16 = 0;
+  last = 0;
+}
+
+size_t LinearResampler::process(const int16_t *in, size_t sampleCount, int16_t *out) {
+  if (sampleCount == 0) {
+    return 0;
+  }
+  size_t produced = 0;
+  uint32_t pos = posQ16;
+  while ((pos >> 16) < sampleCount) {
+    uint32_t index = pos >> 16;
+    int32_t s0 = index == 0 ? last : in[index - 1];
+    out[produced++] = dspLerpS16(s0, in[index], (pos >> 1) & 0x7FFF);
+    pos += stepQ16;
+  }
+  posQ16 = pos - ((uint32_t)sampleCount << 16);
+  last = in[sampleCount - 1];
+  return produced;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Small sample kernels shared by the playback and microphone paths.
+// On the ESP32-S3 the gain kernel runs on esp-dsp (which uses the S3 MAC/SIMD
+// instructions); every kernel has a plain C fallback so other targets still build.
+#if defined(CONFIG_IDF_TARGET_ESP32S3) && __has_include(<dsps_mulc.h>)
+#define DSP_KERNELS_ESP_DSP 1
+#else
+#define DSP_KERNELS_ESP_DSP 0
+#endif
+
+// Q12 gain with saturation, 4096 = unity; attenuation takes the esp-dsp path
+void dspScaleS16(int16_t *samples, size_t sampleCount, int32_t gainQ12);
+
+// acc += in * gainQ15 / 32768 with saturation, for mixing several sources into one buffer
+void dspMixS16(int16_t *acc, const int16_t *in, size_t sampleCount, int32_t gainQ15);
+
+// largest magnitude, 0..32768
+uint32_t dspPeakS16(const int16_t *samples, size_t sampleCount);
+// root mean square, 0..32768
+uint32_t dspRmsS16(const int16_t *samples, size_t sampleCount);
+// root mean square of samples[i] - samples[i - 1] over the same count, 0..65535; against
+// dspRmsS16 it tells the spectral tilt of a frame
+uint32_t dspDiffRmsS16(const int16_t *samples, size_t sampleCount);
+
+// linear interpolation between s0 and s1, fracQ15 in 0..32767
+static inline int16_t dspLerpS16(int32_t s0, int32_t s1, int32_t fracQ15) {
+  return (int16_t)(s0 + (((s1 - s0) * fracQ15) >> 15));
+}
+
+static inline int16_t dspSaturateS16(int32_t x) {
+  return x > 32767 ? 32767 : (x < -32768 ? -32768 : (int16_t)x);
+}
+
+// sum of a[i] * b[i]
+float dspDotF32(const float *a, const float *b, size_t count);
+
+// Linear interpolation resampler; the last input sample of a block carries over to the next
+// one, so a stream can be converted in blocks of any size.
+class LinearResampler {
+public:
+  void begin(uint32_t inputRate, uint32_t outputRate);
+  void reset();
+  // out must hold sampleCount * outputRate / inputRate + 2 samples
+  size_t process(const int16_t *in, size_t sampleCount, int16_t *out);
+
+protected:
+  uint32_t stepQ16 = 1 << 16;  // input samples per output sample, 16.16 fixed point
+  uint32_t posQ16 = 0;         // relative to last, which sits at position 0
+  int16_t last = 0;
+};
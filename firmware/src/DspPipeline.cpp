@@ -0,0 +1,98 @@
+#include "DspPipeline.h"
+#include "DspKernels.h"
+#include "EchoCanceller.h"
+#include "Mixer.h"
+#include "Log.h"
+
+static_assert(DspPipeline::BLOCK_SIZE <= AudioMixer::MAX_BLOCK, "the mixer works on whole blocks");
+
+// soft knee starts at -2.5 dBFS, everything above is squeezed into the remaining headroom
+static constexpr int32_t LIMIT_THRESHOLD = 24576;
+static constexpr int32_t LIMIT_RANGE = 32767 - LIMIT_THRESHOLD;
+
+void DspPipeline::configure(const Config &config) {
+  cfg = config;
+
+  float gain = cfg.gain < 0.0f ? 0.0f : (cfg.gain > MAX_GAIN ? MAX_GAIN : cfg.gain);
+  gainQ12 = (int32_t)(gain * 4096.0f + 0.5f);
+  gainEnabled = gainQ12 != 4096;
+  limiterEnabled = cfg.softLimiter || gainQ12 > 4096;
+
+  if (cfg.pitch > 0.0f && (cfg.pitch < MIN_PITCH || cfg.pitch > MAX_PITCH)) {
+    float pitch = cfg.pitch < MIN_PITCH ? MIN_PITCH : MAX_PITCH;
+    LOG_W("Pitch factor %.3f out of range, using %.2f", cfg.pitch, pitch);
+    cfg.pitch = pitch;
+  }
+  pitchEnabled = cfg.pitch > 0.0f && fabsf(cfg.pitch - 1.0f) >= 0.001f;
+
+  srcEnabled = cfg.inputRate != cfg.outputRate;
+  if (srcEnabled && (cfg.inputRate == 0 || cfg.outputRate == 0 || cfg.outputRate > cfg.inputRate * MAX_SRC_RATIO)) {
+    LOG_W("Unsupported resampling %u -> %u Hz, playing unconverted", cfg.inputRate, cfg.outputRate);
+    srcEnabled = false;
+  }
+  if (srcEnabled) {
+    resampler.begin(cfg.inputRate, cfg.outputRate);
+  }
+  reset();
+
+  LOG_I("DSP pipeline: gain %.2f%s, pitch %s, resample %s, limiter %s",
+                gain, gainEnabled ? "" : " (bypass)", pitchEnabled ? "on" : "off",
+                srcEnabled ? "on" : "off", limiterEnabled ? "on" : "off");
+}
+
+void DspPipeline::reset() {
+  if (pitchEnabled) {
+    auto pcfg = pitchShift.defaultConfig();
+    pcfg.sample_rate = cfg.inputRate;
+    pcfg.channels = 1;
+    pcfg.pitch_shift = cfg.pitch;
+    pitchShift.begin(pcfg);
+  }
+  resampler.reset();
+}
+
+void DspPipeline::write(int16_t *samples, size_t sampleCount) {
+  if (pitchEnabled) {
+    pitchShift.process(samples, sampleCount);
+  }
+
+  // Written to I2S in blocks even without resampling: i2s_write blocks until the DMA has room,
+  // so a block is handed to the echo tap just before it is queued, not a whole frame early
+  for (size_t i = 0; i < sampleCount; i += BLOCK_SIZE) {
+    size_t n = min(BLOCK_SIZE, sampleCount - i);
+    int16_t *block = samples + i;
+    if (mixer != nullptr) {
+      mixer->mixInto(block, n);
+    }
+    if (srcEnabled) {
+      n = resampler.process(block, n, srcBlock);
+      block = srcBlock;
+    }
+    gainAndLimit(block, n);
+    if (echoTap != nullptr) {
+      echoTap->write(block, n);
+    }
+    out.write((const uint8_t *)block, n * sizeof(int16_t));
+  }
+}
+
+void DspPipeline::gainAndLimit(int16_t *samples, size_t sampleCount) {
+  // most frames never reach the knee, those only need the (vectorised) gain
+  if (!limiterEnabled || ((int32_t)dspPeakS16(samples, sampleCount) * gainQ12 >> 12) <= LIMIT_THRESHOLD) {
+    if (gainEnabled) {
+      dspScaleS16(samples, sampleCount, gainQ12);
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < sampleCount; i++) {
+    int32_t x = (samples[i] * gainQ12) >> 12;
+    int32_t magnitude = x < 0 ? -x : x;
+    if (magnitude > LIMIT_THRESHOLD) {
+      int32_t excess = magnitude - LIMIT_THRESHOLD;
+      magnitude = LIMIT_THRESHOLD + LIMIT_RANGE * excess / (excess + LIMIT_RANGE);
+      x = x < 0 ? -magnitude : magnitude;
+    }
+    samples[i] = (int16_t)x;
+  }
+}
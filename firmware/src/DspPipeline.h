@@ -0,0 +1,75 @@
+#pragma once
+
+#include <Arduino.h>
+#include "PitchShift.h"
+#include "DspKernels.h"
+
+class EchoReference;
+class AudioMixer;
+
+// In place processing chain between the Opus decoder and I2S:
+//   pitch shift (optional) -> mixer (optional) -> sample rate conversion (optional)
+//   -> gain + soft limiter -> out
+// Every stage is linear except the limiter, so gain is folded into the limiter pass and a frame
+// is touched once per enabled stage instead of once per AudioTools stream. The stages are
+// chosen by configure(), which the audio task calls after the auth message set them.
+class DspPipeline {
+public:
+  static constexpr size_t BLOCK_SIZE = 256;       // input samples per I2S write
+  static constexpr uint32_t MAX_SRC_RATIO = 3;    // e.g. 16 kHz decoded -> 48 kHz I2S
+  static constexpr float MAX_GAIN = 4.0f;
+  static constexpr float MIN_PITCH = 0.25f;      // the pitch shifter's taps move at most a few
+  static constexpr float MAX_PITCH = 4.0f;        // samples per sample, far below a grain
+
+  struct Config {
+    uint32_t inputRate = 24000;
+    uint32_t outputRate = 24000;
+    float gain = 1.0f;         // linear, 1.0 = unchanged
+    float pitch = 1.0f;        // 1.0 = no pitch shift, clamped to MIN_PITCH..MAX_PITCH, <= 0 off
+    bool softLimiter = false;  // always on when gain > 1.0
+  };
+
+  DspPipeline(Print &out) : out(out), pitchShift(nullOut) {}
+
+  // audioStreamTask: (re)select the stages, resets the pitch and resampler state
+  void configure(const Config &config);
+  // audioStreamTask: drop the state carried between frames
+  void reset();
+
+  // audioStreamTask: process a decoded mono frame in place and write it out
+  void write(int16_t *samples, size_t sampleCount);
+
+  // audioStreamTask: everything written to out is also handed to the echo canceller reference
+  void setEchoTap(EchoReference *tap) { echoTap = tap; }
+  // audioStreamTask: other sources are mixed into every block, after the pitch shift
+  void setMixer(AudioMixer *source) { mixer = source; }
+
+  const Config &config() const { return cfg; }
+
+protected:
+  // pitch shifting runs through process() only, the output is never used
+  class NullPrint : public Print {
+  public:
+    size_t write(uint8_t) override { return 1; }
+    size_t write(const uint8_t *, size_t len) override { return len; }
+  };
+
+  Print &out;
+  NullPrint nullOut;
+  PitchShiftFixedOutput pitchShift;
+  Config cfg;
+
+  bool pitchEnabled = false;
+  bool srcEnabled = false;
+  bool gainEnabled = false;
+  bool limiterEnabled = false;
+  int32_t gainQ12 = 4096;
+
+  LinearResampler resampler;
+  EchoReference *echoTap = nullptr;
+  AudioMixer *mixer = nullptr;
+
+  alignas(16) int16_t srcBlock[BLOCK_SIZE * MAX_SRC_RATIO + 2];
+
+  void gainAndLimit(int16_t *samples, size_t sampleCount);
+};
@@ -0,0 +1,114 @@
+#include "EchoCanceller.h"
+#include <math.h>
+
+void EchoReference::configure(uint32_t playbackRate, uint32_t micRate, uint32_t restartGapMs) {
+  resampler.begin(playbackRate, micRate);
+  this->restartGapMs = restartGapMs;
+  restartPending = true;
+}
+
+void EchoReference::write(const int16_t *samples, size_t sampleCount) {
+  if (!enabled()) {
+    return;
+  }
+
+  // after a flush or an I2S underrun the DMA played silence in between, so the old
+  // alignment no longer holds: pin the next reference sample to the current mic position
+  uint32_t now = millis();
+  if (restartPending || now - lastWriteMs > restartGapMs) {
+    offset.store(micPosition.load(std::memory_order_acquire) - written.load(std::memory_order_relaxed),
+                 std::memory_order_release);
+    resampler.reset();
+    restartPending = false;
+  }
+  lastWriteMs = now;
+
+  // resampled in chunks that fit the scratch buffer even when upsampling 2:1
+  const size_t chunk = sizeof(resampled) / sizeof(resampled[0]) / 2 - 1;
+  for (size_t i = 0; i < sampleCount; i += chunk) {
+    size_t n = min(chunk, sampleCount - i);
+    size_t produced = resampler.process(samples + i, n, resampled);
+    uint32_t w = written.load(std::memory_order_relaxed);
+    for (size_t j = 0; j < produced; j++) {
+      ring[(w + j) & MASK] = resampled[j];
+    }
+    written.store(w + produced, std::memory_order_release);
+  }
+}
+
+void EchoReference::read(int16_t *out, size_t sampleCount, uint32_t delaySamples) {
+  uint32_t pos = micPosition.load(std::memory_order_relaxed);
+  uint32_t base = offset.load(std::memory_order_acquire);
+  uint32_t w = written.load(std::memory_order_acquire);
+
+  for (size_t i = 0; i < sampleCount; i++) {
+    // index of the reference sample that reaches the mic with this mic sample
+    int32_t k = (int32_t)(pos + i - delaySamples - base);
+    // not played yet, or old enough that the writer may be overwriting it
+    if (k < 0 || (uint32_t)k >= w || w - (uint32_t)k > CAPACITY - 512) {
+      out[i] = 0;
+    } else {
+      out[i] = ring[(uint32_t)k & MASK];
+    }
+  }
+  micPosition.store(pos + sampleCount, std::memory_order_release);
+}
+
+void EchoCanceller::reset() {
+  memset(weights, 0, sizeof(weights));
+  memset(history, 0, sizeof(history));
+  pos = 0;
+  refEnergy = 0.0f;
+  doubleTalkHold = 0;
+  micPower = 0.0f;
+  errPower = 0.0f;
+  echoShort = 0.0f;
+  errShort = 0.0f;
+}
+
+void EchoCanceller::process(int16_t *mic, const int16_t *ref, size_t sampleCount) {
+  for (size_t i = 0; i < sampleCount; i++) {
+    float x = ref[i];
+    float d = mic[i];
+
+    // newest sample first: history[pos .. pos + TAPS - 1] is the filter window
+    pos = (pos == 0 ? TAPS : pos) - 1;
+    float oldest = history[pos];
+    history[pos] = x;
+    history[pos + TAPS] = x;
+    refEnergy += x * x - oldest * oldest;
+    if (refEnergy < 0.0f) {
+      refEnergy = 0.0f;
+    }
+
+    const float *window = history + pos;
+    float y = dspDotF32(weights, window, TAPS);
+    float e = d - y;
+
+    micPower += (d * d - micPower) * 0.002f;
+    errPower += (e * e - errPower) * 0.002f;
+    echoShort += (y * y - echoShort) * 0.015f;
+    errShort += (e * e - errShort) * 0.015f;
+
+    // only trust the echo estimate after the filter removed at least 6 dB
+    bool converged = errPower * 4.0f < micPower;
+    if (converged && errShort > DOUBLE_TALK_RATIO * echoShort) {
+      doubleTalkHold = DOUBLE_TALK_HOLD;
+    } else if (doubleTalkHold > 0) {
+      doubleTalkHold--;
+    }
+
+    if (doubleTalkHold == 0 && refEnergy > MIN_REF_ENERGY) {
+      float g = MU * e / (refEnergy + 1.0f);
+      for (size_t k = 0; k < TAPS; k++) {
+        weights[k] += g * window[k];
+      }
+    }
+
+    mic[i] = dspSaturateS16((int32_t)lrintf(e));
+  }
+}
+
+float EchoCanceller::erleDb() const {
+  return 10.0f * log10f((micPower + 1.0f) / (errPower + 1.0f));
+}
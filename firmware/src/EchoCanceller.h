@@ -0,0 +1,78 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "DspKernels.h"
+
+// What the speaker played, at the mic sample rate, for the echo canceller.
+// audioStreamTask writes every block right before it is queued to I2S; micTask reads the
+// reference that lines up with each mic chunk. Both I2S peripherals run from the same clock,
+// so the two are matched by sample count: when playback (re)starts the reference is pinned to
+// the current mic position, and a fixed bulk delay covers the DMA and acoustic path.
+class EchoReference {
+public:
+  static constexpr size_t CAPACITY = 4096;  // 256 ms at 16 kHz, a power of two
+
+  // micTask, while disabled: rates of the speaker and the mic
+  void configure(uint32_t playbackRate, uint32_t micRate, uint32_t restartGapMs);
+  void setEnabled(bool on) { isEnabled.store(on, std::memory_order_release); }
+  bool enabled() const { return isEnabled.load(std::memory_order_acquire); }
+
+  // audioStreamTask: a block that is about to be written to I2S
+  void write(const int16_t *samples, size_t sampleCount);
+  // audioStreamTask: output was flushed, the next write starts a new timeline
+  void restart() { restartPending = true; }
+
+  // micTask: reference for the next sampleCount mic samples, zeros while nothing played
+  void read(int16_t *out, size_t sampleCount, uint32_t delaySamples);
+
+protected:
+  static constexpr size_t MASK = CAPACITY - 1;
+
+  int16_t ring[CAPACITY];
+  std::atomic<bool> isEnabled{false};
+  std::atomic<uint32_t> written{0};      // reference samples written so far
+  std::atomic<uint32_t> offset{0};       // mic position of reference sample 0, before the delay
+  std::atomic<uint32_t> micPosition{0};  // mic samples read so far
+
+  // producer side
+  LinearResampler resampler;
+  int16_t resampled[512];
+  bool restartPending = true;
+  uint32_t lastWriteMs = 0;
+  uint32_t restartGapMs = 64;
+};
+
+// Normalised LMS acoustic echo canceller on 16 kHz mono.
+// The adaptive FIR models the speaker -> mic path around the bulk delay of the reference and
+// its output is subtracted from the mic. Once the filter has converged, a residual that is much
+// louder than the estimated echo means the near end is talking; adaptation is frozen then, so
+// the filter does not learn to cancel the user.
+class EchoCanceller {
+public:
+  static constexpr size_t TAPS = 256;  // 16 ms of echo tail at 16 kHz
+
+  void reset();
+  // in place: mic becomes the mic minus the estimated echo of ref
+  void process(int16_t *mic, const int16_t *ref, size_t sampleCount);
+
+  // echo return loss enhancement over the recent past, for logs
+  float erleDb() const;
+  bool doubleTalk() const { return doubleTalkHold > 0; }
+
+protected:
+  static constexpr float MU = 0.35f;
+  static constexpr float MIN_REF_ENERGY = TAPS * 64.0f * 64.0f;  // don't adapt on near silence
+  static constexpr float DOUBLE_TALK_RATIO = 2.0f;                 // residual vs echo estimate
+  static constexpr uint32_t DOUBLE_TALK_HOLD = 480;                // 30 ms
+
+  float weights[TAPS];
+  float history[2 * TAPS];  // every sample stored twice, so the window is always contiguous
+  size_t pos = 0;
+  float refEnergy = 0.0f;
+  uint32_t doubleTalkHold = 0;
+  float micPower = 0.0f;      // ~30 ms averages, for ERLE
+  float errPower = 0.0f;
+  float echoShort = 0.0f;     // ~4 ms averages, for double talk
+  float errShort = 0.0f;
+};
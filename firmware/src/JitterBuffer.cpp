@@ -0,0 +1,169 @@
+#include "JitterBuffer.h"
+#include <opus.h>
+
+void JitterBuffer::begin(uint32_t sampleRate, uint32_t minDelayMs, uint32_t maxDelayMs) {
+  this->sampleRate = sampleRate;
+  this->minDelayMs = minDelayMs;
+  this->maxDelayMs = maxDelayMs > minDelayMs ? maxDelayMs : minDelayMs;
+  updateTarget();
+}
+
+void JitterBuffer::startStream() {
+  streamEnded.store(false, std::memory_order_release);
+  lastArrivalUs = 0;
+}
+
+void JitterBuffer::endStream() {
+  streamEnded.store(true, std::memory_order_release);
+}
+
+bool JitterBuffer::push(const uint8_t *data, size_t len) {
+  uint32_t now = micros();
+
+  int samples = opus_packet_get_nb_samples(data, len, sampleRate);
+  if (samples <= 0) {
+    return false;
+  }
+
+  // Inter-arrival jitter: how much later than its predecessor's duration a packet shows up.
+  // Early packets (the server runs ahead of real time) don't count, they only fill the buffer.
+  if (lastArrivalUs != 0) {
+    uint32_t gapUs = now - lastArrivalUs;
+    if (gapUs < STREAM_GAP_MS * 1000) {
+      uint32_t expectedUs = (uint64_t)lastSamples * 1000000 / sampleRate;
+      uint32_t lateUs = gapUs > expectedUs ? gapUs - expectedUs : 0;
+      int32_t delta = (int32_t)lateUs - (int32_t)jitterUs;
+      jitterUs = (uint32_t)((int32_t)jitterUs + delta / 16);
+      peakJitterUs = lateUs > peakJitterUs ? lateUs : peakJitterUs - peakJitterUs / 64;
+      updateTarget();
+    }
+  }
+  lastArrivalUs = now;
+  lastSamples = samples;
+  packets.fetch_add(1, std::memory_order_relaxed);
+
+  uint8_t *slot = len <= SLOT_SIZE ? queue.reserve() : nullptr;
+  if (slot == nullptr) {
+    // should not happen while networkTask honours hasRoom(); the decoder is told about the
+    // hole so it can use the FEC data of the next packet
+    overruns.fetch_add(1, std::memory_order_relaxed);
+    lostBeforeNext = true;
+    return false;
+  }
+
+  PacketInfo info = { (uint32_t)samples, lostBeforeNext ? FLAG_LOST_BEFORE : 0 };
+  memcpy(slot, &info, sizeof(info));
+  memcpy(slot + sizeof(info), data, len);
+  queue.commit(sizeof(info) + len);
+  pushedSamples.fetch_add(samples, std::memory_order_release);
+  lostBeforeNext = false;
+  return true;
+}
+
+JitterBuffer::Action JitterBuffer::next(const uint8_t *&data, size_t &len, bool &recoverLost) {
+  uint32_t target = targetMs();
+  bool ended = streamEnded.load(std::memory_order_acquire);
+
+  if (!isPlaying) {
+    // a full queue starts too: networkTask stops reading at !hasRoom(), short packets could
+    // otherwise never add up to the target and nothing would drain the socket again
+    if (queue.empty() || (bufferedMs() < target && !ended && hasRoom())) {
+      return WAIT;
+    }
+    isPlaying = true;
+    concealedMs = 0;
+  }
+
+  size_t slotLen;
+  const uint8_t *slot = queue.peek(slotLen);
+  if (slot != nullptr) {
+    PacketInfo info;
+    memcpy(&info, slot, sizeof(info));
+    data = slot + sizeof(info);
+    len = slotLen - sizeof(info);
+    // a late packet (TCP never loses) is simply played after the concealment, only a packet we
+    // had to drop ourselves leaves a hole that the FEC data of its successor can fill
+    recoverLost = (info.flags & FLAG_LOST_BEFORE) != 0;
+    if (recoverLost) {
+      recovered++;
+    }
+    concealedMs = 0;
+    return DECODE;
+  }
+
+  if (ended) {
+    // drained at the end of the response, not an underrun
+    isPlaying = false;
+    return WAIT;
+  }
+
+  if (concealedMs == 0) {
+    underruns++;
+  }
+  if (concealedMs >= MAX_CONCEAL_MS) {
+    // the link stalled for real: stop concealing and prime again
+    isPlaying = false;
+    concealedMs = 0;
+    return WAIT;
+  }
+  concealedMs += CONCEAL_FRAME_MS;
+  concealed++;
+  return CONCEAL;
+}
+
+void JitterBuffer::release() {
+  size_t slotLen;
+  const uint8_t *slot = queue.peek(slotLen);
+  if (slot == nullptr) {
+    return;
+  }
+  PacketInfo info;
+  memcpy(&info, slot, sizeof(info));
+  queue.pop();
+  playedSamples.fetch_add(info.samples, std::memory_order_release);
+}
+
+void JitterBuffer::clear() {
+  size_t slotLen;
+  const uint8_t *slot;
+  while ((slot = queue.peek(slotLen)) != nullptr) {
+    PacketInfo info;
+    memcpy(&info, slot, sizeof(info));
+    queue.pop();
+    playedSamples.fetch_add(info.samples, std::memory_order_release);
+  }
+  isPlaying = false;
+  concealedMs = 0;
+}
+
+uint32_t JitterBuffer::bufferedMs() const {
+  uint32_t pushed = pushedSamples.load(std::memory_order_acquire);
+  uint32_t played = playedSamples.load(std::memory_order_acquire);
+  return samplesToMs(pushed - played);
+}
+
+// target depth: one concealment frame of headroom plus enough to ride out the jitter peaks
+void JitterBuffer::updateTarget() {
+  uint32_t target = CONCEAL_FRAME_MS + (2 * jitterUs + peakJitterUs) / 1000;
+  if (target < minDelayMs) {
+    target = minDelayMs;
+  }
+  if (target > maxDelayMs) {
+    target = maxDelayMs;
+  }
+  targetDelayMs.store(target, std::memory_order_relaxed);
+}
+
+JitterBuffer::Stats JitterBuffer::stats() const {
+  Stats s;
+  s.packets = packets.load(std::memory_order_relaxed);
+  s.underruns = underruns;
+  s.overruns = overruns.load(std::memory_order_relaxed);
+  s.concealed = concealed;
+  s.recovered = recovered;
+  s.jitterMs = jitterUs / 1000;
+  s.peakJitterMs = peakJitterUs / 1000;
+  s.targetMs = targetMs();
+  s.bufferedMs = bufferedMs();
+  return s;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "PacketQueue.h"
+
+// Packet level adaptive jitter buffer for the Opus downlink.
+// networkTask pushes packets as they arrive; the playout side (audioStreamTask) asks next()
+// what to play. Playback only starts once the buffered audio reaches a target depth, and that
+// target follows the measured inter-arrival jitter so good links run shallow and bad links
+// buffer deeper. Missing audio is reported as CONCEAL so the caller can run Opus PLC/FEC.
+// TTS is sent faster than real time, so nothing queued is ever thrown away to save latency:
+// when the buffer is nearly full the network side stops reading (TCP backpressure) instead,
+// and playback starts even below the target so the reader gets going again.
+class JitterBuffer {
+public:
+  static constexpr size_t SLOT_SIZE = 1024;  // 120 ms @ 24 kbps is ~360 bytes
+  static constexpr size_t SLOT_COUNT = 32;
+  static constexpr size_t HEADROOM_SLOTS = 2;
+
+  enum Action {
+    WAIT,     // nothing to play yet (priming, or the stream ended)
+    DECODE,   // decode the returned packet, then call release()
+    CONCEAL   // a packet is late: synthesize concealmentSamples() with PLC
+  };
+
+  struct Stats {
+    uint32_t packets;
+    uint32_t underruns;     // playout found the buffer empty mid-stream
+    uint32_t overruns;      // packets dropped because the buffer was full
+    uint32_t concealed;     // PLC frames played
+    uint32_t recovered;     // lost frames rebuilt from in-band FEC
+    uint32_t jitterMs;      // smoothed inter-arrival jitter
+    uint32_t peakJitterMs;  // decaying peak of the inter-arrival jitter
+    uint32_t targetMs;      // current target depth
+    uint32_t bufferedMs;    // audio currently buffered
+  };
+
+  // setup(): the packet slots, storageBytes() of memory that stays with the buffer
+  static constexpr size_t storageBytes() { return decltype(queue)::storageBytes(); }
+  bool attach(void *storage) { return queue.begin(storage); }
+
+  void begin(uint32_t sampleRate, uint32_t minDelayMs = 60, uint32_t maxDelayMs = 480);
+
+  // networkTask: new response, stray audio from the old one is already discarded by clear()
+  void startStream();
+  // networkTask: the server has sent the last packet of this response
+  void endStream();
+  // networkTask: queue an Opus packet, stamps its arrival and updates the jitter estimate
+  bool push(const uint8_t *data, size_t len);
+  // networkTask: the sender's sequence numbers skipped packets, the next push() recovers one with FEC
+  void markLost() { lostBeforeNext = true; }
+
+  // audioStreamTask: decide what to play next
+  Action next(const uint8_t *&data, size_t &len, bool &recoverLost);
+  // audioStreamTask: done with the packet returned by next()
+  void release();
+  // audioStreamTask: drop every queued packet and start priming again
+  void clear();
+
+  bool empty() const { return queue.empty(); }
+  // networkTask: false once the reader should pause so the socket applies backpressure
+  bool hasRoom() const { return queue.size() + HEADROOM_SLOTS < SLOT_COUNT; }
+  bool playing() const { return isPlaying; }
+  // audioStreamTask: the response ended and its last packet has been handed to the decoder
+  bool drained() const { return streamEnded.load(std::memory_order_acquire) && queue.empty() && !isPlaying; }
+  size_t concealmentSamples() const { return sampleRate / 1000 * CONCEAL_FRAME_MS; }
+  uint32_t targetMs() const { return targetDelayMs.load(std::memory_order_relaxed); }
+  uint32_t bufferedMs() const;
+  Stats stats() const;
+
+protected:
+  static constexpr uint32_t CONCEAL_FRAME_MS = 20;
+  static constexpr uint32_t MAX_CONCEAL_MS = 120;
+  static constexpr uint32_t STREAM_GAP_MS = 1000;  // arrivals further apart start a new burst
+
+  struct PacketInfo {
+    uint32_t samples;
+    uint32_t flags;
+  };
+  static constexpr uint32_t FLAG_LOST_BEFORE = 1;
+
+  PacketQueue<SLOT_SIZE + sizeof(PacketInfo), SLOT_COUNT> queue;
+
+  uint32_t sampleRate = 24000;
+  uint32_t minDelayMs = 60;
+  uint32_t maxDelayMs = 480;
+
+  // producer side
+  uint32_t lastArrivalUs = 0;
+  uint32_t lastSamples = 0;
+  bool lostBeforeNext = false;
+  uint32_t jitterUs = 20000;
+  uint32_t peakJitterUs = 20000;
+
+  // shared
+  std::atomic<uint32_t> pushedSamples{0};
+  std::atomic<uint32_t> playedSamples{0};
+  std::atomic<uint32_t> targetDelayMs{120};
+  std::atomic<bool> streamEnded{false};
+  std::atomic<uint32_t> packets{0};
+  std::atomic<uint32_t> overruns{0};
+
+  // consumer side
+  bool isPlaying = false;
+  uint32_t concealedMs = 0;
+  uint32_t underruns = 0;
+  uint32_t concealed = 0;
+  uint32_t recovered = 0;
+
+  uint32_t samplesToMs(uint32_t samples) const { return samples * 1000 / sampleRate; }
+  void updateTarget();
+};
@@ -0,0 +1,64 @@
+#include "JsonArena.h"
+
+void *JsonArena::allocate(size_t bytes)
+{
+    size_t start = align(used);
+    size_t end = start + sizeof(BlockHeader) + align(bytes);
+    if (end > size) {
+        return nullptr;
+    }
+
+    BlockHeader *block = reinterpret_cast<BlockHeader *>(buffer + start);
+    block->bytes = bytes;
+    block->previous = last;
+    last = start;
+    used = end;
+    peakUsed = max(peakUsed, used);
+    return block + 1;
+}
+
+void JsonArena::deallocate(void *ptr)
+{
+    if (ptr == nullptr) {
+        return;
+    }
+    // only the newest block gives its space back, the rest waits for reset()
+    if (offsetOf(ptr) == last) {
+        used = last;
+        last = header(ptr)->previous;
+    }
+}
+
+void *JsonArena::reallocate(void *ptr, size_t bytes)
+{
+    if (ptr == nullptr) {
+        return allocate(bytes);
+    }
+
+    BlockHeader *block = header(ptr);
+    // shrinking (ArduinoJson trims pools and strings once they are complete) stays in place
+    if (bytes <= block->bytes) {
+        if (offsetOf(ptr) == last) {
+            used = last + sizeof(BlockHeader) + align(bytes);
+        }
+        block->bytes = bytes;
+        return ptr;
+    }
+    // the newest block grows in place while there is room behind it
+    if (offsetOf(ptr) == last) {
+        size_t end = last + sizeof(BlockHeader) + align(bytes);
+        if (end > size) {
+            return nullptr;
+        }
+        block->bytes = bytes;
+        used = end;
+        peakUsed = max(peakUsed, used);
+        return ptr;
+    }
+
+    void *moved = allocate(bytes);
+    if (moved != nullptr) {
+        memcpy(moved, ptr, block->bytes);
+    }
+    return moved;
+}
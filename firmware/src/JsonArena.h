@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// ArduinoJson allocator over a fixed buffer, for documents that are parsed, read and dropped
+// on a hot path. Allocation bumps a pointer; freeing or growing the newest block happens in
+// place, anything else is reclaimed by reset(). When the buffer is exhausted allocate()
+// fails and deserializeJson() reports NoMemory instead of reaching for the heap.
+// One arena serves one task at a time.
+class JsonArena : public ArduinoJson::Allocator {
+public:
+    JsonArena(uint8_t *buffer, size_t size) : buffer(buffer), size(size) {}
+
+    void *allocate(size_t bytes) override;
+    void deallocate(void *ptr) override;
+    void *reallocate(void *ptr, size_t bytes) override;
+
+    // drop every block, the documents using the arena must be gone or cleared
+    void reset() { used = 0; last = NO_BLOCK; }
+    size_t peak() const { return peakUsed; }
+    size_t capacity() const { return size; }
+
+protected:
+    // in front of every block, keeps blocks 8 byte aligned
+    struct BlockHeader {
+        uint32_t bytes;
+        uint32_t previous;  // offset of the block allocated before this one
+    };
+    static constexpr uint32_t NO_BLOCK = 0xFFFFFFFF;
+
+    uint8_t *buffer;
+    size_t size;
+    size_t used = 0;
+    uint32_t last = NO_BLOCK;  // offset of the newest block header
+    size_t peakUsed = 0;
+
+    BlockHeader *header(void *ptr) { return reinterpret_cast<BlockHeader *>(ptr) - 1; }
+    uint32_t offsetOf(void *ptr) { return (uint8_t *)header(ptr) - buffer; }
+    static size_t align(size_t bytes) { return (bytes + 7) & ~(size_t)7; }
+};
+
+template <size_t SIZE>
+class StaticJsonArena : public JsonArena {
+public:
+    StaticJsonArena() : JsonArena(storage, SIZE) {}
+
+private:
+    alignas(8) uint8_t storage[SIZE];
+};
@@ -1,330 +1,129 @@
 #include "LEDHandler.h"
+#include "Log.h"
+#include <driver/ledc.h>
 
-int brightness = 0;
-int fadeAmount = 5;
-static unsigned long lastToggle = 0;
-static bool ledState = false;
-
-void setLEDColor(uint8_t r, uint8_t g, uint8_t b)
-{
-    analogWrite(RED_LED_PIN, r);
-    analogWrite(GREEN_LED_PIN, g);
-    analogWrite(BLUE_LED_PIN, b);
-}
-
-void setStaticColor(StaticColor color)
-{
-    switch (color)
-    {
-    case StaticColor::RED:
-        digitalWrite(RED_LED_PIN, LOW);
-        digitalWrite(GREEN_LED_PIN, HIGH);
-        digitalWrite(BLUE_LED_PIN, HIGH);
-        break;
-    case StaticColor::GREEN:
-        digitalWrite(RED_LED_PIN, HIGH);
-        digitalWrite(GREEN_LED_PIN, LOW);
-        digitalWrite(BLUE_LED_PIN, HIGH);
-        break;
-    case StaticColor::BLUE:
-        digitalWrite(RED_LED_PIN, HIGH);
-        digitalWrite(GREEN_LED_PIN, HIGH);
-        digitalWrite(BLUE_LED_PIN, LOW);
-        break;
-    case StaticColor::YELLOW:
-        digitalWrite(RED_LED_PIN, LOW);
-        digitalWrite(GREEN_LED_PIN, LOW);
-        digitalWrite(BLUE_LED_PIN, HIGH);
-        break;
-    case StaticColor::MAGENTA:
-        digitalWrite(RED_LED_PIN, LOW);
-        digitalWrite(GREEN_LED_PIN, HIGH);
-        digitalWrite(BLUE_LED_PIN, LOW);
-        break;
-    case StaticColor::CYAN:
-        digitalWrite(RED_LED_PIN, HIGH);
-        digitalWrite(GREEN_LED_PIN, LOW);
-        digitalWrite(BLUE_LED_PIN, LOW);
-        break;
-    case StaticColor::WHITE:
-    digitalWrite(RED_LED_PIN, LOW);
-    digitalWrite(GREEN_LED_PIN, LOW);
-    digitalWrite(BLUE_LED_PIN, LOW);
-    break;
-    }
-}
-
-void loopCyanPinkYellow()
-{
-    // Cyan (Green + Blue)
-    digitalWrite(RED_LED_PIN, LOW);
-    digitalWrite(GREEN_LED_PIN, HIGH);
-    digitalWrite(BLUE_LED_PIN, HIGH);
-    delay(500);
-
-    // Pink (Red + Blue)
-    digitalWrite(RED_LED_PIN, HIGH);
-    digitalWrite(GREEN_LED_PIN, LOW);
-    digitalWrite(BLUE_LED_PIN, HIGH);
-    delay(500);
-
-    // Yellow (Red + Green)
-    digitalWrite(RED_LED_PIN, HIGH);
-    digitalWrite(GREEN_LED_PIN, HIGH);
-    digitalWrite(BLUE_LED_PIN, LOW);
-    delay(500);
-}
-
-void pulseWhite()
+// the LEDs are active low, the channels invert their output so duty 0 is off and 255 full
+struct LedScene
 {
-    setLEDColor(brightness, brightness, brightness);
-    brightness += fadeAmount;
-    if (brightness <= 0 || brightness >= 255) // Changed from 255 to 128
-    {
-        fadeAmount = -fadeAmount;
-    }
-}
-
-void pulseMagenta()
-{
-    setLEDColor(brightness, 0, brightness);
-    brightness += fadeAmount;
-    if (brightness <= 0 || brightness >= 255) // Changed from 255 to 128
-    {
-        fadeAmount = -fadeAmount;
-    }
-}
+    uint8_t r, g, b;
+    uint16_t pulseMs;   // 0: static, otherwise fading down and back up takes this long
+};
 
-void pulseYellow()
-{
-    setLEDColor(brightness, brightness, 0);
-    brightness += fadeAmount;
-    if (brightness <= 0 || brightness >= 255) // Changed from 255 to 128
-    {
-        fadeAmount = -fadeAmount;
-    }
-}
+static constexpr ledc_mode_t LED_MODE = LEDC_LOW_SPEED_MODE;
+static constexpr ledc_timer_t LED_TIMER = LEDC_TIMER_0;
+static constexpr uint32_t LED_FREQ_HZ = 5000;
+static constexpr uint32_t LED_TRANSITION_MS = 150;  // cross fade between two scenes
+static constexpr uint8_t LED_PULSE_FLOOR = 32;      // of 255, the low point of a pulse
 
-void pulseBlue()
-{
-    setLEDColor(0, 0, brightness);
-    brightness += fadeAmount;
-    if (brightness <= 0 || brightness >= 255) // Changed from 255 to 128
-    {
-        fadeAmount = -fadeAmount;
-    }
-}
+static const ledc_channel_t LED_CHANNELS[3] = {LEDC_CHANNEL_0, LEDC_CHANNEL_1, LEDC_CHANNEL_2};
 
-void blinkWhite()
-{
-    if (ledState)
-    {
-        digitalWrite(RED_LED_PIN, HIGH);
-        digitalWrite(GREEN_LED_PIN, HIGH);
-        digitalWrite(BLUE_LED_PIN, HIGH);
-    }
-    else
-    {
-        digitalWrite(RED_LED_PIN, LOW);
-        digitalWrite(GREEN_LED_PIN, LOW);
-        digitalWrite(BLUE_LED_PIN, LOW);
-    }
-}
+static TaskHandle_t ledTaskHandle = nullptr;
+static bool ledcReady = false;
 
-void blinkGreen()
+static LedScene sceneFor(DeviceState state)
 {
-    digitalWrite(BLUE_LED_PIN, LOW);
-    digitalWrite(RED_LED_PIN, LOW);
-    if (ledState)
-    {
-        digitalWrite(GREEN_LED_PIN, HIGH);
-    }
-    else
+    switch (state)
     {
-        digitalWrite(GREEN_LED_PIN, LOW);
+    case IDLE:
+        return {255, 255, 255, 0};      // white
+    case SOFT_AP:
+        return {255, 0, 255, 0};        // magenta
+    case PROCESSING:
+        return {0, 255, 0, 1200};       // green, pulsing while the server thinks
+    case SPEAKING:
+        return {0, 0, 255, 0};          // blue
+    case LISTENING:
+        return {255, 255, 0, 0};        // yellow
+    case SLEEP:
+        return {255, 0, 0, 0};          // red
+    case DOZE:
+        return {0, 0, 0, 0};            // off
+    default:
+        return {0, 255, 0, 0};          // green
     }
 }
 
-void blinkYellow()
-{
-    digitalWrite(BLUE_LED_PIN, LOW);
-    if (ledState)
-    {
-        digitalWrite(RED_LED_PIN, HIGH);
-        digitalWrite(GREEN_LED_PIN, HIGH);
-    }
-    else
-    {
-        digitalWrite(RED_LED_PIN, LOW);
-        digitalWrite(GREEN_LED_PIN, LOW);
-    }
-}
-
-void turnOffLED()
-{
-    digitalWrite(RED_LED_PIN, LOW);
-    digitalWrite(GREEN_LED_PIN, LOW);
-    digitalWrite(BLUE_LED_PIN, LOW);
-}
-
-void turnOnLED()
-{
-    digitalWrite(RED_LED_PIN, HIGH);
-    digitalWrite(GREEN_LED_PIN, HIGH);
-    digitalWrite(BLUE_LED_PIN, HIGH);
-}
-
 void setupRGBLED()
 {
-    pinMode(RED_LED_PIN, OUTPUT);
-    pinMode(GREEN_LED_PIN, OUTPUT);
-    pinMode(BLUE_LED_PIN, OUTPUT);
-    turnOffLED(); // Turn off the LED initially
-}
-
-void blinkCyanPulse()
-{
-    analogWrite(GREEN_LED_PIN, brightness);
-    analogWrite(BLUE_LED_PIN, brightness);
-
-    brightness += fadeAmount;
-    if (brightness <= 0 || brightness >= 255)
-    {
-        fadeAmount = -fadeAmount;
-    }
-}
-
-const uint8_t colorSequence[][3] = {
-    {0, 255, 255}, // Cyan   (R=0,   G=255, B=255)
-    {255, 0, 255}, // Pink   (R=255, G=0,   B=255)
-    {255, 255, 0}, // Yellow (R=255, G=255, B=0)
-};
-const int NUM_COLORS = sizeof(colorSequence) / sizeof(colorSequence[0]);
-
-void loopCyanPinkYellowPulse(unsigned long currentTime)
-{
-    // Duration of each color fade
-    const unsigned long transitionDuration = 1000; // 500 ms per fade
-
-    // colorIndex = which color in colorSequence we’re currently *starting* from
-    static int colorIndex = 0;
+    ledc_timer_config_t timer = {};
+    timer.speed_mode = LED_MODE;
+    timer.duty_resolution = LEDC_TIMER_8_BIT;
+    timer.timer_num = LED_TIMER;
+    timer.freq_hz = LED_FREQ_HZ;
+    timer.clk_cfg = LEDC_AUTO_CLK;
+    esp_err_t err = ledc_timer_config(&timer);
 
-    // We'll store the "start color" and "end color" for the current fade
-    static uint8_t startColor[3];
-    static uint8_t endColor[3];
-
-    // The timestamp at which the current fade *started*
-    static unsigned long transitionStartTime = 0;
-
-    // A flag so we can initialize the first fade
-    static bool initialized = false;
-
-    if (!initialized)
-    {
-        // On the very first call, set the starting color to colorSequence[0]
-        // and the endColor to the next color in the array
-        memcpy(startColor, colorSequence[colorIndex], 3);
-        int nextIndex = (colorIndex + 1) % NUM_COLORS;
-        memcpy(endColor, colorSequence[nextIndex], 3);
-
-        transitionStartTime = currentTime;
-        initialized = true;
+    const int pins[3] = {RED_LED_PIN, GREEN_LED_PIN, BLUE_LED_PIN};
+    for (size_t i = 0; i < 3 && err == ESP_OK; i++) {
+        ledc_channel_config_t channel = {};
+        channel.gpio_num = pins[i];
+        channel.speed_mode = LED_MODE;
+        channel.channel = LED_CHANNELS[i];
+        channel.timer_sel = LED_TIMER;
+        channel.duty = 0;
+        channel.flags.output_invert = 1;
+        err = ledc_channel_config(&channel);
     }
-
-    // How long has this transition been running?
-    unsigned long elapsed = currentTime - transitionStartTime;
-    float t = (float)elapsed / (float)transitionDuration;
-    if (t > 1.0f)
-    {
-        t = 1.0f; // clamp
+    if (err == ESP_OK) {
+        err = ledc_fade_func_install(0);
     }
-
-    // Interpolate each channel: R, G, B
-    uint8_t r = startColor[0] + (endColor[0] - startColor[0]) * t;
-    uint8_t g = startColor[1] + (endColor[1] - startColor[1]) * t;
-    uint8_t b = startColor[2] + (endColor[2] - startColor[2]) * t;
-
-    // Write these values to your LED pins
-    analogWrite(RED_LED_PIN, r);
-    analogWrite(GREEN_LED_PIN, g);
-    analogWrite(BLUE_LED_PIN, b);
-
-    // Check if this transition has finished
-    if (elapsed >= transitionDuration)
-    {
-        // Move to next color in the sequence
-        colorIndex = (colorIndex + 1) % NUM_COLORS;
-        memcpy(startColor, endColor, 3); // old 'end' becomes new 'start'
-
-        int nextIndex = (colorIndex + 1) % NUM_COLORS;
-        memcpy(endColor, colorSequence[nextIndex], 3);
-
-        transitionStartTime = currentTime; // reset the clock for the next fade
+    ledcReady = err == ESP_OK;
+    if (!ledcReady) {
+        LOG_E("[LED] LEDC setup failed: %s", esp_err_to_name(err));
     }
 }
 
-void blinkBlue()
+// ledTask -> fadeTo()
+// the fade runs in hardware; a fade that is still running is finished first by the driver
+static void fadeTo(const uint8_t rgb[3], uint32_t fadeMs)
 {
-    digitalWrite(GREEN_LED_PIN, LOW);
-    digitalWrite(RED_LED_PIN, LOW);
-    if (ledState)
-    {
-        digitalWrite(BLUE_LED_PIN, HIGH);
+    if (!ledcReady) {
+        return;
     }
-    else
-    {
-        digitalWrite(BLUE_LED_PIN, LOW);
+    for (size_t i = 0; i < 3; i++) {
+        ledc_set_fade_with_time(LED_MODE, LED_CHANNELS[i], rgb[i], fadeMs);
+        ledc_fade_start(LED_MODE, LED_CHANNELS[i], LEDC_FADE_NO_WAIT);
     }
 }
 
-void staticYellow()
+void ledNotify()
 {
-    digitalWrite(BLUE_LED_PIN, LOW);
-    digitalWrite(RED_LED_PIN, HIGH);
-    digitalWrite(GREEN_LED_PIN, HIGH);
+    if (ledTaskHandle != nullptr) {
+        xTaskNotifyGive(ledTaskHandle);
+    }
 }
 
 void ledTask(void *parameter)
 {
+    ledTaskHandle = xTaskGetCurrentTaskHandle();
     setupRGBLED();
-    unsigned long currentTime = 0;
+
+    DeviceState shown = SETUP;  // nothing shown yet, the first pass fades in
+    bool pulseLow = false;
     while (1)
     {
-        currentTime += 20; // Track time based on vTaskDelay
-
-        // Toggle LED state every 200ms for blinking functions
-        if (currentTime - lastToggle >= 200)
-        {
-            ledState = !ledState;
-            lastToggle = currentTime;
+        DeviceState state = deviceState;
+        LedScene scene = sceneFor(state);
+        uint8_t rgb[3] = {scene.r, scene.g, scene.b};
+        uint32_t waitMs = LED_TRANSITION_MS;
+
+        if (state != shown) {
+            shown = state;
+            pulseLow = false;
+            fadeTo(rgb, LED_TRANSITION_MS);
+        } else if (scene.pulseMs > 0) {
+            // a pulse turns around (or a state came and went again before we woke)
+            pulseLow = !pulseLow;
+            if (pulseLow) {
+                for (uint8_t &c : rgb) {
+                    c = c * LED_PULSE_FLOOR / 255;
+                }
+            }
+            fadeTo(rgb, scene.pulseMs / 2);
+            waitMs = scene.pulseMs / 2;
         }
 
-         switch (deviceState)
-        {
-        case IDLE:
-            setStaticColor(StaticColor::WHITE);
-            break;
-        case SOFT_AP:
-            setStaticColor(StaticColor::MAGENTA);
-            break;
-        case PROCESSING:
-            setStaticColor(StaticColor::GREEN);
-            break;
-        case SPEAKING:
-            setStaticColor(StaticColor::BLUE);
-            break;
-        case LISTENING:
-            setStaticColor(StaticColor::YELLOW);
-            break;
-        case SLEEP:
-            setStaticColor(StaticColor::RED);
-            break;
-        default:
-            setStaticColor(StaticColor::GREEN); // LED on
-            break;
-        }
-
-        // Delay for smoother LED transitions
-        vTaskDelay(20 / portTICK_PERIOD_MS); // Approximate the delay from the original `pulsateLED()`
+        // static scenes sleep until the next state change
+        ulTaskNotifyTake(pdTRUE, scene.pulseMs ? pdMS_TO_TICKS(waitMs) : portMAX_DELAY);
     }
-}
\ No newline at end of file
+}
@@ -3,24 +3,12 @@
 
 #include "Config.h"
 
-enum class StaticColor
-{
-    RED,
-    GREEN,
-    BLUE,
-    YELLOW,
-    MAGENTA,
-    CYAN,
-    WHITE,
-};
-
-void setStaticColor(StaticColor color);
-void setLEDColor(uint8_t r, uint8_t g, uint8_t b);
-void turnOffLED();
-void turnOnLED();
+// LED ENGINE: one scene (colour, optional pulse) per device state, rendered with LEDC
+// hardware fades. ledTask sleeps until setDeviceState() calls ledNotify(), or until a
+// pulse has to turn around; nothing polls deviceState.
 void setupRGBLED();
-void turnOnBlueLED();
-void turnOnRedLEDFlash();
 void ledTask(void *parameter);
+// any task: deviceState changed
+void ledNotify();
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,147 @@
+#include "Log.h"
+#include "Scheduling.h"
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+
+// one ring item: header followed by the text, no terminator
+struct LogRecordHeader
+{
+    uint32_t ms;
+    uint8_t level;
+};
+
+static const char LEVEL_CHARS[] = "-EWID";
+
+static RingbufHandle_t logRing = nullptr;
+static std::atomic<uint32_t> queuedRecords{0};
+static std::atomic<uint32_t> printedRecords{0};
+static std::atomic<uint32_t> droppedRecords{0};
+
+bool LogRateLimit::allow(uint32_t periodMs, uint32_t &skipped)
+{
+    uint32_t now = millis();
+    if (started && now - lastMs < periodMs) {
+        suppressed++;
+        return false;
+    }
+    started = true;
+    lastMs = now;
+    skipped = suppressed;
+    suppressed = 0;
+    return true;
+}
+
+// logTask, or the caller before logBegin()
+static void printRecord(uint32_t ms, uint8_t level, const char *text, size_t length)
+{
+    Serial.printf("%7lu %c ", (unsigned long)ms, LEVEL_CHARS[level < sizeof(LEVEL_CHARS) - 1 ? level : 0]);
+    Serial.write(reinterpret_cast<const uint8_t *>(text), length);
+    Serial.write('\n');
+}
+
+// logTask is the only writer to Serial once it runs
+static void logTask(void *parameter)
+{
+    for (;;) {
+        size_t size = 0;
+        void *item = xRingbufferReceive(logRing, &size, portMAX_DELAY);
+        if (item == nullptr) {
+            continue;
+        }
+
+        uint32_t dropped = droppedRecords.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            Serial.printf("[LOG] %u lines dropped, ring full\n", (unsigned)dropped);
+        }
+
+        const LogRecordHeader *header = static_cast<const LogRecordHeader *>(item);
+        printRecord(header->ms, header->level, reinterpret_cast<const char *>(header + 1), size - sizeof(LogRecordHeader));
+        vRingbufferReturnItem(logRing, item);
+        printedRecords.fetch_add(1, std::memory_order_release);
+    }
+}
+
+void logBegin()
+{
+    if (logRing != nullptr) {
+        return;
+    }
+    RingbufHandle_t ring = xRingbufferCreate(LOG_RING_SIZE, RINGBUF_TYPE_NOSPLIT);
+    if (ring == nullptr) {
+        Serial.println("Failed to create the log ring, logging synchronously");
+        return;
+    }
+    logRing = ring;
+
+    static ProfiledTask<TASK_LOG> logTaskStack;
+    logTaskStack.start(logTask);
+}
+
+static void logRecordV(uint8_t level, uint32_t skipped, const char *format, va_list args)
+{
+    struct {
+        LogRecordHeader header;
+        char text[LOG_LINE_MAX];
+    } record;
+    record.header.ms = millis();
+    record.header.level = level;
+
+    int length = vsnprintf(record.text, sizeof(record.text), format, args);
+    if (length < 0) {
+        return;
+    }
+    size_t used = min((size_t)length, sizeof(record.text) - 1);
+    while (used > 0 && (record.text[used - 1] == '\n' || record.text[used - 1] == '\r')) {
+        used--;
+    }
+    if (skipped > 0 && used < sizeof(record.text) - 1) {
+        int extra = snprintf(record.text + used, sizeof(record.text) - used, " (+%u suppressed)", (unsigned)skipped);
+        used = min(used + (size_t)max(extra, 0), sizeof(record.text) - 1);
+    }
+
+    if (logRing == nullptr) {
+        printRecord(record.header.ms, level, record.text, used);
+        return;
+    }
+    if (xRingbufferSend(logRing, &record, sizeof(LogRecordHeader) + used, 0) != pdTRUE) {
+        droppedRecords.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    queuedRecords.fetch_add(1, std::memory_order_relaxed);
+}
+
+void logWriteV(uint8_t level, const char *format, va_list args)
+{
+    logRecordV(level, 0, format, args);
+}
+
+void logWrite(uint8_t level, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    logRecordV(level, 0, format, args);
+    va_end(args);
+}
+
+void logWriteSkipped(uint8_t level, uint32_t skipped, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    logRecordV(level, skipped, format, args);
+    va_end(args);
+}
+
+void logFlush(uint32_t timeoutMs)
+{
+    if (logRing == nullptr) {
+        Serial.flush();
+        return;
+    }
+    uint32_t target = queuedRecords.load(std::memory_order_relaxed);
+    uint32_t start = millis();
+    while ((int32_t)(printedRecords.load(std::memory_order_acquire) - target) < 0 && millis() - start < timeoutMs) {
+        delay(5);
+    }
+    Serial.flush();
+}
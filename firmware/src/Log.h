@@ -0,0 +1,67 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+// Deferred logging: the caller formats the line into a stack buffer and copies it
+// into a FreeRTOS ring buffer, a low priority task on the protocol core writes it to
+// Serial. A log call costs a vsnprintf and a memcpy instead of waiting for the UART at
+// 115200 baud, and when the ring is full the line is dropped (and counted), never waited on.
+//
+// Levels are filtered at compile time: anything above FW_LOG_LEVEL is a dead branch,
+// so the format string and the arguments are not even built. Not for use from ISRs.
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef FW_LOG_LEVEL
+#define FW_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_AT(level, ...) \
+    do { if ((level) <= FW_LOG_LEVEL) logWrite((level), __VA_ARGS__); } while (0)
+
+#define LOG_E(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_W(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_I(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_D(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+// At most one line per periodMs from this call site, the next line that gets through
+// reports how many were swallowed in between. For paths that run once per packet.
+#define LOG_EVERY_MS(periodMs, level, ...)                                          \
+    do {                                                                            \
+        if ((level) <= FW_LOG_LEVEL) {                                              \
+            static LogRateLimit _logLimit;                                          \
+            uint32_t _logSkipped;                                                   \
+            if (_logLimit.allow((periodMs), _logSkipped)) {                         \
+                logWriteSkipped((level), _logSkipped, __VA_ARGS__);                 \
+            }                                                                       \
+        }                                                                           \
+    } while (0)
+
+#define LOG_W_EVERY(periodMs, ...) LOG_EVERY_MS(periodMs, LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_I_EVERY(periodMs, ...) LOG_EVERY_MS(periodMs, LOG_LEVEL_INFO, __VA_ARGS__)
+
+struct LogRateLimit
+{
+    uint32_t lastMs = 0;
+    uint32_t suppressed = 0;
+    bool started = false;
+
+    // true when the call site may log now, skipped is the number of calls swallowed since the last one
+    bool allow(uint32_t periodMs, uint32_t &skipped);
+};
+
+static constexpr size_t LOG_LINE_MAX = 192;     // longer lines are cut
+static constexpr size_t LOG_RING_SIZE = 8192;
+
+// setup(): create the ring and the drain task, before that lines go straight to Serial
+void logBegin();
+// any task: queue one line, a trailing newline in format is optional
+void logWrite(uint8_t level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void logWriteV(uint8_t level, const char *format, va_list args);
+void logWriteSkipped(uint8_t level, uint32_t skipped, const char *format, ...) __attribute__((format(printf, 3, 4)));
+// any task: wait until everything queued so far is on the UART, e.g. before deep sleep
+void logFlush(uint32_t timeoutMs = 200);
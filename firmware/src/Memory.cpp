@@ -0,0 +1,112 @@
+#include "Memory.h"
+#include "Log.h"
+#include <esp_heap_caps.h>
+
+struct TaskRecord
+{
+    TaskHandle_t handle;
+    uint32_t stackBytes;
+};
+
+static constexpr size_t MAX_TASKS = 16;
+static TaskRecord tasks[MAX_TASKS];
+static size_t taskCount = 0;
+static portMUX_TYPE registryLock = portMUX_INITIALIZER_UNLOCKED;
+
+static size_t placedBytes[3] = {0, 0, 0};
+static const char *const REGION_NAMES[3] = {"internal", "dma", "psram"};
+
+// tasks the core or the libraries start themselves, looked up by name for the report
+static const char *const FOREIGN_TASKS[] = {"loopTask", "async_tcp"};
+
+static uint32_t regionCaps(MemoryRegion region)
+{
+    switch (region) {
+    case MEM_DMA:
+        return MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    case MEM_PSRAM:
+        return MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+    case MEM_INTERNAL:
+    default:
+        return MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    }
+}
+
+void *memAlloc(size_t bytes, MemoryRegion region, const char *tag)
+{
+    void *ptr = heap_caps_malloc(bytes, regionCaps(region));
+    if (ptr == nullptr && region == MEM_PSRAM) {
+        LOG_W("[MEM] %s: no PSRAM for %u bytes, using internal RAM", tag, (unsigned)bytes);
+        region = MEM_INTERNAL;
+        ptr = heap_caps_malloc(bytes, regionCaps(region));
+    }
+    if (ptr == nullptr) {
+        LOG_E("[MEM] %s: failed to allocate %u bytes (%s)", tag, (unsigned)bytes, REGION_NAMES[region]);
+        return nullptr;
+    }
+    placedBytes[region] += bytes;
+    LOG_D("[MEM] %s: %u bytes in %s", tag, (unsigned)bytes, REGION_NAMES[region]);
+    return ptr;
+}
+
+void memRegisterTask(TaskHandle_t handle, uint32_t stackBytes)
+{
+    portENTER_CRITICAL(&registryLock);
+    if (taskCount < MAX_TASKS) {
+        tasks[taskCount++] = {handle, stackBytes};
+    }
+    portEXIT_CRITICAL(&registryLock);
+}
+
+static void writeHeap(Print &out, const char *name, uint32_t caps)
+{
+    out.printf("\"%s\":{\"free\":%u,\"min_free\":%u,\"largest\":%u}", name,
+        (unsigned)heap_caps_get_free_size(caps), (unsigned)heap_caps_get_minimum_free_size(caps),
+        (unsigned)heap_caps_get_largest_free_block(caps));
+}
+
+// stack is 0 when the size is not known (tasks not started by us)
+static void writeTask(Print &out, TaskHandle_t handle, uint32_t stackBytes, bool first)
+{
+    out.printf("%s{\"name\":\"%s\",\"stack\":%u,\"min_free\":%u}", first ? "" : ",",
+        pcTaskGetName(handle), (unsigned)stackBytes, (unsigned)uxTaskGetStackHighWaterMark(handle));
+}
+
+void memoryReport(Print &out)
+{
+    out.print("{\"heap\":{");
+    writeHeap(out, "internal", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    out.print(",");
+    writeHeap(out, "psram", MALLOC_CAP_SPIRAM);
+    out.print("},\"placed\":{");
+    for (size_t i = 0; i < 3; i++) {
+        out.printf("%s\"%s\":%u", i ? "," : "", REGION_NAMES[i], (unsigned)placedBytes[i]);
+    }
+    out.print("},\"tasks\":[");
+
+    bool first = true;
+    for (size_t i = 0; i < taskCount; i++) {
+        writeTask(out, tasks[i].handle, tasks[i].stackBytes, first);
+        first = false;
+    }
+    for (const char *name : FOREIGN_TASKS) {
+        TaskHandle_t handle = xTaskGetHandle(name);
+        if (handle != nullptr) {
+            writeTask(out, handle, 0, first);
+            first = false;
+        }
+    }
+    out.print("]}");
+}
+
+void logMemoryReport()
+{
+    LOG_I("[MEM] internal free %u (min %u, largest %u), psram free %u (min %u)",
+        (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL), (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+        (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL),
+        (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM), (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
+    for (size_t i = 0; i < taskCount; i++) {
+        LOG_I("[MEM] %-16s stack %5u, %5u never used", pcTaskGetName(tasks[i].handle),
+            (unsigned)tasks[i].stackBytes, (unsigned)uxTaskGetStackHighWaterMark(tasks[i].handle));
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Arduino.h>
+#include <new>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// Memory placement: where a buffer lives is decided where it is created, not left to the
+// malloc threshold (CONFIG_SPIRAM_MALLOC_ALWAYSINTERNAL sends anything above 16 KB to PSRAM,
+// which is where the Opus states would otherwise end up).
+//   MEM_INTERNAL  codec state and buffers touched every frame
+//   MEM_DMA       buffers handed to a peripheral
+//   MEM_PSRAM     deep buffers that are touched once per packet, falls back to internal RAM
+//                 on boards without PSRAM
+// Task stacks are static and registered, so memoryReport() can show every high-water mark.
+enum MemoryRegion
+{
+    MEM_INTERNAL,
+    MEM_DMA,
+    MEM_PSRAM,
+};
+
+// setup() and task start only: long lived allocations, never freed
+void *memAlloc(size_t bytes, MemoryRegion region, const char *tag);
+
+template <typename T, typename... Args>
+T *memNew(MemoryRegion region, const char *tag, Args &&...args)
+{
+    void *ptr = memAlloc(sizeof(T), region, tag);
+    return ptr ? new (ptr) T(static_cast<Args &&>(args)...) : nullptr;
+}
+
+// keep track of a task that was not started through StaticTask, for the report
+void memRegisterTask(TaskHandle_t handle, uint32_t stackBytes);
+
+// any task: heap per region and stack high-water marks, as JSON
+void memoryReport(Print &out);
+// any task: the same as a few log lines
+void logMemoryReport();
+
+// A task whose stack and TCB are static (internal RAM, known at link time) instead of
+// coming out of the heap at boot.
+template <size_t STACK_BYTES>
+class StaticTask {
+public:
+    TaskHandle_t start(TaskFunction_t function, const char *name, void *parameter, UBaseType_t priority, BaseType_t core)
+    {
+        // ESP-IDF counts stack depth in bytes
+        handle = xTaskCreateStaticPinnedToCore(function, name, STACK_BYTES, parameter, priority, stack, &tcb, core);
+        if (handle != nullptr) {
+            memRegisterTask(handle, STACK_BYTES);
+        }
+        return handle;
+    }
+
+    TaskHandle_t taskHandle() const { return handle; }
+
+private:
+    StackType_t stack[STACK_BYTES / sizeof(StackType_t)];
+    StaticTask_t tcb;
+    TaskHandle_t handle = nullptr;
+};
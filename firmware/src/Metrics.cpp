@@ -0,0 +1,169 @@
+#include "Metrics.h"
+
+Metrics metrics;
+
+static const char *const TURN_EVENT_NAMES[TURN_EVENT_COUNT] = {
+    "committed", "created", "first_bin", "first_decode", "first_i2s", "complete", "listening"
+};
+
+static const char *const COUNTER_NAMES[sizeof(TurnCounters) / sizeof(uint32_t)] = {
+    "underruns", "overruns", "concealed", "recovered", "decode_errors", "uplink_drops"
+};
+
+static const char *const I2S_DIRECTION_NAMES[I2S_DIRECTION_COUNT] = {"playback", "mic"};
+
+static void countersToArray(const TurnCounters &counters, uint32_t *values)
+{
+    memcpy(values, &counters, sizeof(TurnCounters));
+}
+
+void Metrics::beginTurn(const TurnCounters &now)
+{
+    if (turnOpen()) {
+        endTurn(now);
+    }
+
+    uint32_t id = lastId.load(std::memory_order_relaxed) + 1;
+    Record &record = records[id % TURN_HISTORY];
+
+    // readers skip the slot while its id is 0
+    record.id.store(0, std::memory_order_release);
+    for (auto &stamp : record.stampUs) {
+        stamp.store(0, std::memory_order_relaxed);
+    }
+    for (auto &counter : record.counters) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    startCounters = now;
+    record.id.store(id, std::memory_order_release);
+
+    lastId.store(id, std::memory_order_release);
+    open.store(true, std::memory_order_release);
+}
+
+void Metrics::mark(TurnEvent event)
+{
+    if (!turnOpen()) {
+        return;
+    }
+    uint32_t id = lastId.load(std::memory_order_acquire);
+    Record &record = records[id % TURN_HISTORY];
+    if (record.id.load(std::memory_order_acquire) != id) {
+        return;
+    }
+
+    // 0 means "not reached", so a stamp that happens to be 0 is nudged to 1
+    uint32_t now = micros();
+    uint32_t expected = 0;
+    record.stampUs[event].compare_exchange_strong(expected, now ? now : 1, std::memory_order_acq_rel);
+}
+
+void Metrics::endTurn(const TurnCounters &now)
+{
+    if (!open.exchange(false, std::memory_order_acq_rel)) {
+        return;
+    }
+    uint32_t id = lastId.load(std::memory_order_relaxed);
+    Record &record = records[id % TURN_HISTORY];
+
+    uint32_t start[sizeof(TurnCounters) / sizeof(uint32_t)];
+    uint32_t end[sizeof(TurnCounters) / sizeof(uint32_t)];
+    countersToArray(startCounters, start);
+    countersToArray(now, end);
+    for (size_t i = 0; i < sizeof(TurnCounters) / sizeof(uint32_t); i++) {
+        record.counters[i].store(end[i] - start[i], std::memory_order_relaxed);
+    }
+}
+
+void Metrics::writeJson(Print &out, const TurnCounters &totals, size_t maxTurns) const
+{
+    uint32_t values[sizeof(TurnCounters) / sizeof(uint32_t)];
+    countersToArray(totals, values);
+
+    out.printf("{\"uptime_ms\":%lu,\"totals\":{", (unsigned long)millis());
+    for (size_t i = 0; i < sizeof(TurnCounters) / sizeof(uint32_t); i++) {
+        out.printf("%s\"%s\":%u", i ? "," : "", COUNTER_NAMES[i], values[i]);
+    }
+    out.print("},\"i2s\":{");
+    for (size_t i = 0; i < I2S_DIRECTION_COUNT; i++) {
+        out.printf("%s\"%s\":{\"rate\":%u,\"dma_count\":%u,\"dma_size\":%u,\"dma_ms\":%u}", i ? "," : "",
+            I2S_DIRECTION_NAMES[i], i2sFormats[i][0].load(std::memory_order_relaxed), i2sFormats[i][1].load(std::memory_order_relaxed),
+            i2sFormats[i][2].load(std::memory_order_relaxed), i2sFormats[i][3].load(std::memory_order_relaxed));
+    }
+    out.print("},\"turns\":[");
+
+    uint32_t newest = lastId.load(std::memory_order_acquire);
+    size_t turns = maxTurns < TURN_HISTORY ? maxTurns : TURN_HISTORY;
+    uint32_t first = newest >= turns ? newest - turns + 1 : 1;
+    bool any = false;
+    for (uint32_t id = first; id <= newest && id != 0; id++) {
+        if (any) {
+            out.print(",");
+        }
+        writeRecord(out, records[id % TURN_HISTORY], id);
+        any = true;
+    }
+    out.print("]}");
+}
+
+void Metrics::setI2sFormat(I2sDirection direction, const I2sFormat &format)
+{
+    uint32_t values[sizeof(I2sFormat) / sizeof(uint32_t)];
+    memcpy(values, &format, sizeof(format));
+    for (size_t i = 0; i < sizeof(I2sFormat) / sizeof(uint32_t); i++) {
+        i2sFormats[direction][i].store(values[i], std::memory_order_relaxed);
+    }
+}
+
+// times are in ms relative to the first stamp of the turn, events not reached are left out
+void Metrics::writeRecord(Print &out, const Record &record, uint32_t id) const
+{
+    uint32_t stamps[TURN_EVENT_COUNT];
+    uint32_t counters[sizeof(TurnCounters) / sizeof(uint32_t)];
+    for (size_t i = 0; i < TURN_EVENT_COUNT; i++) {
+        stamps[i] = record.stampUs[i].load(std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < sizeof(TurnCounters) / sizeof(uint32_t); i++) {
+        counters[i] = record.counters[i].load(std::memory_order_relaxed);
+    }
+    if (record.id.load(std::memory_order_acquire) != id) {
+        out.printf("{\"id\":%u,\"overwritten\":true}", id);
+        return;
+    }
+
+    uint32_t origin = 0;
+    for (size_t i = 0; i < TURN_EVENT_COUNT; i++) {
+        if (stamps[i] != 0) {
+            origin = stamps[i];
+            break;
+        }
+    }
+
+    out.printf("{\"id\":%u", id);
+    for (size_t i = 0; i < TURN_EVENT_COUNT; i++) {
+        if (stamps[i] != 0) {
+            int32_t relUs = (int32_t)(stamps[i] - origin);
+            relUs = relUs < 0 ? 0 : relUs;
+            out.printf(",\"%s\":%ld.%ld", TURN_EVENT_NAMES[i], (long)(relUs / 1000), (long)(relUs % 1000 / 100));
+        }
+    }
+    for (size_t i = 0; i < sizeof(TurnCounters) / sizeof(uint32_t); i++) {
+        if (counters[i] != 0) {
+            out.printf(",\"%s\":%u", COUNTER_NAMES[i], counters[i]);
+        }
+    }
+    out.print("}");
+}
+
+size_t FixedBufferPrint::write(const uint8_t *data, size_t len)
+{
+    size_t room = size - 1 - length;
+    if (len > room) {
+        overflow = true;
+        len = room;
+    }
+    memcpy(buffer + length, data, len);
+    length += len;
+    buffer[length] = '\0';
+    return len;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+// Per turn latency records: one fixed size record per turn in a small ring, every state
+// machine step stamps its time once (the first call wins). Marks come from networkTask and
+// audioStreamTask, readers (the WS push and the /api/metrics handler) run on other tasks, so
+// everything in a record is atomic and a slot carries its turn id to detect reuse mid read.
+enum TurnEvent
+{
+    TURN_COMMITTED,     // AUDIO.COMMITTED, the server has the user's speech
+    TURN_CREATED,       // RESPONSE.CREATED
+    TURN_FIRST_BIN,     // first downlink audio packet
+    TURN_FIRST_DECODE,  // first frame out of the Opus decoder
+    TURN_FIRST_I2S,     // first frame queued to the I2S DMA
+    TURN_COMPLETE,      // RESPONSE.COMPLETE / RESPONSE.ERROR
+    TURN_LISTENING,     // mic open again
+    TURN_EVENT_COUNT
+};
+
+// cumulative counters, a turn record stores how much they grew during the turn
+struct TurnCounters
+{
+    uint32_t underruns;
+    uint32_t overruns;
+    uint32_t concealed;
+    uint32_t recovered;
+    uint32_t decodeErrors;
+    uint32_t uplinkDrops;
+};
+
+// an I2S port as it runs, after the auth message negotiated it
+struct I2sFormat
+{
+    uint32_t sampleRate;
+    uint32_t dmaCount;
+    uint32_t dmaSize;
+    uint32_t dmaMs;
+};
+
+enum I2sDirection
+{
+    I2S_PLAYBACK,
+    I2S_MIC,
+    I2S_DIRECTION_COUNT
+};
+
+class Metrics {
+public:
+    static constexpr size_t TURN_HISTORY = 8;
+
+    // networkTask: a new turn starts, closes the previous one if it was still open
+    void beginTurn(const TurnCounters &now);
+    // any task: first time this turn reached event
+    void mark(TurnEvent event);
+    // networkTask: the turn is over, its counters are taken relative to beginTurn()
+    void endTurn(const TurnCounters &now);
+    bool turnOpen() const { return open.load(std::memory_order_acquire); }
+
+    // audioStreamTask / micTask: the format their port runs with now
+    void setI2sFormat(I2sDirection direction, const I2sFormat &format);
+
+    // any task: {"uptime_ms":..,"totals":{..},"i2s":{..},"turns":[..]}, newest turn last
+    void writeJson(Print &out, const TurnCounters &totals, size_t maxTurns = TURN_HISTORY) const;
+
+protected:
+    struct Record {
+        std::atomic<uint32_t> id{0};  // 0 while the slot is being reset
+        std::atomic<uint32_t> stampUs[TURN_EVENT_COUNT];
+        std::atomic<uint32_t> counters[sizeof(TurnCounters) / sizeof(uint32_t)];
+    };
+
+    Record records[TURN_HISTORY];
+    std::atomic<uint32_t> lastId{0};
+    std::atomic<bool> open{false};
+    TurnCounters startCounters = {};  // networkTask only
+    std::atomic<uint32_t> i2sFormats[I2S_DIRECTION_COUNT][sizeof(I2sFormat) / sizeof(uint32_t)] = {};
+
+    void writeRecord(Print &out, const Record &record, uint32_t id) const;
+};
+
+// Print into a fixed buffer, for handing the JSON to sendTXT without a String
+class FixedBufferPrint : public Print {
+public:
+    FixedBufferPrint(char *buffer, size_t size) : buffer(buffer), size(size) { clear(); }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *data, size_t len) override;
+
+    void clear() { length = 0; buffer[0] = '\0'; overflow = false; }
+    const char *c_str() const { return buffer; }
+    size_t len() const { return length; }
+    bool overflowed() const { return overflow; }
+
+private:
+    char *buffer;
+    size_t size;
+    size_t length = 0;
+    bool overflow = false;
+};
+
+extern Metrics metrics;
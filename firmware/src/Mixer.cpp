@@ -0,0 +1,164 @@
+#include "Mixer.h"
+#include "DspKernels.h"
+
+bool AudioMixer::begin(void *storage) {
+  if (storage == nullptr) {
+    return false;
+  }
+  int16_t *rings = static_cast<int16_t *>(storage);
+  for (size_t i = 0; i < INPUT_COUNT; i++) {
+    inputs[i].ring = rings + i * RING_SAMPLES;
+  }
+  return true;
+}
+
+int32_t AudioMixer::toQ15(float value) {
+  value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+  return (int32_t)(value * UNITY_Q15 + 0.5f);
+}
+
+int AudioMixer::open(float gain, float duck, RefillHook refill) {
+  for (size_t i = 0; i < INPUT_COUNT; i++) {
+    Input &in = inputs[i];
+    uint8_t expected = FREE;
+    if (in.ring == nullptr || !in.state.compare_exchange_strong(expected, OPENING, std::memory_order_acquire)) {
+      continue;
+    }
+    in.gainQ15 = toQ15(gain);
+    in.duckQ15 = toQ15(duck);
+    in.currentQ15 = 0;  // ramps in, so a clip that starts loud does not click
+    in.refill = refill;
+    in.openedAt = in.head.load(std::memory_order_relaxed);
+    in.started = false;
+    in.refillAsked = false;
+    in.state.store(PLAYING, std::memory_order_release);
+    return (int)i;
+  }
+  return -1;
+}
+
+size_t AudioMixer::room(int input) const {
+  if (input < 0 || input >= (int)INPUT_COUNT) {
+    return 0;
+  }
+  const Input &in = inputs[input];
+  return RING_SAMPLES - (in.head.load(std::memory_order_relaxed) - in.tail.load(std::memory_order_acquire));
+}
+
+size_t AudioMixer::write(int input, const int16_t *samples, size_t sampleCount) {
+  if (input < 0 || input >= (int)INPUT_COUNT || inputs[input].state.load(std::memory_order_acquire) != PLAYING) {
+    return 0;
+  }
+  Input &in = inputs[input];
+  size_t count = min(sampleCount, room(input));
+  uint32_t head = in.head.load(std::memory_order_relaxed);
+  size_t start = head & (RING_SAMPLES - 1);
+  size_t first = min(count, RING_SAMPLES - start);
+  memcpy(in.ring + start, samples, first * sizeof(int16_t));
+  memcpy(in.ring, samples + first, (count - first) * sizeof(int16_t));
+  in.head.store(head + count, std::memory_order_release);
+  return count;
+}
+
+void AudioMixer::close(int input) {
+  if (input >= 0 && input < (int)INPUT_COUNT) {
+    uint8_t expected = PLAYING;
+    inputs[input].state.compare_exchange_strong(expected, DRAINING, std::memory_order_release);
+  }
+}
+
+void AudioMixer::stop(int input) {
+  if (input < 0 || input >= (int)INPUT_COUNT) {
+    return;
+  }
+  uint8_t expected = PLAYING;
+  if (!inputs[input].state.compare_exchange_strong(expected, STOPPING, std::memory_order_release)) {
+    expected = DRAINING;
+    inputs[input].state.compare_exchange_strong(expected, STOPPING, std::memory_order_release);
+  }
+}
+
+bool AudioMixer::active() const {
+  for (size_t i = 0; i < INPUT_COUNT; i++) {
+    if (inputs[i].state.load(std::memory_order_acquire) != FREE) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void AudioMixer::ramp(int16_t *samples, size_t sampleCount, int32_t &currentQ15, int32_t targetQ15) {
+  for (size_t i = 0; i < sampleCount; i++) {
+    if (currentQ15 < targetQ15) {
+      currentQ15 = min(currentQ15 + RAMP_STEP_Q15, targetQ15);
+    } else if (currentQ15 > targetQ15) {
+      currentQ15 = max(currentQ15 - RAMP_STEP_Q15, targetQ15);
+    }
+    samples[i] = (int16_t)((samples[i] * currentQ15) >> 15);
+  }
+}
+
+void AudioMixer::release(Input &in) {
+  in.tail.store(in.head.load(std::memory_order_acquire), std::memory_order_release);
+  in.state.store(FREE, std::memory_order_release);
+}
+
+void AudioMixer::mixInto(int16_t *main, size_t sampleCount) {
+  if (sampleCount > MAX_BLOCK) {
+    sampleCount = MAX_BLOCK;
+  }
+
+  // the main bus goes down to the lowest duck of the inputs that still play
+  int32_t duckTarget = UNITY_Q15;
+  for (size_t i = 0; i < INPUT_COUNT; i++) {
+    uint8_t state = inputs[i].state.load(std::memory_order_acquire);
+    if (state == PLAYING || state == DRAINING) {
+      duckTarget = min(duckTarget, inputs[i].duckQ15);
+    }
+  }
+  if (duckQ15 != duckTarget) {
+    ramp(main, sampleCount, duckQ15, duckTarget);
+  } else if (duckQ15 != UNITY_Q15) {
+    dspScaleS16(main, sampleCount, duckQ15 >> 3);
+  }
+
+  for (size_t i = 0; i < INPUT_COUNT; i++) {
+    Input &in = inputs[i];
+    uint8_t state = in.state.load(std::memory_order_acquire);
+    if (state == FREE || state == OPENING) {
+      continue;
+    }
+    if (!in.started) {
+      in.tail.store(in.openedAt, std::memory_order_release);
+      in.started = true;
+    }
+
+    uint32_t tail = in.tail.load(std::memory_order_relaxed);
+    size_t available = in.head.load(std::memory_order_acquire) - tail;
+    size_t count = min(available, sampleCount);
+    size_t start = tail & (RING_SAMPLES - 1);
+    size_t first = min(count, RING_SAMPLES - start);
+    memcpy(scratch, in.ring + start, first * sizeof(int16_t));
+    memcpy(scratch + first, in.ring, (count - first) * sizeof(int16_t));
+    in.tail.store(tail + count, std::memory_order_release);
+
+    int32_t target = state == STOPPING ? 0 : in.gainQ15;
+    if (in.currentQ15 != target) {
+      ramp(scratch, count, in.currentQ15, target);
+      dspMixS16(main, scratch, count, UNITY_Q15);
+    } else if (target != 0) {
+      dspMixS16(main, scratch, count, target);
+    }
+
+    if ((state == DRAINING && count == available) || (state == STOPPING && (count == 0 || in.currentQ15 == 0))) {
+      release(in);
+      continue;
+    }
+    // an underrun is played as silence, the hook gets the producer going before that
+    bool low = available - count < RING_SAMPLES / 2;
+    if (state == PLAYING && low && !in.refillAsked && in.refill != nullptr) {
+      in.refill();
+    }
+    in.refillAsked = low;
+  }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+// Fixed point N-input mixer in front of the playback DSP (after pitch shift, before
+// resampling and the volume/limiter pass). The decoded response is the main bus and is
+// mixed in place; up to INPUT_COUNT other sources (cached prompts, chimes) are added on top,
+// each from its own lock-free single producer -> single consumer PCM ring at the decoder
+// (downlink) rate.
+// Every input has its own gain and may duck the main bus while it plays. Inputs are opened
+// and closed between blocks with short gain ramps, so nothing has to be flushed and a source
+// can start while a response is still buffering.
+class AudioMixer {
+public:
+  static constexpr size_t INPUT_COUNT = 2;
+  static constexpr size_t RING_SAMPLES = 4096;   // per input, ~170 ms at 24 kHz
+  static constexpr int32_t RAMP_SAMPLES = 256;   // unity gain to silence, ~10 ms at 24 kHz
+  static constexpr size_t MAX_BLOCK = 256;       // DspPipeline::BLOCK_SIZE
+  static_assert((RING_SAMPLES & (RING_SAMPLES - 1)) == 0, "RING_SAMPLES must be a power of two");
+
+  // called by the consumer once per input when less than half of its ring is left
+  typedef void (*RefillHook)();
+
+  static constexpr size_t storageBytes() { return INPUT_COUNT * RING_SAMPLES * sizeof(int16_t); }
+
+  // before either side runs: storageBytes() of internal memory (read every block), kept for good
+  bool begin(void *storage);
+
+  // producer: claim a free input, -1 if all are taken. gain applies to the input, duck to the
+  // main bus while the input plays (1.0 leaves it alone); both 0.0..1.0
+  int open(float gain, float duck, RefillHook refill = nullptr);
+  // producer: queue up to sampleCount samples, returns how many fit
+  size_t write(int input, const int16_t *samples, size_t sampleCount);
+  // producer: free space of the ring in samples
+  size_t room(int input) const;
+  // producer: nothing more to come, the input plays out what it has and frees itself
+  void close(int input);
+  // any task: fade the input out and drop what it still has queued
+  void stop(int input);
+
+  // any task: some input is still playing
+  bool active() const;
+
+  // consumer: duck main and add every open input to it, sampleCount <= MAX_BLOCK
+  void mixInto(int16_t *main, size_t sampleCount);
+  // consumer: back to unity on the main bus, the inputs keep playing
+  void reset() { duckQ15 = UNITY_Q15; }
+
+protected:
+  static constexpr int32_t UNITY_Q15 = 32768;
+  static constexpr int32_t RAMP_STEP_Q15 = UNITY_Q15 / RAMP_SAMPLES;
+
+  enum State : uint8_t {
+    FREE,
+    OPENING,    // claimed by open(), the consumer leaves it alone until it is set up
+    PLAYING,
+    DRAINING,   // closed by the producer, frees itself once the ring is empty
+    STOPPING,   // fades out, then drops the ring
+  };
+
+  struct Input {
+    std::atomic<uint8_t> state{FREE};
+    std::atomic<uint32_t> head{0};   // written by the producer
+    std::atomic<uint32_t> tail{0};   // written by the consumer
+    int16_t *ring = nullptr;
+    int32_t gainQ15 = UNITY_Q15;     // target, set on open()
+    int32_t duckQ15 = UNITY_Q15;
+    int32_t currentQ15 = 0;          // ramped towards gainQ15 by the consumer
+    RefillHook refill = nullptr;
+    uint32_t openedAt = 0;           // head at open(), older samples are left overs
+    bool started = false;            // consumer only, reset by open()
+    bool refillAsked = false;        // consumer only
+  };
+
+  Input inputs[INPUT_COUNT];
+  int32_t duckQ15 = UNITY_Q15;       // consumer only, ramped towards the lowest open duck
+  alignas(16) int16_t scratch[MAX_BLOCK];
+
+  static int32_t toQ15(float value);
+  // in place, moves currentQ15 towards targetQ15 by RAMP_STEP_Q15 per sample
+  static void ramp(int16_t *samples, size_t sampleCount, int32_t &currentQ15, int32_t targetQ15);
+  void release(Input &in);
+};
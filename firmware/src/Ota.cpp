@@ -0,0 +1,283 @@
+#include "Ota.h"
+#include "Log.h"
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+#include <mbedtls/sha256.h>
+#include <freertos/semphr.h>
+
+volatile bool otaRestartScheduled = false;
+
+// one transfer at a time, from whichever transport started it
+struct OtaTransfer
+{
+    bool active;
+    OtaSource source;
+    const esp_partition_t *partition;
+    esp_ota_handle_t handle;
+    mbedtls_sha256_context sha;
+    size_t imageSize;
+    size_t received;
+    char expectedSha[65];
+};
+
+static OtaTransfer transfer = {};
+static char lastError[64] = "";
+
+static SemaphoreHandle_t otaLock()
+{
+    static SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+    return lock;
+}
+
+struct OtaLockGuard
+{
+    OtaLockGuard() { xSemaphoreTake(otaLock(), portMAX_DELAY); }
+    ~OtaLockGuard() { xSemaphoreGive(otaLock()); }
+};
+
+static bool fail(const char *reason)
+{
+    strlcpy(lastError, reason, sizeof(lastError));
+    LOG_E("[OTA] %s", reason);
+    return false;
+}
+
+// with the lock held
+static void release()
+{
+    if (transfer.active) {
+        esp_ota_abort(transfer.handle);
+        mbedtls_sha256_free(&transfer.sha);
+    }
+    transfer.active = false;
+}
+
+// BOOT
+// NVS "ota": pending (new image not confirmed yet), boots (since it was flashed), previous
+// (label of the slot to go back to)
+void otaBootCheck()
+{
+    Preferences prefs;
+    prefs.begin("ota", false);
+    if (!prefs.getBool("pending", false)) {
+        prefs.end();
+        return;
+    }
+
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    String previous = prefs.getString("previous", "");
+    if (previous == running->label) {
+        // the bootloader already went back (or the new image never booted)
+        LOG_W("[OTA] Running the previous image %s again, update dropped", running->label);
+        prefs.putBool("pending", false);
+        prefs.end();
+        return;
+    }
+
+    uint8_t boots = prefs.getUChar("boots", 0) + 1;
+    prefs.putUChar("boots", boots);
+    if (boots <= OTA_MAX_UNVERIFIED_BOOTS) {
+        LOG_I("[OTA] Unconfirmed image in %s, boot %u of %u", running->label, boots, OTA_MAX_UNVERIFIED_BOOTS);
+        prefs.end();
+        return;
+    }
+
+    const esp_partition_t *fallback = esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, previous.c_str());
+    prefs.putBool("pending", false);
+    prefs.end();
+    if (fallback == nullptr || esp_ota_set_boot_partition(fallback) != ESP_OK) {
+        LOG_E("[OTA] Image in %s never reached the server and %s is not bootable, keeping it", running->label, previous.c_str());
+        return;
+    }
+    LOG_E("[OTA] Image in %s never reached the server, rolling back to %s", running->label, previous.c_str());
+    logFlush();
+    esp_restart();
+}
+
+void otaMarkValid()
+{
+    static bool checked = false;
+    if (checked) {
+        return;
+    }
+    checked = true;
+
+    esp_ota_mark_app_valid_cancel_rollback();  // no-op unless the bootloader does rollback
+    Preferences prefs;
+    prefs.begin("ota", false);
+    if (prefs.getBool("pending", false)) {
+        prefs.putBool("pending", false);
+        LOG_I("[OTA] Image in %s confirmed", esp_ota_get_running_partition()->label);
+    }
+    prefs.end();
+}
+
+// the Arduino core would confirm the image right at boot, we wait for the server
+extern "C" bool verifyRollbackLater()
+{
+    return true;
+}
+
+// TRANSFER
+/**
+ * @brief Start (or resume) writing an image into the inactive slot
+ * @param source Transport the chunks will come from
+ * @param imageSize Size of the whole image in bytes
+ * @param sha256Hex Expected SHA-256 of the whole image, 64 hex digits
+ * @param offset Where the sender starts, 0 or the offset the device reported
+ * @return true if the chunks from offset on can be written
+ */
+bool otaBegin(OtaSource source, size_t imageSize, const char *sha256Hex, size_t offset)
+{
+    OtaLockGuard lock;
+    if (sha256Hex == nullptr || strlen(sha256Hex) != 64) {
+        return fail("sha256 missing or malformed");
+    }
+
+    if (transfer.active && transfer.imageSize == imageSize && strcasecmp(transfer.expectedSha, sha256Hex) == 0) {
+        if (offset > transfer.received) {
+            return fail("resume offset past the received bytes");
+        }
+        transfer.source = source;
+        LOG_I("[OTA] Resuming at %u of %u bytes", (unsigned)transfer.received, (unsigned)imageSize);
+        return true;
+    }
+    if (offset != 0) {
+        return fail("nothing to resume, start at offset 0");
+    }
+    release();
+
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == nullptr) {
+        return fail("no OTA slot");
+    }
+    if (imageSize == 0 || imageSize > partition->size) {
+        return fail("image does not fit the OTA slot");
+    }
+    // sequential writes erase sector by sector instead of the whole slot up front
+    esp_err_t err = esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &transfer.handle);
+    if (err != ESP_OK) {
+        return fail(esp_err_to_name(err));
+    }
+
+    transfer.active = true;
+    transfer.source = source;
+    transfer.partition = partition;
+    transfer.imageSize = imageSize;
+    transfer.received = 0;
+    strlcpy(transfer.expectedSha, sha256Hex, sizeof(transfer.expectedSha));
+    mbedtls_sha256_init(&transfer.sha);
+    mbedtls_sha256_starts(&transfer.sha, 0);
+    lastError[0] = '\0';
+    LOG_I("[OTA] Receiving %u bytes into %s", (unsigned)imageSize, partition->label);
+    return true;
+}
+
+bool otaWrite(OtaSource source, size_t offset, const uint8_t *data, size_t length)
+{
+    OtaLockGuard lock;
+    if (!transfer.active || transfer.source != source) {
+        return fail("no transfer from this source");
+    }
+    if (offset > transfer.received) {
+        return fail("chunk out of order");
+    }
+    // a chunk sent again after a resume: only the part we do not have yet
+    size_t skip = transfer.received - offset;
+    if (skip >= length) {
+        return true;
+    }
+    data += skip;
+    length -= skip;
+    if (transfer.received + length > transfer.imageSize) {
+        release();
+        return fail("more data than the announced size");
+    }
+
+    esp_err_t err = esp_ota_write(transfer.handle, data, length);
+    if (err != ESP_OK) {
+        release();
+        return fail(esp_err_to_name(err));
+    }
+    mbedtls_sha256_update(&transfer.sha, data, length);
+    transfer.received += length;
+    return true;
+}
+
+bool otaFinish(OtaSource source)
+{
+    OtaLockGuard lock;
+    if (!transfer.active || transfer.source != source) {
+        return fail("no transfer from this source");
+    }
+    if (transfer.received != transfer.imageSize) {
+        return fail("image incomplete");  // still active, the sender can resume
+    }
+
+    uint8_t digest[32];
+    char digestHex[65];
+    mbedtls_sha256_finish(&transfer.sha, digest);
+    for (size_t i = 0; i < sizeof(digest); i++) {
+        snprintf(digestHex + i * 2, 3, "%02x", digest[i]);
+    }
+    if (strcasecmp(digestHex, transfer.expectedSha) != 0) {
+        release();
+        return fail("sha256 mismatch");
+    }
+
+    // esp_ota_end() also checks the image itself (header, segments, its appended hash)
+    mbedtls_sha256_free(&transfer.sha);
+    transfer.active = false;
+    esp_err_t err = esp_ota_end(transfer.handle);
+    if (err == ESP_OK) {
+        err = esp_ota_set_boot_partition(transfer.partition);
+    }
+    if (err != ESP_OK) {
+        return fail(esp_err_to_name(err));
+    }
+
+    Preferences prefs;
+    prefs.begin("ota", false);
+    prefs.putBool("pending", true);
+    prefs.putUChar("boots", 0);
+    prefs.putString("previous", esp_ota_get_running_partition()->label);
+    prefs.end();
+
+    LOG_I("[OTA] Image of %u bytes verified, booting %s next", (unsigned)transfer.imageSize, transfer.partition->label);
+    otaRestartScheduled = true;
+    return true;
+}
+
+void otaAbort(const char *reason)
+{
+    OtaLockGuard lock;
+    if (transfer.active) {
+        LOG_W("[OTA] Aborted at %u of %u bytes: %s", (unsigned)transfer.received, (unsigned)transfer.imageSize, reason);
+        strlcpy(lastError, reason, sizeof(lastError));
+        release();
+    }
+}
+
+bool otaActive()
+{
+    return transfer.active;
+}
+
+size_t otaReceived()
+{
+    OtaLockGuard lock;
+    return transfer.active ? transfer.received : 0;
+}
+
+const char *otaError()
+{
+    return lastError;
+}
+
+void otaReport(Print &out)
+{
+    OtaLockGuard lock;
+    out.printf("{\"active\":%s,\"received\":%u,\"size\":%u,\"running\":\"%s\",\"error\":\"%s\"}",
+        transfer.active ? "true" : "false", (unsigned)(transfer.active ? transfer.received : 0),
+        (unsigned)(transfer.active ? transfer.imageSize : 0), esp_ota_get_running_partition()->label, lastError);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <Arduino.h>
+
+// OTA: firmware updates streamed straight into the inactive app slot (app0/app1 in
+// partition.csv), one chunk at a time as it arrives, never buffered as a whole image.
+// Two transports feed the same writer:
+//   websocket  {"type":"ota","msg":"begin","size":N,"sha256":"<hex>","offset":K}, then BIN
+//              frames starting with an OtaChunkHeader, then {"type":"ota","msg":"end"}
+//   HTTP       POST /api/ota with "Authorization: Bearer <device token>", X-OTA-Size,
+//              X-OTA-SHA256 and X-OTA-Offset headers and the image (from the offset) as body
+// A transfer that breaks off is resumed by starting again with the same sha256 and the
+// offset the device reported; the image is checked against the SHA-256 before it is
+// made bootable.
+//
+// A new image boots as pending: it counts its own boots and goes back to the previous slot
+// if it has not reached the server after OTA_MAX_UNVERIFIED_BOOTS of them. otaMarkValid()
+// (after the first auth message) accepts it, and also confirms it to the bootloader when
+// that is built with rollback support.
+struct __attribute__((packed)) OtaChunkHeader {
+    uint32_t magic;             // OTA_CHUNK_MAGIC, tells OTA chunks apart from audio
+    uint32_t offset;            // position of the chunk in the image
+};
+
+constexpr uint32_t OTA_CHUNK_MAGIC = 0x3141544f;  // "OTA1"
+constexpr uint8_t OTA_MAX_UNVERIFIED_BOOTS = 3;
+constexpr size_t OTA_PROGRESS_BYTES = 32 * 1024;  // websocket: report progress this often
+
+enum OtaSource
+{
+    OTA_SOURCE_WEBSOCKET,
+    OTA_SOURCE_HTTP,
+};
+
+// setup(), before anything else: roll back an image that keeps failing to come up
+void otaBootCheck();
+// networkTask -> onAuth(): the running image reached the server
+void otaMarkValid();
+
+// networkTask or async_tcp. Resumes when the same image is already being received,
+// otherwise starts over at offset 0 (a different offset is refused). false with otaError().
+bool otaBegin(OtaSource source, size_t imageSize, const char *sha256Hex, size_t offset);
+// chunks have to come in order; a repeated chunk is skipped
+bool otaWrite(OtaSource source, size_t offset, const uint8_t *data, size_t length);
+// checks size and SHA-256, makes the new slot bootable; the caller restarts
+bool otaFinish(OtaSource source);
+void otaAbort(const char *reason);
+
+bool otaActive();
+size_t otaReceived();
+const char *otaError();
+// any task: progress as JSON
+void otaReport(Print &out);
+
+// set by otaFinish(), loopTask restarts once the answer is out
+extern volatile bool otaRestartScheduled;
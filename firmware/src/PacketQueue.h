@@ -0,0 +1,100 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <string.h>
+
+// Lock-free single producer -> single consumer queue of variable length packets.
+// Every packet lives in its own fixed size slot, so the producer can fill a slot in place
+// (reserve/commit) and the consumer can read it in place (peek/pop) without extra copies.
+// The producer never blocks: push()/reserve() fail when the queue is full and the caller
+// decides what to drop. The slots are external (see Memory.h for where they go): until
+// begin() hands the queue its storage it behaves as a queue that is always full.
+template <size_t SLOT_SIZE, size_t SLOT_COUNT>
+class PacketQueue {
+  static_assert((SLOT_COUNT & (SLOT_COUNT - 1)) == 0, "SLOT_COUNT must be a power of two");
+
+public:
+  static constexpr size_t slotSize() { return SLOT_SIZE; }
+  static constexpr size_t slotCount() { return SLOT_COUNT; }
+  static constexpr size_t storageBytes() { return sizeof(Slot) * SLOT_COUNT; }
+
+  // before either side runs: storageBytes() of 4 byte aligned memory, kept for good
+  bool begin(void *storage) {
+    if (storage == nullptr) {
+      return false;
+    }
+    _slots = static_cast<Slot *>(storage);
+    return true;
+  }
+  bool ready() const { return _slots != nullptr; }
+
+  // producer: copy a packet into the next free slot
+  bool push(const uint8_t *data, size_t len) {
+    if (len > SLOT_SIZE) {
+      return false;
+    }
+    uint8_t *slot = reserve();
+    if (slot == nullptr) {
+      return false;
+    }
+    memcpy(slot, data, len);
+    commit(len);
+    return true;
+  }
+
+  // producer: next free slot to be filled in place, nullptr if the queue is full
+  uint8_t *reserve() {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    if (_slots == nullptr || head - _tail.load(std::memory_order_acquire) >= SLOT_COUNT) {
+      return nullptr;
+    }
+    return _slots[head & (SLOT_COUNT - 1)].data;
+  }
+
+  // producer: publish the slot returned by reserve()
+  void commit(size_t len) {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    _slots[head & (SLOT_COUNT - 1)].len = len;
+    _head.store(head + 1, std::memory_order_release);
+  }
+
+  // consumer: oldest packet or nullptr if the queue is empty, valid until pop()
+  const uint8_t *peek(size_t &len) {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    Slot &slot = _slots[tail & (SLOT_COUNT - 1)];
+    len = slot.len;
+    return slot.data;
+  }
+
+  // consumer: release the packet returned by peek()
+  void pop() {
+    _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // consumer: drop everything queued so far
+  void clear() {
+    _tail.store(_head.load(std::memory_order_acquire), std::memory_order_release);
+  }
+
+  size_t size() const {
+    return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+private:
+  struct Slot {
+    size_t len;
+    alignas(4) uint8_t data[SLOT_SIZE];
+  };
+
+  Slot *_slots = nullptr;
+  std::atomic<uint32_t> _head{0};
+  std::atomic<uint32_t> _tail{0};
+};
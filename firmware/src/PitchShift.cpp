@@ -1,54 +1,53 @@
 #include "PitchShift.h"
 
-#define GRAINSIZE 1024ul
-static int16_t buf1[GRAINSIZE];
-static int16_t buf2[GRAINSIZE];
-static int16_t* buf = buf1;
-static int16_t* buf_ = buf2;
-static unsigned long readAddress = 0;
-static unsigned long writeAddress = 0;
-
 bool PitchShiftFixedOutput::begin(PitchShiftInfo info) {
   TRACED();
   cfg = info;
   AudioOutput::setAudioInfo(info);
-  this->pitchMul = (uint32_t)(info.pitch_shift * 256.0f + 0.5f);
-  //this->secondaryOffset = (uint32_t)( (1.0f - (info.pitch_shift - (int)(info.pitch_shift))) * GRAINSIZE + 0.5f);
-  this->secondaryOffset = GRAINSIZE - ((( this->pitchMul * GRAINSIZE ) >> 8 ) % GRAINSIZE);
-  
-  return true;
-}
 
-int16_t PitchShiftFixedOutput::pitchShift(int16_t value) {
+  size_t grainSize = 64;
+  while (grainSize * 2 <= (size_t)info.buffer_size && grainSize * 2 <= MAX_GRAIN_SIZE) {
+    grainSize *= 2;
+  }
+  grainMask = grainSize - 1;
+  grainShift = 0;
+  while ((1u << grainShift) < grainSize) {
+    grainShift++;
+  }
 
-  buf_[writeAddress] = value;
+  bypass = info.pitch_shift <= 0.0f || fabsf(info.pitch_shift - 1.0f) < 0.001f;
+  stepQ16 = (uint32_t)(info.pitch_shift * 65536.0f + 0.5f);
 
-  int ii1 = (writeAddress * this->pitchMul) >> 8;
-  int output1 = buf[ii1 % GRAINSIZE];
-  int ii2 = ii1 + secondaryOffset;
-  int output2 = buf[ii2 % GRAINSIZE];
+  // start with the first tap half a grain behind the writer, where its window is fully open
+  memset(grain, 0, sizeof(grain));
+  writeAddress = 0;
+  readAddressQ16 = (uint32_t)(grainSize / 2) << 16;
+  return true;
+}
 
-  unsigned long f = 0;
-  if ( writeAddress >= GRAINSIZE*3/4 )
-  {
-    f = GRAINSIZE;
-  }
-  else if ( writeAddress >= GRAINSIZE/4 )
-  {
-    f = (writeAddress - GRAINSIZE/4) * 2;
+void PitchShiftFixedOutput::process(int16_t *samples, size_t sampleCount) {
+  if (bypass) {
+    return;
   }
 
-  int output = ( output1 * (GRAINSIZE - f ) + output2 * f )   /GRAINSIZE;
+  const uint32_t grainQ16Mask = ((grainMask + 1) << 16) - 1;
+  const uint32_t halfGrainQ16 = ((grainMask + 1) / 2) << 16;
 
-  writeAddress++;
-  if (writeAddress >= GRAINSIZE)
-  {
-    writeAddress = 0; // loop around to beginning of grain
-    readAddress = 0;
+  for (size_t i = 0; i < sampleCount; i++) {
+    grain[writeAddress] = samples[i];
 
-    buf_ = buf;
-    buf = buf == buf1 ? buf2 : buf1;
-  }
+    // distance of tap 1 behind the writer decides both windows (Q15, they always sum to 1.0)
+    uint32_t delayQ16 = ((writeAddress << 16) - readAddressQ16) & grainQ16Mask;
+    int32_t gain1 = delayQ16 >> grainShift;
+    if (delayQ16 >= halfGrainQ16) {
+      gain1 = 65536 - gain1;
+    }
+    int32_t gain2 = 32768 - gain1;
 
-  return output;
+    int32_t out = (readTap(readAddressQ16) * gain1 + readTap(readAddressQ16 + halfGrainQ16) * gain2) >> 15;
+    samples[i] = (int16_t)out;
+
+    readAddressQ16 = (readAddressQ16 + stepQ16) & grainQ16Mask;
+    writeAddress = (writeAddress + 1) & grainMask;
+  }
 }
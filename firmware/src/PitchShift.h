@@ -5,32 +5,44 @@
 #include <string.h>
 
 #include "AudioTools.h"
+#include "DspKernels.h"
 
-//pitch shift effect with interpolaion fixed to 1.5 frequency factor, fixed delay, int16_t, 1 channel
+// pitch shift effect for int16_t, 1 channel
+// Two taps read a delay line at pitch_shift times the write speed, half a grain apart, and are
+// cross-faded with complementary triangle windows so the tap that wraps around is always silent.
+// All state lives in the object, so several instances can run side by side.
 class PitchShiftFixedOutput : public AudioOutput {
 public:
+  static constexpr size_t MAX_GRAIN_SIZE = 2048;
+  static constexpr size_t BLOCK_SIZE = 256;
+
   PitchShiftFixedOutput(Print &out) { p_out = &out; }
 
   PitchShiftInfo defaultConfig() {
     PitchShiftInfo result;
     result.bits_per_sample = sizeof(int16_t) * 8;
+    result.buffer_size = 1024;
     return result;
   }
 
+  // buffer_size is the grain length in samples, rounded down to a power of two
   bool begin(PitchShiftInfo info);
 
-  size_t write(const uint8_t *data, size_t len) override {
-    size_t result = 0;
-    int16_t *p_in = (int16_t *)data;
-    int sample_count = len / sizeof(int16_t);
+  // in place, any number of samples
+  void process(int16_t *samples, size_t sampleCount);
 
-    for (int j = 0; j < sample_count; j += 1) {
-      int16_t value = p_in[j];
+  // processes whole blocks and hands each block to the output in one write
+  size_t write(const uint8_t *data, size_t len) override {
+    const int16_t *p_in = (const int16_t *)data;
+    size_t sample_count = len / sizeof(int16_t);
 
-      int16_t out_value = pitchShift(value);
-      result += p_out->write((uint8_t *)&out_value, sizeof(int16_t));
+    for (size_t j = 0; j < sample_count; j += BLOCK_SIZE) {
+      size_t n = min(BLOCK_SIZE, sample_count - j);
+      memcpy(block, p_in + j, n * sizeof(int16_t));
+      process(block, n);
+      p_out->write((const uint8_t *)block, n * sizeof(int16_t));
     }
-    return result;
+    return sample_count * sizeof(int16_t);
   }
 
   void end() {}
@@ -38,7 +50,17 @@ public:
 protected:
   Print *p_out = nullptr;
 
-  int16_t pitchShift(int16_t value);
-  uint32_t pitchMul;
-  unsigned long secondaryOffset;
-};
\ No newline at end of file
+  int16_t grain[MAX_GRAIN_SIZE];
+  int16_t block[BLOCK_SIZE];
+  uint32_t grainMask = 0;        // grain size - 1
+  uint32_t grainShift = 0;       // log2(grain size)
+  uint32_t writeAddress = 0;
+  uint32_t readAddressQ16 = 0;   // fractional read position, 16.16 fixed point
+  uint32_t stepQ16 = 1 << 16;    // read advance per sample, 16.16 fixed point
+  bool bypass = true;
+
+  inline int32_t readTap(uint32_t addressQ16) const {
+    uint32_t index = addressQ16 >> 16;
+    return dspLerpS16(grain[index & grainMask], grain[(index + 1) & grainMask], (addressQ16 >> 1) & 0x7FFF);
+  }
+};
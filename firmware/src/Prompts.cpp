@@ -0,0 +1,381 @@
+#include "Prompts.h"
+#include "Audio.h"
+#include "Doze.h"
+#include "Log.h"
+#include "Memory.h"
+#include "Mixer.h"
+#include <SPIFFS.h>
+#include <Preferences.h>
+#include <mbedtls/sha256.h>
+
+static const char *const PROMPT_NAMES[PROMPT_COUNT] = {"wake", "thinking", "connection_error"};
+static const char *const INCOMING_PATH = "/p/.incoming";
+static constexpr size_t HASH_CHARS = 64;
+static constexpr size_t PATH_MAX_CHARS = 32;  // SPIFFS_OBJ_NAME_LEN
+
+static bool mounted = false;
+static char promptHashes[PROMPT_COUNT][HASH_CHARS + 1]; //access from networkTask only
+
+// a clip being received
+struct PromptStore
+{
+    bool active;
+    File file;
+    char hash[HASH_CHARS + 1];
+    size_t size;
+    size_t received;
+    mbedtls_sha256_context sha;
+};
+static PromptStore store; //access from networkTask only
+
+// a clip being played
+struct PromptPlayback
+{
+    File file;
+    int input = -1;                                     // playbackMixer input
+    uint8_t packet[JitterBuffer::SLOT_SIZE];            // read but not decoded yet
+    size_t packetLength = 0;
+};
+static PromptPlayback playback; //access from networkTask only
+static OpusDecoder *promptDecoder = nullptr; //access from networkTask only
+static int16_t promptPcm[MAX_DECODED_SAMPLES]; //access from networkTask only
+static volatile bool wakePromptScheduled = false; //set by the button and touch handlers, played by networkTask
+
+static void promptPath(const char *hash, char *path)
+{
+    snprintf(path, PATH_MAX_CHARS, "/p/%.24s", hash);
+}
+
+// copies a hex SHA-256 to hash in lower case, the case the file names and name table use
+static bool validHash(const char *text, char *hash)
+{
+    if (text == nullptr || strlen(text) != HASH_CHARS) {
+        return false;
+    }
+    for (size_t i = 0; i < HASH_CHARS; i++) {
+        if (!isxdigit((unsigned char)text[i])) {
+            return false;
+        }
+        hash[i] = tolower((unsigned char)text[i]);
+    }
+    hash[HASH_CHARS] = '\0';
+    return true;
+}
+
+void promptsBegin()
+{
+    // formats the partition the first time, which takes a while but only happens once
+    mounted = SPIFFS.begin(true);
+    if (!mounted) {
+        LOG_E("[PROMPT] spiffs not mounted, prompts come from the server only");
+        return;
+    }
+    SPIFFS.remove(INCOMING_PATH);
+
+    // decodes ahead of playout into the mixer ring, so PSRAM is fast enough
+    promptDecoder = (OpusDecoder *)memAlloc(opus_decoder_get_size(CHANNELS), MEM_PSRAM, "prompt decoder");
+    if (promptDecoder == nullptr || opus_decoder_init(promptDecoder, SAMPLE_RATE, CHANNELS) != OPUS_OK) {
+        LOG_E("[PROMPT] No decoder, prompts come from the server only");
+        mounted = false;
+        return;
+    }
+
+    Preferences prefs;
+    prefs.begin("prompts", true);
+    for (size_t i = 0; i < PROMPT_COUNT; i++) {
+        String hash = prefs.getString(PROMPT_NAMES[i], "");
+        if (!validHash(hash.c_str(), promptHashes[i])) {
+            promptHashes[i][0] = '\0';
+        }
+    }
+    prefs.end();
+    LOG_I("[PROMPT] spiffs %u of %u bytes used", (unsigned)SPIFFS.usedBytes(), (unsigned)SPIFFS.totalBytes());
+}
+
+bool promptCached(const char *text)
+{
+    char hash[HASH_CHARS + 1];
+    if (!mounted || !validHash(text, hash)) {
+        return false;
+    }
+    char path[PATH_MAX_CHARS];
+    promptPath(hash, path);
+    return SPIFFS.exists(path);
+}
+
+/**
+ * @brief Use the clips the server names in its auth message, and ask for the missing ones
+ * @param names Object of prompt name to SHA-256, names the device does not know are ignored
+ */
+void promptsConfigure(JsonObjectConst names)
+{
+    if (names.isNull()) {
+        return;
+    }
+    Preferences prefs;
+    prefs.begin("prompts", false);
+    char missing[64 + PROMPT_COUNT * (HASH_CHARS + 3)];
+    int length = snprintf(missing, sizeof(missing), "{\"type\":\"prompt\",\"msg\":\"missing\",\"hashes\":[");
+    size_t missingCount = 0;
+    for (size_t i = 0; i < PROMPT_COUNT; i++) {
+        char hash[HASH_CHARS + 1];
+        if (!validHash(names[PROMPT_NAMES[i]] | "", hash)) {
+            continue;
+        }
+        if (strcmp(hash, promptHashes[i]) != 0) {
+            strlcpy(promptHashes[i], hash, sizeof(promptHashes[i]));
+            prefs.putString(PROMPT_NAMES[i], hash);
+        }
+        if (!promptCached(hash)) {
+            length += snprintf(missing + length, sizeof(missing) - length, "%s\"%s\"", missingCount ? "," : "", hash);
+            missingCount++;
+        }
+    }
+    prefs.end();
+
+    if (missingCount > 0 && mounted) {
+        snprintf(missing + length, sizeof(missing) - length, "]}");
+        webSocket.sendTXT(missing);
+        LOG_I("[PROMPT] %u prompts not cached, asked the server for them", (unsigned)missingCount);
+    }
+}
+
+// STORE
+// networkTask -> promptStoreBegin() -> makeRoom()
+// drops clips no name points at any more, oldest directory order first, until size fits
+static bool makeRoom(size_t size)
+{
+    size_t total = SPIFFS.totalBytes();
+    // spiffs slows down badly when nearly full, keep a quarter free
+    size_t limit = total - total / 4;
+    if (SPIFFS.usedBytes() + size <= limit) {
+        return true;
+    }
+
+    File dir = SPIFFS.open("/");
+    for (File entry = dir.openNextFile(); entry; entry = dir.openNextFile()) {
+        String path = entry.path();
+        entry.close();
+        if (!path.startsWith("/p/") || path == INCOMING_PATH) {
+            continue;
+        }
+        bool named = false;
+        for (size_t i = 0; i < PROMPT_COUNT; i++) {
+            named |= strncmp(path.c_str() + 3, promptHashes[i], 24) == 0;
+        }
+        if (!named) {
+            SPIFFS.remove(path);
+            LOG_I("[PROMPT] Evicted %s", path.c_str());
+            if (SPIFFS.usedBytes() + size <= limit) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool promptStoreBegin(const char *text, size_t size)
+{
+    char hash[HASH_CHARS + 1];
+    if (store.active) {
+        store.file.close();
+        mbedtls_sha256_free(&store.sha);
+        store.active = false;
+    }
+    if (!mounted || !validHash(text, hash) || size == 0 || size > PROMPT_MAX_BYTES) {
+        LOG_W("[PROMPT] Refusing clip %.12s of %u bytes", text ? text : "", (unsigned)size);
+        return false;
+    }
+    if (promptCached(hash)) {
+        return false;  // nothing to do, the server gets "cached" back
+    }
+    if (!makeRoom(size)) {
+        LOG_W("[PROMPT] No room for %u bytes", (unsigned)size);
+        return false;
+    }
+    store.file = SPIFFS.open(INCOMING_PATH, FILE_WRITE);
+    if (!store.file) {
+        LOG_E("[PROMPT] Could not create %s", INCOMING_PATH);
+        return false;
+    }
+    store.active = true;
+    strlcpy(store.hash, hash, sizeof(store.hash));
+    store.size = size;
+    store.received = 0;
+    mbedtls_sha256_init(&store.sha);
+    mbedtls_sha256_starts(&store.sha, 0);
+    return true;
+}
+
+bool promptStoreWrite(size_t offset, const uint8_t *data, size_t length)
+{
+    if (!store.active || offset != store.received || store.received + length > store.size) {
+        return false;
+    }
+    if (store.file.write(data, length) != length) {
+        LOG_E("[PROMPT] Write failed at %u", (unsigned)offset);
+        return false;
+    }
+    mbedtls_sha256_update(&store.sha, data, length);
+    store.received += length;
+    return true;
+}
+
+bool promptStoreCommit()
+{
+    if (!store.active) {
+        return false;
+    }
+    store.active = false;
+    store.file.close();
+
+    uint8_t digest[32];
+    char digestHex[HASH_CHARS + 1];
+    mbedtls_sha256_finish(&store.sha, digest);
+    mbedtls_sha256_free(&store.sha);
+    for (size_t i = 0; i < sizeof(digest); i++) {
+        snprintf(digestHex + i * 2, 3, "%02x", digest[i]);
+    }
+    if (store.received != store.size || strcmp(digestHex, store.hash) != 0) {
+        LOG_W("[PROMPT] Clip %.12s incomplete or corrupt, dropped", store.hash);
+        SPIFFS.remove(INCOMING_PATH);
+        return false;
+    }
+
+    char path[PATH_MAX_CHARS];
+    promptPath(store.hash, path);
+    if (!SPIFFS.rename(INCOMING_PATH, path)) {
+        SPIFFS.remove(INCOMING_PATH);
+        return false;
+    }
+    LOG_I("[PROMPT] Cached %s (%u bytes)", path, (unsigned)store.size);
+    return true;
+}
+
+bool promptStoring()
+{
+    return store.active;
+}
+
+// PLAYBACK
+// networkTask -> promptPlay() / promptService() -> readPacket()
+static bool readPacket()
+{
+    uint16_t length = 0;
+    if (playback.file.read(reinterpret_cast<uint8_t *>(&length), sizeof(length)) != sizeof(length)) {
+        return false;  // end of the clip
+    }
+    if (length == 0 || length > sizeof(playback.packet) || playback.file.read(playback.packet, length) != length) {
+        LOG_W("[PROMPT] Damaged clip %s, stopping", playback.file.name());
+        return false;
+    }
+    playback.packetLength = length;
+    return true;
+}
+
+// networkTask -> promptService() -> endPlayback()
+static void endPlayback()
+{
+    playback.file.close();
+    playbackMixer.close(playback.input);  // plays out what is queued and frees the input
+    playback.input = -1;
+    playback.packetLength = 0;
+}
+
+bool promptPlay(const char *text)
+{
+    char hash[HASH_CHARS + 1];
+    if (deviceState == SLEEP || dozing() || promptDecoder == nullptr || !validHash(text, hash) || !promptCached(hash)) {
+        return false;
+    }
+    promptStop();
+
+    char path[PATH_MAX_CHARS];
+    promptPath(hash, path);
+    playback.file = SPIFFS.open(path, FILE_READ);
+    if (!playback.file) {
+        return false;
+    }
+    playback.input = playbackMixer.open(PROMPT_GAIN, PROMPT_DUCK, wakeNetworkTask);
+    if (playback.input < 0) {
+        LOG_W("[PROMPT] No free mixer input");
+        playback.file.close();
+        return false;
+    }
+    opus_decoder_init(promptDecoder, downlinkSampleRate, CHANNELS);  // the mixer runs at the downlink rate
+    playback.packetLength = 0;
+    digitalWrite(I2S_SD_OUT, HIGH);
+    promptService();
+    xTaskNotifyGive(speakerTaskHandle);
+    return true;
+}
+
+bool promptPlayNamed(PromptName name)
+{
+    return name < PROMPT_COUNT && promptPlay(promptHashes[name]);
+}
+
+bool promptPlayNamed(const char *name)
+{
+    for (size_t i = 0; i < PROMPT_COUNT; i++) {
+        if (strcmp(name, PROMPT_NAMES[i]) == 0) {
+            return promptPlayNamed((PromptName)i);
+        }
+    }
+    return false;
+}
+
+// fades out over a few ms, the response (if any) keeps playing
+void promptStop()
+{
+    if (playback.file) {
+        playback.file.close();
+    }
+    if (playback.input >= 0) {
+        playbackMixer.stop(playback.input);
+        playback.input = -1;
+    }
+    playback.packetLength = 0;
+}
+
+// main (button) / touchTask -> promptScheduleWake()
+void promptScheduleWake()
+{
+    wakePromptScheduled = true;
+    wakeNetworkTask();
+}
+
+void promptService()
+{
+    // local feedback for the press, before the server hears anything
+    if (wakePromptScheduled) {
+        wakePromptScheduled = false;
+        promptPlayNamed(PROMPT_WAKE);
+    }
+    if (playback.input < 0) {
+        return;
+    }
+    if (dozing()) {
+        promptStop();
+        return;
+    }
+
+    // decode a packet only once its whole frame fits into the ring
+    while (true) {
+        if (playback.packetLength == 0 && !readPacket()) {
+            endPlayback();
+            return;
+        }
+        int samples = opus_packet_get_nb_samples(playback.packet, playback.packetLength, downlinkSampleRate);
+        if (samples > 0 && (size_t)samples > playbackMixer.room(playback.input)) {
+            return;  // the mixer calls wakeNetworkTask() once it drained half of the ring
+        }
+        samples = opus_decode(promptDecoder, playback.packet, playback.packetLength, promptPcm, MAX_DECODED_SAMPLES, 0);
+        playback.packetLength = 0;
+        if (samples < 0) {
+            LOG_W_EVERY(1000, "[PROMPT] Opus decode failed (%d)", samples);
+            continue;
+        }
+        playbackMixer.write(playback.input, promptPcm, samples * CHANNELS);
+    }
+}
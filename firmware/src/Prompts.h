@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// PROMPTS: short Opus clips (chimes, "thinking", connection errors) kept in the spiffs
+// partition and played from flash, so the device can answer without a round trip and
+// prompts that repeat are not sent again.
+// Clips are content addressed: stored as /p/<first 24 hex digits of their SHA-256>, the file
+// being the packets as [uint16 length, little endian][Opus packet], any Opus rate.
+//   auth      "prompts": {"wake": "<sha256>", ...} names the clips to use, the device answers
+//             {"type":"prompt","msg":"missing","hashes":[...]} for the ones it does not have
+//   store     {"type":"prompt","msg":"store","hash":"<sha256>","size":N}, BIN frames starting
+//             with a PromptChunkHeader, then {"type":"prompt","msg":"commit"}
+//   play      {"type":"prompt","msg":"play","hash":"<sha256>"} or "name":"<name>"
+// Playback decodes on networkTask into an input of playbackMixer, so a prompt plays over a
+// response that is buffering or playing (ducking it) instead of replacing it.
+enum PromptName
+{
+    PROMPT_WAKE,
+    PROMPT_THINKING,
+    PROMPT_CONNECTION_ERROR,
+    PROMPT_COUNT
+};
+
+struct __attribute__((packed)) PromptChunkHeader {
+    uint32_t magic;             // PROMPT_CHUNK_MAGIC
+    uint32_t offset;            // position of the chunk in the clip
+};
+
+constexpr uint32_t PROMPT_CHUNK_MAGIC = 0x314d5250;  // "PRM1"
+constexpr size_t PROMPT_MAX_BYTES = 256 * 1024;
+constexpr float PROMPT_GAIN = 1.0f;
+constexpr float PROMPT_DUCK = 0.35f;  // a response that plays at the same time, about -9 dB
+
+// setup(), before the tasks: mount (and on first boot format) spiffs, load the name table,
+// create the decoder
+void promptsBegin();
+
+// any task: the user woke the device, networkTask plays the "wake" clip if there is one
+void promptScheduleWake();
+
+// networkTask only from here on
+// onAuth(): take over the name table from "prompts", ask for what is missing
+void promptsConfigure(JsonObjectConst names);
+bool promptCached(const char *hash);
+
+bool promptStoreBegin(const char *hash, size_t size);
+bool promptStoreWrite(size_t offset, const uint8_t *data, size_t length);
+bool promptStoreCommit();
+bool promptStoring();
+
+// false when the clip is not cached or no mixer input is free; replaces a prompt that plays
+bool promptPlay(const char *hash);
+bool promptPlayNamed(PromptName name);
+bool promptPlayNamed(const char *name);
+void promptStop();
+// networkTask loop: start a scheduled wake clip, keep the mixer input filled while a prompt plays
+void promptService();
@@ -0,0 +1,123 @@
+#include "Scheduling.h"
+#include "Log.h"
+#include <freertos/semphr.h>
+
+// per task CPU time needs the FreeRTOS run time counter; without it only the layout is reported
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+#define TASK_STATS_RUN_TIME 1
+#else
+#define TASK_STATS_RUN_TIME 0
+#endif
+
+static constexpr size_t MAX_SAMPLED_TASKS = 32;
+static constexpr int NO_CORE = -1;
+
+struct TaskSample
+{
+    char name[configMAX_TASK_NAME_LEN];
+    TaskHandle_t handle;
+    int core;               // NO_CORE when the task is not pinned
+    UBaseType_t priority;
+    uint32_t stackFree;     // bytes never used
+    uint32_t runTime;       // run time counter at the sample, for the next delta
+    uint32_t cpuPermille;   // of one core over the window
+};
+
+static TaskSample samples[MAX_SAMPLED_TASKS]; //written by loopTask under statsLock()
+static size_t sampleCount = 0;
+static uint32_t corePermille[portNUM_PROCESSORS] = {};
+static uint32_t windowUs = 0;
+static uint32_t lastTotalRunTime = 0;
+
+static SemaphoreHandle_t statsLock()
+{
+    static SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+    return lock;
+}
+
+struct StatsLockGuard
+{
+    StatsLockGuard() { xSemaphoreTake(statsLock(), portMAX_DELAY); }
+    ~StatsLockGuard() { xSemaphoreGive(statsLock()); }
+};
+
+void taskStatsSample()
+{
+#if configUSE_TRACE_FACILITY
+    static TaskStatus_t status[MAX_SAMPLED_TASKS]; //access from loopTask only
+    uint32_t totalRunTime = 0;
+    UBaseType_t count = uxTaskGetSystemState(status, MAX_SAMPLED_TASKS, &totalRunTime);
+
+    StatsLockGuard lock;
+    uint32_t window = totalRunTime - lastTotalRunTime;
+    TaskSample next[MAX_SAMPLED_TASKS];
+    for (UBaseType_t i = 0; i < count; i++) {
+        TaskSample &sample = next[i];
+        strlcpy(sample.name, status[i].pcTaskName, sizeof(sample.name));
+        sample.handle = status[i].xHandle;
+        BaseType_t affinity = xTaskGetAffinity(status[i].xHandle);
+        sample.core = affinity == tskNO_AFFINITY ? NO_CORE : (int)affinity;
+        sample.priority = status[i].uxCurrentPriority;
+        sample.stackFree = status[i].usStackHighWaterMark;
+        sample.runTime = TASK_STATS_RUN_TIME ? status[i].ulRunTimeCounter : 0;
+        sample.cpuPermille = 0;
+
+        // a task that did not exist at the previous sample is measured from the next one on
+        for (size_t j = 0; j < sampleCount && window > 0; j++) {
+            if (samples[j].handle == sample.handle) {
+                sample.cpuPermille = (uint64_t)(sample.runTime - samples[j].runTime) * 1000 / window;
+                break;
+            }
+        }
+    }
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        TaskHandle_t idle = xTaskGetIdleTaskHandleForCPU(core);
+        corePermille[core] = 0;
+        for (UBaseType_t i = 0; i < count; i++) {
+            if (next[i].handle == idle && next[i].cpuPermille <= 1000) {
+                corePermille[core] = 1000 - next[i].cpuPermille;
+            }
+        }
+    }
+    memcpy(samples, next, count * sizeof(TaskSample));
+    sampleCount = count;
+    windowUs = window;
+    lastTotalRunTime = totalRunTime;
+#endif
+}
+
+void taskStatsReport(Print &out)
+{
+    StatsLockGuard lock;
+    out.printf("{\"run_time_stats\":%s,\"window_ms\":%u,\"cores\":[", TASK_STATS_RUN_TIME ? "true" : "false",
+        (unsigned)(windowUs / 1000));
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        out.printf("%s{\"core\":%d,\"load_pct\":%u.%u}", core ? "," : "", core,
+            (unsigned)(corePermille[core] / 10), (unsigned)(corePermille[core] % 10));
+    }
+    out.print("],\"tasks\":[");
+    for (size_t i = 0; i < sampleCount; i++) {
+        const TaskSample &sample = samples[i];
+        out.printf("%s{\"name\":\"%s\",\"core\":%d,\"priority\":%u,\"cpu_pct\":%u.%u,\"min_free\":%u}", i ? "," : "",
+            sample.name, sample.core, (unsigned)sample.priority, (unsigned)(sample.cpuPermille / 10),
+            (unsigned)(sample.cpuPermille % 10), (unsigned)sample.stackFree);
+    }
+    out.print("]}");
+}
+
+void logTaskStats()
+{
+    StatsLockGuard lock;
+    if (!TASK_STATS_RUN_TIME || windowUs == 0) {
+        return;
+    }
+    LOG_I("[CPU] core 0 %u.%u%%, core 1 %u.%u%% over %u ms", (unsigned)(corePermille[0] / 10), (unsigned)(corePermille[0] % 10),
+        (unsigned)(corePermille[portNUM_PROCESSORS - 1] / 10), (unsigned)(corePermille[portNUM_PROCESSORS - 1] % 10),
+        (unsigned)(windowUs / 1000));
+    for (size_t i = 0; i < sampleCount; i++) {
+        const TaskSample &sample = samples[i];
+        LOG_I("[CPU] %-16s core %2d prio %2u %3u.%u%%", sample.name, sample.core, (unsigned)sample.priority,
+            (unsigned)(sample.cpuPermille / 10), (unsigned)(sample.cpuPermille % 10));
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <Arduino.h>
+#include "Memory.h"
+
+// SCHEDULING PROFILE: priority, core and stack of every task the firmware starts, in one
+// table. Audio deadlines come first, cosmetics last:
+//   core 0  Wi-Fi driver (23) and lwIP (18) as the IDF starts them, networkTask between the
+//           two so socket data is picked up at once without starving the radio, then the
+//           background tasks (wifiTask, discovery, log, async_tcp via platformio.ini)
+//   core 1  audioStreamTask above micTask (an output underrun is audible, the mic DMA holds
+//           several buffers and duplex AEC runs on micTask), the LED engine at the bottom,
+//           level with loopTask
+// taskStatsSample() measures how the layout holds up under load.
+enum TaskSlot
+{
+    TASK_NETWORK,
+    TASK_SPEAKER,
+    TASK_MIC,
+    TASK_LED,
+    TASK_WIFI,
+    TASK_DISCOVERY,
+    TASK_LOG,
+    TASK_TOUCH,
+    TASK_SLOT_COUNT
+};
+
+struct TaskProfile
+{
+    const char *name;
+    UBaseType_t priority;
+    BaseType_t core;
+    uint32_t stackBytes;
+};
+
+constexpr TaskProfile TASK_PROFILES[TASK_SLOT_COUNT] = {
+    {"Websocket Task",  20, 0, 8192},   // sole websocket owner, decodes prompts
+    {"Speaker Task",     6, 1, 16384},  // opus_decode runs on this stack
+    {"Microphone Task",  5, 1, 16384},  // opus_encode and the AEC run on this stack
+    {"LED Task",         1, 1, 4096},   // only wakes on state changes and pulse turns
+    {"WifiManager",      1, 0, 4096},
+    {"Discovery",        1, 0, 4096},   // mostly sleeps between polls
+    {"Log Task",         1, 0, 3072},   // draining only uses the time nothing else wants
+    {"Touch Task",       3, 0, 4096},   // polls the pad every 20 ms
+};
+
+// A StaticTask that takes its name, priority, core and stack from TASK_PROFILES
+template <TaskSlot SLOT>
+class ProfiledTask : public StaticTask<TASK_PROFILES[SLOT].stackBytes> {
+public:
+    TaskHandle_t start(TaskFunction_t function, void *parameter = nullptr)
+    {
+        const TaskProfile &profile = TASK_PROFILES[SLOT];
+        return StaticTask<TASK_PROFILES[SLOT].stackBytes>::start(function, profile.name, parameter, profile.priority, profile.core);
+    }
+};
+
+constexpr uint32_t TASK_STATS_INTERVAL_MS = 5000;
+
+// loopTask, every TASK_STATS_INTERVAL_MS: CPU time per task since the previous sample
+void taskStatsSample();
+// any task: the last sample as JSON, {"run_time_stats":..,"window_ms":..,"cores":[..],"tasks":[..]}
+void taskStatsReport(Print &out);
+// any task: the same as a few log lines
+void logTaskStats();
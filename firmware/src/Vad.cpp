@@ -0,0 +1,77 @@
+#include "Vad.h"
+#include "DspKernels.h"
+#include <math.h>
+
+void VoiceActivityDetector::begin(uint32_t sampleRate, uint32_t frameMs, uint32_t endSilenceMs) {
+  (void)sampleRate;  // both features are normalised per sample
+  this->frameMs = frameMs > 0 ? frameMs : 20;
+  this->endSilenceMs = endSilenceMs > HANGOVER_MS ? endSilenceMs : HANGOVER_MS;
+  noiseRms = 0.0f;
+  reset();
+}
+
+// start of a turn: keep the learned noise floor, forget the utterance state
+void VoiceActivityDetector::reset() {
+  active = false;
+  hangoverLeftMs = 0;
+  speechMs = 0;
+  silenceMs = 0;
+}
+
+VoiceActivityDetector::Result VoiceActivityDetector::process(const int16_t *samples, size_t sampleCount) {
+  Result result = { 0, active, false, false };
+  if (sampleCount == 0) {
+    return result;
+  }
+
+  float rms = (float)dspRmsS16(samples, sampleCount);
+  float diffRms = (float)dspDiffRmsS16(samples, sampleCount);
+  if (noiseRms <= 0.0f) {
+    noiseRms = rms > MIN_NOISE_RMS ? rms : MIN_NOISE_RMS;
+  }
+
+  // 4 dB over the floor starts to count, 16 dB is certainly loud enough
+  float snrDb = 20.0f * log10f((rms + 1.0f) / (noiseRms + 1.0f));
+  float energyScore = (snrDb - 4.0f) / 12.0f;
+  energyScore = energyScore < 0.0f ? 0.0f : (energyScore > 1.0f ? 1.0f : energyScore);
+
+  // white noise gives a ratio of 2, voiced speech well below 1
+  float tilt = rms > 0.0f ? (diffRms * diffRms) / (rms * rms) : 0.0f;
+  float tiltWeight = tilt < 1.0f ? 1.0f : (tilt < 1.6f ? 0.75f : 0.45f);
+
+  result.probability = (uint8_t)(energyScore * tiltWeight * 255.0f + 0.5f);
+
+  bool frameSpeech = result.probability >= (active ? KEEP_PROBABILITY : ONSET_PROBABILITY);
+
+  // the floor drops quickly to quiet frames and only creeps up under speech
+  float rate = rms < noiseRms ? 0.25f : (frameSpeech ? 0.0005f : 0.01f) * frameMs / 20.0f;
+  noiseRms += (rms - noiseRms) * rate;
+  if (noiseRms < MIN_NOISE_RMS) {
+    noiseRms = MIN_NOISE_RMS;
+  }
+
+  if (frameSpeech) {
+    result.started = !active;
+    active = true;
+    hangoverLeftMs = HANGOVER_MS;
+    speechMs += frameMs;
+    silenceMs = 0;
+  } else {
+    if (active) {
+      if (hangoverLeftMs > frameMs) {
+        hangoverLeftMs -= frameMs;
+      } else {
+        hangoverLeftMs = 0;
+        active = false;
+      }
+    }
+    silenceMs += frameMs;
+    if (speechMs >= MIN_SPEECH_MS && silenceMs >= endSilenceMs) {
+      result.ended = true;
+      speechMs = 0;
+    }
+  }
+
+  result.speech = active;
+  return result;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Lightweight voice activity detector for the mic uplink, one call per frame.
+// Two cheap features per frame:
+//   - energy against an adaptive noise floor (the floor follows quiet frames quickly and loud
+//     frames slowly, so steady fan/room noise is learned but speech is not)
+//   - spectral tilt, the energy of the first difference against the energy of the frame;
+//     voiced speech sits low in the spectrum while hiss and clicks are flat or high heavy
+// A hangover keeps short pauses inside an utterance, and ended is raised once when the
+// speaker has been quiet for endSilenceMs after real speech.
+class VoiceActivityDetector {
+public:
+  struct Result {
+    uint8_t probability;  // 0..255 speech likelihood of this frame
+    bool speech;          // inside an utterance (includes the hangover)
+    bool started;         // first frame of an utterance
+    bool ended;           // the utterance just ended, send vad_end
+  };
+
+  void begin(uint32_t sampleRate, uint32_t frameMs, uint32_t endSilenceMs);
+  void reset();
+  Result process(const int16_t *samples, size_t sampleCount);
+
+  uint32_t noiseFloor() const { return (uint32_t)noiseRms; }
+
+protected:
+  static constexpr uint32_t HANGOVER_MS = 200;
+  static constexpr uint32_t MIN_SPEECH_MS = 120;  // shorter bursts (taps, clicks) never end a turn
+  static constexpr uint8_t ONSET_PROBABILITY = 160;
+  static constexpr uint8_t KEEP_PROBABILITY = 110;
+  static constexpr float MIN_NOISE_RMS = 20.0f;
+
+  uint32_t frameMs = 20;
+  uint32_t endSilenceMs = 700;
+
+  float noiseRms = 0.0f;
+  bool active = false;
+  uint32_t hangoverLeftMs = 0;
+  uint32_t speechMs = 0;
+  uint32_t silenceMs = 0;
+};
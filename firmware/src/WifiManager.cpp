@@ -11,17 +11,134 @@
 #include <WiFi.h>
 #include <Preferences.h>
 #include <Config.h>
+#include "Log.h"
+#include "Scheduling.h"
+#include "Discovery.h"
+#include "UiAssets.h"
+#include <esp_attr.h>
+#include <esp_sleep.h>
+#include <esp_netif.h>
+#include <esp_netif_net_stack.h>
+#include <lwip/dhcp.h>
+
+// Last good association. RTC slow memory keeps it across deep sleep, the NVS copy across power
+// cycles. The IP lease is only reused straight out of deep sleep and only until the time the
+// DHCP client would have renewed it, after a power cycle DHCP runs as usual. time() keeps
+// counting through deep sleep, so it dates the lease.
+struct FastConnectRecord {
+  uint32_t magic;
+  uint32_t credentialsHash;  // apList entry the record belongs to, a changed entry invalidates it
+  uint8_t apIndex;
+  uint8_t channel;
+  uint8_t bssid[6];
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint32_t leaseRenewAt;     // time() at T1 of the DHCP lease ip came with, 0: no lease
+};
+static const uint32_t FAST_CONNECT_MAGIC = 0x46434e32;
+static const uint32_t FAST_CONNECT_TIMEOUT_MS = 3000;
+static const uint32_t FAST_CONNECT_LEASE_MAX_S = 86400;  // caps infinite leases
+RTC_DATA_ATTR static FastConnectRecord rtcFastConnect;
+static uint32_t reusedLeaseRenewAt = 0;  // set while the station runs on a reused lease, access from wifiTask only
+static bool leaseSavePending = false;    // DHCP was restarted, save its lease once bound, access from wifiTask only
+
+// seconds until the DHCP client renews the station's lease (T1), 0 if the address is not from DHCP
+static uint32_t dhcpRenewSeconds() {
+  esp_netif_t *sta = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+  struct netif *netif = sta ? (struct netif *)esp_netif_get_netif_impl(sta) : nullptr;
+  if (netif == nullptr || !dhcp_supplied_address(netif)) return 0;
+  uint32_t renew = netif_dhcp_data(netif)->offered_t1_renew;
+  return renew < FAST_CONNECT_LEASE_MAX_S ? renew : FAST_CONNECT_LEASE_MAX_S;
+}
+
+// FNV-1a over SSID and password
+static uint32_t credentialsHash(const String &name, const String &pass) {
+  uint32_t hash = 2166136261u;
+  for (const String *part : {&name, &pass}) {
+    for (size_t i = 0; i < part->length(); i++) {
+      hash = (hash ^ (uint8_t)(*part)[i]) * 16777619u;
+    }
+    hash = (hash ^ 0xFF) * 16777619u;
+  }
+  return hash;
+}
+
+// Scan cache: one scan at a time, started by wifiTask and read by the API and tryConnect().
+// Requests inside SCAN_MIN_INTERVAL_MS of the last scan are answered from the cache. The
+// channel dwell is kept short, and shorter still while SoftAP clients are connected, since
+// the radio leaves their channel for every hop.
+struct ScanEntry {
+  char ssid[33];
+  uint8_t bssid[6];
+  int8_t rssi;
+  uint8_t channel;
+  uint8_t encryptionType;
+};
+static const uint8_t SCAN_CACHE_MAX = 24;
+static const uint32_t SCAN_MIN_INTERVAL_MS = 10000;
+static const uint32_t SCAN_MAX_AGE_MS = 30000;     // older results make tryConnect() scan again
+static const uint32_t SCAN_DWELL_MS = 120;
+static const uint32_t SCAN_DWELL_SOFTAP_MS = 60;
+static ScanEntry scanEntries[SCAN_CACHE_MAX];
+static uint8_t scanCount = 0;
+static uint32_t scanId = 0;                        // +1 per finished scan, 0: no results yet
+static unsigned long scanFinishedAt = 0;
+static volatile bool scanRequested = false;
+static volatile bool scanRunning = false; //written by wifiTask, read by the /scan and /scan/results handlers
+static portMUX_TYPE scanLock = portMUX_INITIALIZER_UNLOCKED;
+
+// wifiTask -> serviceScan() / scanNow() -> storeScanResults()
+static void storeScanResults(int16_t found) {
+  ScanEntry entries[SCAN_CACHE_MAX];
+  uint8_t count = 0;
+  for (int16_t i = 0; i < found && count < SCAN_CACHE_MAX; i++) {
+    ScanEntry &entry = entries[count++];
+    strlcpy(entry.ssid, WiFi.SSID(i).c_str(), sizeof(entry.ssid));
+    memcpy(entry.bssid, WiFi.BSSID(i), sizeof(entry.bssid));
+    entry.rssi = (int8_t)WiFi.RSSI(i);
+    entry.channel = (uint8_t)WiFi.channel(i);
+    entry.encryptionType = (uint8_t)WiFi.encryptionType(i);
+  }
+  WiFi.scanDelete();
+
+  portENTER_CRITICAL(&scanLock);
+  memcpy(scanEntries, entries, sizeof(ScanEntry) * count);
+  scanCount = count;
+  scanId++;
+  scanFinishedAt = millis();
+  portEXIT_CRITICAL(&scanLock);
+}
+
+// any task: a consistent copy of the cache, returns the number of entries
+static uint8_t copyScanResults(ScanEntry *out, uint32_t &id, unsigned long &finishedAt) {
+  portENTER_CRITICAL(&scanLock);
+  uint8_t count = scanCount;
+  memcpy(out, scanEntries, sizeof(ScanEntry) * count);
+  id = scanId;
+  finishedAt = scanFinishedAt;
+  portEXIT_CRITICAL(&scanLock);
+  return count;
+}
+
+static uint32_t scanDwellMs() {
+  return WiFi.softAPgetStationNum() > 0 ? SCAN_DWELL_SOFTAP_MS : SCAN_DWELL_MS;
+}
 
 /**
- * @brief Write a message to the Serial interface
- * @param msg The message to be written
+ * @brief Write a message to the deferred log
+ * @param format printf style format of the message
  *
- * This function is a simple wrapper around Serial.print() to write a message
- * to the serial console. It can be overwritten by a custom implementation for 
- * enhanced logging.
+ * This function is a simple wrapper around logWriteV() to queue a message
+ * for the serial console without building a String. It can be overwritten by
+ * a custom implementation for enhanced logging.
  */
-void WIFIMANAGER::logMessage(String msg) {
-  Serial.print(msg);
+void WIFIMANAGER::logMessage(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  logWriteV(LOG_LEVEL_INFO, format, args);
+  va_end(args);
 }
 
 /**
@@ -58,17 +175,11 @@ void WIFIMANAGER::startBackgroundTask(String softApName, String softApPass) {
   loadFromNVS();
   tryConnect();
 
-  BaseType_t taskCreated = xTaskCreatePinnedToCore(
-    wifiTask,
-    "WifiManager",
-    4096,   // Stack size in words
-    this,   // Task input parameter
-    1,      // Priority of the task
-    &WifiCheckTask,  // Task handle.
-    0       // Core where the task should run
-  );
-
-  if (taskCreated != pdPASS) {
+  // priority, core and stack from TASK_PROFILES, see Scheduling.h
+  static ProfiledTask<TASK_WIFI> wifiTaskStack;
+  WifiCheckTask = wifiTaskStack.start(wifiTask, this);
+
+  if (WifiCheckTask == nullptr) {
     logMessage("[ERROR] WifiManager: Error creating background task\n");
   }
 }
@@ -85,7 +196,7 @@ WIFIMANAGER::WIFIMANAGER(const char * ns) {
   WiFi.onEvent([&](WiFiEvent_t event, WiFiEventInfo_t info) {
     logMessage("[WIFI] onEvent() AP mode started!\n");
     softApRunning = true;
-    deviceState = SOFT_AP;
+    setDeviceState(SOFT_AP);
 #if ESP_ARDUINO_VERSION_MAJOR >= 2
     }, ARDUINO_EVENT_WIFI_AP_START); // arduino-esp32 2.0.0 and later
 #else
@@ -94,7 +205,7 @@ WIFIMANAGER::WIFIMANAGER(const char * ns) {
   WiFi.onEvent([&](WiFiEvent_t event, WiFiEventInfo_t info) {
     logMessage("[WIFI] onEvent() AP mode stopped!\n");
     softApRunning = false;
-    deviceState = IDLE;
+    setDeviceState(IDLE);
 #if ESP_ARDUINO_VERSION_MAJOR >= 2
     }, ARDUINO_EVENT_WIFI_AP_STOP); // arduino-esp32 2.0.0 and later
 #else
@@ -173,7 +284,7 @@ bool WIFIMANAGER::loadFromNVS() {
         if (apName.length() > 0) {
           sprintf(tmpKey, "apPass%d", i);
           String apPass = preferences.getString(tmpKey);
-          logMessage(String("[WIFI] Load SSID '") + apName + "' to " + String(i+1) + ". slot.\n");
+          logMessage("[WIFI] Load SSID '%s' to %d. slot.\n", apName.c_str(), i+1);
           apList[i].apName = apName;
           apList[i].apPass = apPass;
           configuredSSIDs++;
@@ -235,7 +346,7 @@ bool WIFIMANAGER::addWifi(String apName, String apPass, bool updateNVS) {
 
   for(uint8_t i=0; i<WIFIMANAGER_MAX_APS; i++) {
     if (apList[i].apName == "") {
-      logMessage(String("[WIFI] Found unused slot Nr. ") + String(i) + " to store the new SSID '" + apName + "' credentials.\n");
+      logMessage("[WIFI] Found unused slot Nr. %d to store the new SSID '%s' credentials.\n", i, apName.c_str());
       apList[i].apName = apName;
       apList[i].apPass = apPass;
       configuredSSIDs++;
@@ -303,6 +414,175 @@ uint8_t WIFIMANAGER::getApEntry() {
   return 0;
 }
 
+// Discovery runs on its own task, a failed attempt is retried from loop()
+static const uint8_t SERVER_DISCOVERY_ATTEMPTS = 3;
+static const uint32_t SERVER_RETRY_DELAY_MS = 1500;
+static volatile uint8_t serverAttemptsLeft = 0;
+static volatile bool serverRetryScheduled = false;
+static volatile unsigned long serverRetryAt = 0;
+static bool serverRetrySkipCache = false; //access from wifiTask only
+
+// discoveryTask -> onServerDiscovered() -> websocketSetup()
+static void onServerDiscovered(const DiscoveryResult &result, void *) {
+  if (result.found) {
+    ws_server_ip = result.ip.toString();
+    LOG_I("[WIFI] Using server %s:%d (%s, %u ms)", ws_server_ip.c_str(), result.port,
+      discoverySourceName(result.source), (unsigned)result.elapsedMs);
+    serverAttemptsLeft = 0;
+    websocketSetup(ws_server_ip.c_str(), result.port, ws_path);
+    return;
+  }
+  if (serverAttemptsLeft > 0) {
+    LOG_I("[WIFI] Server discovery failed, %d attempts left", serverAttemptsLeft);
+    serverRetryAt = millis() + SERVER_RETRY_DELAY_MS;
+    serverRetryScheduled = true;
+    return;
+  }
+  LOG_I("[WIFI] Server discovery failed, cannot connect to server");
+}
+
+/**
+ * @brief Find the Elato server and hand it to the websocket, without waiting for it
+ * @param skipCache true to leave the cache out, e.g. when the cached server stopped answering
+ * @return true if discovery was started
+ *
+ * The cached server, the UDP beacon and mDNS are raced on the discovery task. A cached server
+ * that answers is used right away while the network sources only update the cache behind it.
+ */
+bool WIFIMANAGER::connectServer(bool skipCache) {
+  serverAttemptsLeft = SERVER_DISCOVERY_ATTEMPTS - 1;
+  serverRetryScheduled = false;
+  serverRetrySkipCache = skipCache;
+  if (!discoveryStart(!skipCache, onServerDiscovered, nullptr)) {
+    logMessage("[WIFI] Server discovery still running\n");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Connect to the access point of the last good association, without scanning
+ * @return true if the station is connected
+ *
+ * Uses the RTC copy after a deep sleep wake (including the IP lease while it is not due for
+ * renewal, so DHCP is skipped too) and the NVS copy otherwise. On failure the record is
+ * dropped and DHCP is restored, so the caller can fall back to a scan.
+ */
+bool WIFIMANAGER::tryFastConnect() {
+  FastConnectRecord record;
+  bool fromSleep = esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED && rtcFastConnect.magic == FAST_CONNECT_MAGIC;
+  if (fromSleep) {
+    record = rtcFastConnect;
+    if (record.leaseRenewAt <= (uint32_t)time(nullptr)) record.ip = 0;  // due for renewal, ask DHCP
+  } else {
+    if (!preferences.begin(NVS, true)) return false;
+    size_t read = preferences.getBytes("fastConnect", &record, sizeof(record));
+    preferences.end();
+    if (read != sizeof(record) || record.magic != FAST_CONNECT_MAGIC) return false;
+    record.ip = 0;  // the lease may be gone after a power cycle
+  }
+
+  if (record.apIndex >= WIFIMANAGER_MAX_APS || apList[record.apIndex].apName.length() == 0 ||
+      credentialsHash(apList[record.apIndex].apName, apList[record.apIndex].apPass) != record.credentialsHash) {
+    clearFastConnect();
+    return false;
+  }
+
+  const apCredentials_t &ap = apList[record.apIndex];
+  logMessage("[WIFI] Fast connect to %s (%02x:%02x:%02x:%02x:%02x:%02x, channel %d)%s\n", ap.apName.c_str(),
+    record.bssid[0], record.bssid[1], record.bssid[2], record.bssid[3], record.bssid[4], record.bssid[5],
+    record.channel, record.ip ? " with the previous lease" : "");
+
+  unsigned long start = millis();
+  WiFi.mode(WIFI_STA);
+  if (record.ip != 0) {
+    WiFi.config(IPAddress(record.ip), IPAddress(record.gateway), IPAddress(record.subnet), IPAddress(record.dns));
+  } else {
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);  // an earlier fast connect may have left its lease set
+  }
+  WiFi.begin(ap.apName.c_str(), ap.apPass.c_str(), record.channel, record.bssid);
+  wl_status_t status = (wl_status_t)WiFi.waitForConnectResult(FAST_CONNECT_TIMEOUT_MS);
+  if (status == WL_CONNECTED) {
+    logMessage("[WIFI] Fast connect successful after %lu ms\n", millis() - start);
+    // loop() hands the address back to DHCP when the reused lease is due for renewal
+    reusedLeaseRenewAt = record.ip ? record.leaseRenewAt : 0;
+    saveFastConnect(record.apIndex);
+    return true;
+  }
+
+  logMessage("[WIFI] Fast connect failed (%d), scanning instead\n", status);
+  reusedLeaseRenewAt = 0;
+  WiFi.disconnect();
+  WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);  // back to DHCP
+  clearFastConnect();
+  return false;
+}
+
+/**
+ * @brief Store the association that just succeeded
+ * @param apIndex Entry of apList that was used
+ *
+ * Only a lease DHCP handed out is stored. A reused one keeps the renewal time it came with,
+ * so a chain of wakes never stretches one lease past it.
+ */
+void WIFIMANAGER::saveFastConnect(uint8_t apIndex) {
+  FastConnectRecord record;
+  memset(&record, 0, sizeof(record));
+  record.magic = FAST_CONNECT_MAGIC;
+  record.credentialsHash = credentialsHash(apList[apIndex].apName, apList[apIndex].apPass);
+  record.apIndex = apIndex;
+  record.channel = WiFi.channel();
+  memcpy(record.bssid, WiFi.BSSID(), sizeof(record.bssid));
+  record.ip = (uint32_t)WiFi.localIP();
+  record.gateway = (uint32_t)WiFi.gatewayIP();
+  record.subnet = (uint32_t)WiFi.subnetMask();
+  record.dns = (uint32_t)WiFi.dnsIP(0);
+  uint32_t renewIn = dhcpRenewSeconds();
+  if (renewIn > 0) {
+    record.leaseRenewAt = (uint32_t)time(nullptr) + renewIn;
+  } else if (reusedLeaseRenewAt != 0 && rtcFastConnect.magic == FAST_CONNECT_MAGIC && rtcFastConnect.ip == record.ip) {
+    record.leaseRenewAt = reusedLeaseRenewAt;
+  } else {
+    record.ip = 0;
+  }
+
+  // flash is only written when the access point changed, not on every wake
+  bool sameAp = rtcFastConnect.magic == FAST_CONNECT_MAGIC && rtcFastConnect.apIndex == apIndex &&
+    rtcFastConnect.channel == record.channel && memcmp(rtcFastConnect.bssid, record.bssid, sizeof(record.bssid)) == 0 &&
+    rtcFastConnect.credentialsHash == record.credentialsHash;
+  rtcFastConnect = record;
+  if (sameAp) return;
+
+  if (preferences.begin(NVS, false)) {
+    record.ip = 0;
+    record.leaseRenewAt = 0;
+    preferences.putBytes("fastConnect", &record, sizeof(record));
+    preferences.end();
+  }
+}
+
+void WIFIMANAGER::clearFastConnect() {
+  rtcFastConnect.magic = 0;
+  if (preferences.begin(NVS, false)) {
+    preferences.remove("fastConnect");
+    preferences.end();
+  }
+}
+
+/**
+ * @brief The station got its connection, the rest of the bring up
+ * @return true if a server was found
+ */
+bool WIFIMANAGER::onStationConnected() {
+  logMessage("[WIFI] SSID   : %s\n", WiFi.SSID().c_str());
+  logMessage("[WIFI] IP     : %s\n", WiFi.localIP().toString().c_str());
+
+  // Cached server, UDP beacon and mDNS at once, websocketSetup() runs when one answers
+  bool started = connectServer(false);
+  stopSoftAP();
+  return started;
+}
+
 /**
  * @brief Background loop function running inside the task
  * @details regulary check if the connection is up&running, try to reconnect or create a fallback AP
@@ -313,6 +593,34 @@ void WIFIMANAGER::loop() {
     dnsServer.processNextRequest();
   }
   
+  serviceScan();
+
+  // the reused lease is due for renewal, which only a running DHCP client can do
+  if (reusedLeaseRenewAt != 0 && (uint32_t)time(nullptr) >= reusedLeaseRenewAt && WiFi.status() == WL_CONNECTED) {
+    reusedLeaseRenewAt = 0;
+    leaseSavePending = true;
+    logMessage("[WIFI] Reused lease for %s is due, asking DHCP\n", WiFi.localIP().toString().c_str());
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+  }
+  if (leaseSavePending && WiFi.status() == WL_CONNECTED && dhcpRenewSeconds() > 0) {
+    leaseSavePending = false;
+    saveFastConnect(rtcFastConnect.apIndex);
+  }
+
+  // networkTask gave up on the server in use, look for it again
+  if (serverRediscoveryScheduled && WiFi.status() == WL_CONNECTED && !discoveryRunning()) {
+    serverRediscoveryScheduled = false;
+    logMessage("[WIFI] Server %s stopped answering, discovering again\n", ws_server_ip.c_str());
+    connectServer(true);
+  }
+
+  // the last discovery found nothing
+  if (serverRetryScheduled && (long)(millis() - serverRetryAt) >= 0 && WiFi.status() == WL_CONNECTED && !discoveryRunning()) {
+    serverRetryScheduled = false;
+    serverAttemptsLeft = serverAttemptsLeft - 1;
+    discoveryStart(!serverRetrySkipCache, onServerDiscovered, nullptr);
+  }
+
   if (millis() - lastWifiCheckMillis < intervalWifiCheckMillis) return;
   lastWifiCheckMillis = millis();
 
@@ -320,15 +628,15 @@ void WIFIMANAGER::loop() {
     // Check if we are connected to a well known SSID
     for(uint8_t i=0; i<WIFIMANAGER_MAX_APS; i++) {
       if (WiFi.SSID() == apList[i].apName) {
-        logMessage(String("[WIFI][STATUS] Connected to known SSID: '") + WiFi.SSID() + "' with IP " + WiFi.localIP().toString() + "\n");
+        logMessage("[WIFI][STATUS] Connected to known SSID: '%s' with IP %s\n", WiFi.SSID().c_str(), WiFi.localIP().toString().c_str());
         return;
       }
     }
     // looks like we are connected to something else, strange!?
-    logMessage("[WIFI] We are connected to an unknown SSID ignoring. Connected to: " + WiFi.SSID() + "\n");
+    logMessage("[WIFI] We are connected to an unknown SSID ignoring. Connected to: %s\n", WiFi.SSID().c_str());
   } else {
     if (softApRunning) {
-      logMessage("[WIFI] Not trying to connect to a known SSID. SoftAP has " + String(WiFi.softAPgetStationNum()) + " clients connected!\n");
+      logMessage("[WIFI] Not trying to connect to a known SSID. SoftAP has %d clients connected!\n", WiFi.softAPgetStationNum());
     } else {
       // let's try to connect to some WiFi in Range
       if (!tryConnect()) {
@@ -340,7 +648,7 @@ void WIFIMANAGER::loop() {
 
   if (softApRunning && millis() - startApTimeMillis > timeoutApMillis) {
     if (WiFi.softAPgetStationNum() > 0) {
-      logMessage("[WIFI] SoftAP has " + String(WiFi.softAPgetStationNum()) + " clients connected!\n");
+      logMessage("[WIFI] SoftAP has %d clients connected!\n", WiFi.softAPgetStationNum());
       startApTimeMillis = millis(); // reset timeout as someone is connected
       return;
     }
@@ -349,6 +657,65 @@ void WIFIMANAGER::loop() {
     delay(100);
   }
 }
+/**
+ * @brief Ask for a background scan
+ * @return true if a scan was queued, false if one is queued or running already or the cached results are recent enough
+ */
+bool WIFIMANAGER::requestScan() {
+  // a second request would make serviceScan() start another full scan right after this one
+  if (scanRunning || scanRequested) {
+    return false;
+  }
+  if (scanId > 0 && millis() - scanFinishedAt < SCAN_MIN_INTERVAL_MS) {
+    return false;
+  }
+  scanRequested = true;
+  return true;
+}
+
+/**
+ * @brief Start a requested scan without waiting, and store its results once it is done
+ */
+void WIFIMANAGER::serviceScan() {
+  if (scanRunning) {
+    int16_t found = WiFi.scanComplete();
+    if (found == WIFI_SCAN_RUNNING) return;
+    scanRunning = false;
+    if (found < 0) {
+      logMessage("[WIFI] Background scan failed\n");
+      return;
+    }
+    storeScanResults(found);
+    logMessage("[WIFI] Background scan found %d networks\n", found);
+    return;
+  }
+  if (!scanRequested) return;
+  scanRequested = false;
+  if (WiFi.scanNetworks(true, true, false, scanDwellMs()) == WIFI_SCAN_FAILED) {
+    logMessage("[WIFI] Unable to start a background scan\n");
+    return;
+  }
+  scanRunning = true;
+}
+
+/**
+ * @brief Scan and wait for the results, they go to the cache as well
+ * @return true if at least one network was found
+ */
+bool WIFIMANAGER::scanNow() {
+  if (scanRunning) {
+    // let the background scan finish instead of starting another one
+    while (WiFi.scanComplete() == WIFI_SCAN_RUNNING) delay(10);
+    scanRunning = false;
+  }
+  int16_t found = WiFi.scanNetworks(false, true, false, scanDwellMs());
+  if (found < 0) {
+    return false;
+  }
+  storeScanResults(found);
+  return found > 0;
+}
+
 /**
  * @brief Try to connect to one of the configured SSIDs (if available).
  * @details If more than 2 SSIDs configured, scan for available WIFIs and connect to the strongest
@@ -363,51 +730,56 @@ bool WIFIMANAGER::tryConnect() {
   }
 
   if (softApRunning) {
-    logMessage("[WIFI] Not trying to connect. SoftAP has " + String(WiFi.softAPgetStationNum()) + " clients connected!\n");
+    logMessage("[WIFI] Not trying to connect. SoftAP has %d clients connected!\n", WiFi.softAPgetStationNum());
     return false;
   }
 
+  // Straight back to the last access point, the scan below only runs when that fails
+  if (tryFastConnect()) {
+    return onStationConnected();
+  }
+
   int choosenAp = INT_MIN;
   if (configuredSSIDs == 1) {
     // only one configured SSID, skip scanning and try to connect to this specific one.
     choosenAp = getApEntry();
   } else {
     WiFi.mode(WIFI_STA);
-    int8_t scanResult = WiFi.scanNetworks(false, true);
-    if(scanResult <= 0) {
+    // a recent background scan (e.g. from the provisioning page) saves another one
+    if (scanId == 0 || millis() - scanFinishedAt > SCAN_MAX_AGE_MS) {
+      scanNow();
+    }
+    static ScanEntry entries[SCAN_CACHE_MAX]; //access from wifiTask only
+    uint32_t id;
+    unsigned long finishedAt;
+    uint8_t scanResult = copyScanResults(entries, id, finishedAt);
+    if(scanResult == 0) {
       logMessage("[WIFI] Unable to find WIFI networks in range to this device!\n");
       return false;
     }
-    logMessage(String("[WIFI] Found ") + String(scanResult) + " networks in range\n");
+    logMessage("[WIFI] Found %d networks in range (scan %u ms old)\n", scanResult, (unsigned)(millis() - finishedAt));
     int choosenRssi = INT_MIN;  // we want to select the strongest signal with the highest priority if we have multiple SSIDs available
-    for(int8_t x = 0; x < scanResult; ++x) {
-      String ssid;
-      uint8_t encryptionType;
-      int32_t rssi;
-      uint8_t* bssid;
-      int32_t channel;
-      WiFi.getNetworkInfo(x, ssid, encryptionType, rssi, bssid, channel);
+    for(uint8_t x = 0; x < scanResult; ++x) {
+      const ScanEntry &network = entries[x];
       for(uint8_t i=0; i<WIFIMANAGER_MAX_APS; i++) {
-        if (apList[i].apName.length() == 0 || apList[i].apName != ssid) continue;
+        if (apList[i].apName.length() == 0 || apList[i].apName != network.ssid) continue;
 
-        if (rssi > choosenRssi) {
-          if(encryptionType == WIFI_AUTH_OPEN || apList[i].apPass.length() > 0) { // open wifi or we do know a password
+        if (network.rssi > choosenRssi) {
+          if(network.encryptionType == WIFI_AUTH_OPEN || apList[i].apPass.length() > 0) { // open wifi or we do know a password
             choosenAp = i;
-            choosenRssi = rssi;
+            choosenRssi = network.rssi;
           }
         } // else lower wifi signal
       }
     }
-    WiFi.scanDelete();
   }
 
   if (choosenAp == INT_MIN) {
     logMessage("[WIFI] Unable to find an SSID to connect to!\n");
     return false;
   } else {
-    logMessage(String("[WIFI] Trying to connect to SSID ") + apList[choosenAp].apName 
-      + " with password " + (apList[choosenAp].apPass.length() > 0 ? "'***'" : "''") + "\n"
-    );
+    logMessage("[WIFI] Trying to connect to SSID %s with password %s\n", apList[choosenAp].apName.c_str(),
+      apList[choosenAp].apPass.length() > 0 ? "'***'" : "''");
 
     WiFi.begin(apList[choosenAp].apName.c_str(), apList[choosenAp].apPass.c_str());
     wl_status_t status = (wl_status_t)WiFi.waitForConnectResult(5000UL);
@@ -430,33 +802,8 @@ bool WIFIMANAGER::tryConnect() {
         break;
       case WL_CONNECTED: // 3
         logMessage("[WIFI] Connection successful\n");
-        logMessage("[WIFI] SSID   : " + WiFi.SSID() + "\n");
-        logMessage("[WIFI] IP     : " + WiFi.localIP().toString() + "\n");
-        
-        // Discover Elato server via mDNS/UDP before connecting
-        {
-          uint16_t discoveredPort = ws_port;
-          bool found = false;
-          for (int attempt = 1; attempt <= 3; attempt++) {
-            if (discoverElatoServer(ws_server_ip, discoveredPort)) {
-              found = true;
-              break;
-            }
-            logMessage("[WIFI] Server discovery failed (attempt " + String(attempt) + "/3)\n");
-            delay(1500);
-          }
-          if (found) {
-            logMessage("[WIFI] Using discovered server: " + ws_server_ip + ":" + String(discoveredPort) + "\n");
-            websocketSetup(ws_server_ip.c_str(), discoveredPort, ws_path);
-          } else {
-            logMessage("[WIFI] Server discovery failed, cannot connect to server\n");
-            // Don't call websocketSetup - no server found
-            stopSoftAP();
-            return false;
-          }
-        }
-        stopSoftAP();
-        return true;
+        saveFastConnect(choosenAp);
+        return onStationConnected();
       case WL_CONNECT_FAILED:
         logMessage("[WIFI] Connecting failed (4): Unknown reason\n");
         break;
@@ -470,7 +817,7 @@ bool WIFIMANAGER::tryConnect() {
         logMessage("[WIFI] Connecting failed (7): No Wifi shield found\n");
         break;
       default:
-        logMessage("[WIFI] Connecting failed (" + String(status) + "): Unknown status code\n");
+        logMessage("[WIFI] Connecting failed (%d): Unknown status code\n", status);
         break;
     }
   }
@@ -498,13 +845,13 @@ bool WIFIMANAGER::runSoftAP(String apName, String apPass) {
   startApTimeMillis = millis();
 
   if (this->softApName == "") this->softApName = "ESP_" + String((uint32_t)ESP.getEfuseMac());
-  logMessage("[WIFI] Starting configuration portal on AP SSID " + this->softApName + "\n");
+  logMessage("[WIFI] Starting configuration portal on AP SSID %s\n", this->softApName.c_str());
 
   WiFi.mode(WIFI_AP);
   bool state = WiFi.softAP(this->softApName.c_str(), (this->softApPass.length() ? this->softApPass.c_str() : NULL));
   if (state) {
     IPAddress IP = WiFi.softAPIP();
-    logMessage("[WIFI] AP created. My IP is: " + IP.toString() + "\n");
+    logMessage("[WIFI] AP created. My IP is: %s\n", IP.toString().c_str());
     
     // Start DNS server for captive portal - redirect all requests to our IP
     dnsServer.start(53, "*", IP);
@@ -664,7 +1011,7 @@ void WIFIMANAGER::attachWebServer(WebServer * srv) {
     message += "path=";
     message += webServer->arg("path");
     message += '\n';
-    logMessage(message);
+    logMessage("%s", message.c_str());
   });
 #endif
 
@@ -815,6 +1162,43 @@ void WIFIMANAGER::attachWebServer(WebServer * srv) {
 #endif
   });
 
+// before "/scan", which would match "/scan/results" as well
+#if ASYNC_WEBSERVER == true
+  webServer->on((apiPrefix + "/scan/results").c_str(), HTTP_GET, [&](AsyncWebServerRequest *request) {
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+#else
+  webServer->on((apiPrefix + "/scan/results").c_str(), HTTP_GET, [&]() {
+    String buffer;
+#endif
+    JsonDocument jsonDoc;
+
+    static ScanEntry entries[SCAN_CACHE_MAX]; //access from the webserver task only
+    uint32_t id;
+    unsigned long finishedAt;
+    uint8_t count = copyScanResults(entries, id, finishedAt);
+    jsonDoc["scan_id"] = id;
+    jsonDoc["age_ms"] = id > 0 ? millis() - finishedAt : 0;
+    jsonDoc["scanning"] = scanRunning || scanRequested;
+    JsonArray networks = jsonDoc["networks"].to<JsonArray>();
+    for (uint8_t i = 0; i < count; i++) {
+      JsonObject wifiNet = networks.add<JsonObject>();
+      wifiNet["ssid"] = entries[i].ssid;
+      wifiNet["encryptionType"] = entries[i].encryptionType;
+      wifiNet["rssi"] = entries[i].rssi;
+      wifiNet["channel"] = entries[i].channel;
+    }
+#if ASYNC_WEBSERVER == true
+    serializeJson(jsonDoc, *response);
+    response->setCode(200);
+    response->setContentLength(measureJson(jsonDoc));
+    request->send(response);
+#else
+    // Improve me: not that efficient without the stream response
+    serializeJson(jsonDoc, buffer);
+    webServer->send(200, "application/json", buffer);
+#endif
+  });
+
 #if ASYNC_WEBSERVER == true
   webServer->on((apiPrefix + "/scan").c_str(), HTTP_GET, [&](AsyncWebServerRequest *request) {
     AsyncResponseStream *response = request->beginResponseStream("application/json");
@@ -824,30 +1208,10 @@ void WIFIMANAGER::attachWebServer(WebServer * srv) {
 #endif
     JsonDocument jsonDoc;
 
-    int scanResult;
-    String ssid;
-    uint8_t encryptionType;
-    int32_t rssi;
-    uint8_t* bssid;
-    int32_t channel;
-
-    scanResult = WiFi.scanComplete();
-    if (scanResult == WIFI_SCAN_FAILED) {
-      scanResult = WiFi.scanNetworks(true, true);   // FIXME: scanNetworks is disconnecting clients!
-      jsonDoc["status"] = "scanning";
-    } else if (scanResult > 0) {
-      for (int8_t i = 0; i < scanResult; i++) {
-        WiFi.getNetworkInfo(i, ssid, encryptionType, rssi, bssid, channel);
-
-        JsonObject wifiNet = jsonDoc.createNestedObject();
-        wifiNet["ssid"] = ssid;
-        wifiNet["encryptionType"] = encryptionType;
-        wifiNet["rssi"] = rssi;
-        wifiNet["channel"] = channel;
-        yield();
-      }
-      WiFi.scanDelete();
-    }
+    // wifiTask runs the scan, the results are collected from /scan/results once scan_id moves
+    bool scanning = requestScan() || scanRunning || scanRequested;
+    jsonDoc["status"] = scanning ? "scanning" : "cached";
+    jsonDoc["scan_id"] = scanning ? scanId + 1 : scanId;
 #if ASYNC_WEBSERVER == true
     serializeJson(jsonDoc, *response);
     response->setCode(200);
@@ -899,408 +1263,39 @@ void WIFIMANAGER::attachWebServer(WebServer * srv) {
 }
 
 /**
- * @brief Attach the WebServer to the WifiManager to register the RESTful API
- * @param srv WebServer object
+ * @brief Serve the gzipped UI assets embedded by scripts/embed_ui.py
+ *
+ * The page is revalidated on every load (Cache-Control: no-cache) and answered with 304 when
+ * the browser's ETag still matches, so a phone that opens the captive portal again gets
+ * a few bytes instead of the whole page.
  */
 void WIFIMANAGER::attachUI() {
-
-#if ASYNC_WEBSERVER == true
-  webServer->on((uiPrefix).c_str(), HTTP_GET, [](AsyncWebServerRequest* request) {
-#else
-  webServer->on((uiPrefix).c_str(), HTTP_GET, [&]() {
-#endif
-
-    String html = R"html(
-<!DOCTYPE html>
-<html lang="en">
-<head>
-    <meta charset="UTF-8">
-    <meta name="viewport" content="width=device-width, initial-scale=1.0">
-    <title>YOUR ELATO 😊</title>
-    <style>
-        :root {
-            --primary-color: #2563eb;
-            --bg-color: #f8fafc;
-            --card-bg: #ffffff;
-            --text-color: #1e293b;
-            --border-color: #e2e8f0;
-        }
-
-        body {
-            font-family: system-ui, -apple-system, sans-serif;
-            background: var(--bg-color);
-            color: var(--text-color);
-            margin: 0;
-            padding: 16px;
-            line-height: 1.5;
-        }
-
-        .container {
-            max-width: 600px;
-            margin: 0 auto;
-        }
-
-        .card {
-            background: var(--card-bg);
-            border-radius: 8px;
-            padding: 16px;
-            margin-bottom: 16px;
-            box-shadow: 0 1px 3px rgba(0,0,0,0.1);
-            border: 1px solid var(--border-color);
-        }
-
-        h1, h2 {
-            margin: 0 0 16px 0;
-            color: var(--text-color);
-        }
-
-        .network-list {
-            list-style: none;
-            padding: 0;
-            margin: 0;
-        }
-
-        .network-item {
-            display: flex;
-            align-items: center;
-            padding: 12px;
-            border-bottom: 1px solid var(--border-color);
-            cursor: pointer;
-            transition: background-color 0.2s;
-        }
-
-        .network-item:last-child {
-            border-bottom: none;
-        }
-
-        .network-item:hover {
-            background-color: var(--bg-color);
-        }
-
-        .network-info {
-            flex-grow: 1;
-        }
-
-        .network-info div {
-          float: left;
-          width: 70%;
-        }
-
-        .network-info button {
-          float: right;
-          width: 30%;
-        }
-
-        .ssid {
-            font-weight: 500;
-            margin-bottom: 4px;
-        }
-
-        .signal {
-            font-size: 0.875rem;
-            color: #64748b;
-        }
-
-        button {
-            background: var(--primary-color);
-            color: white;
-            border: none;
-            padding: 8px 16px;
-            border-radius: 4px;
-            cursor: pointer;
-            font-size: 0.875rem;
-            transition: opacity 0.2s;
-        }
-
-        button:hover {
-            opacity: 0.9;
-        }
-
-        button:disabled {
-            opacity: 0.5;
-            cursor: not-allowed;
-        }
-
-        .status {
-            padding: 8px;
-            border-radius: 4px;
-            margin-bottom: 16px;
-            display: none;
-        }
-
-        .status.error {
-            background: #fee2e2;
-            color: #991b1b;
-            display: block;
-        }
-
-        .status.success {
-            background: #dcfce7;
-            color: #166534;
-            display: block;
-        }
-
-        .status.info {
-            background: #e0f2fe;
-            color: #075985;
-            display: block;
-        }
-
-        .modal {
-            display: none;
-            position: fixed;
-            top: 0;
-            left: 0;
-            width: 100%;
-            height: 100%;
-            background: rgba(0,0,0,0.5);
-            align-items: center;
-            justify-content: center;
-        }
-
-        .modal-content {
-            background: var(--card-bg);
-            padding: 24px;
-            border-radius: 8px;
-            width: 90%;
-            max-width: 400px;
-        }
-
-        input {
-            width: 100%;
-            padding: 8px;
-            margin: 8px 0 16px;
-            border: 1px solid var(--border-color);
-            border-radius: 4px;
-            box-sizing: border-box;
-            font-size: 16px;
-        }
-
-        .button-group {
-            display: flex;
-            gap: 8px;
-            justify-content: flex-end;
-        }
-
-        .button-secondary {
-            background: var(--bg-color);
-            color: var(--text-color);
-            border: 1px solid var(--border-color);
-        }
-
-        .saved-networks {
-            margin-top: 8px;
-            padding-top: 8px;
-            border-top: 1px solid var(--border-color);
-        }
-    </style>
-</head>
-<body>
-    <div class="container">
-        <div class="card">
-            <h1>YOUR ELATO DEVICE 😊</h1>
-            <div id="status"></div>
-            <button onclick="scanNetworks()">Scan for Networks</button>
-            <button onclick="showConnectModal()">Manual Connect</button>
-        </div>
-
-        <div class="card">
-            <h2>✅ Saved Networks</h2>
-            <div id="savedNetworks" class="network-list"></div>
-        </div>
-
-        <div class="card">
-            <h2>🛜 Available Networks</h2>
-            <div id="networkList" class="network-list"></div>
-        </div>
-    </div>
-
-    <div id="connectModal" class="modal">
-        <div class="modal-content">
-            <h2>Connect to Network</h2>
-            <form id="connectForm" onsubmit="connectToNetwork(event)">
-                <label for="apName">Network Name:</label>
-                <input type="text" id="apName" required>
-                
-                <label for="apPass">Password:</label>
-                <input type="password" id="apPass" required>
-                
-                <div class="button-group">
-                    <button type="button" class="button-secondary" onclick="closeModal()">Cancel</button>
-                    <button type="submit">Connect</button>
-                </div>
-            </form>
-        </div>
-    </div>
-
-    <script>
-        const API_BASE = '/api';
-        let networks = {};
-
-        // Load saved networks when page loads
-        window.addEventListener('load', () => {
-            loadSavedNetworks();
-            scanNetworks();
-        });
-
-        async function loadSavedNetworks() {
-            try {
-                const response = await fetch(`${API_BASE}/wifi/configlist`);
-                if (!response.ok) throw new Error('Failed to fetch saved networks');
-                
-                const savedNetworks = await response.json();
-                displaySavedNetworks(savedNetworks);
-            } catch (error) {
-                showStatus('Failed to load saved networks: ' + error.message, 'error');
-            }
-        }
-
-        function displaySavedNetworks(networks) {
-            const networkList = document.getElementById('savedNetworks');
-            const networkArray = Object.values(networks);
-            
-            if (networkArray.length === 0) {
-                networkList.innerHTML = '<div class="network-item">No saved networks</div>';
-                return;
-            }
-
-            networkList.innerHTML = networkArray.map(network => `
-                <div class="network-item">
-                    <div class="network-info">
-                        <div class="ssid">${network.apName}</div>
-                        <button onclick="deleteNetwork('${network.id}')">🗑️ Remove</button>
-                    </div>
-                </div>
-            `).join('');
-        }
-
-        async function scanNetworks() {
-            try {
-                showStatus('Scanning for networks...', 'info');
-                const response = await fetch(`${API_BASE}/wifi/scan`);
-                if (!response.ok) throw new Error('Network scan failed');
-                
-                // Wait 5 seconds for the scan to complete
-                await new Promise(resolve => setTimeout(resolve, 5000));
-                
-                const scanResponse = await fetch(`${API_BASE}/wifi/scan/results`);
-                if (!scanResponse.ok) throw new Error('Failed to fetch scan results');
-                
-                networks = await scanResponse.json();
-                displayNetworks(networks);
-                showStatus('Networks found', 'success');
-            } catch (error) {
-                showStatus(error.message, 'error');
-            }
-        }
-
-        function displayNetworks(networks) {
-            const networkList = document.getElementById('networkList');
-            const networkArray = Object.values(networks || {})
-              .filter(network => network && network.ssid && network.ssid.length > 0);
-            
-            if (networkArray.length === 0) {
-                networkList.innerHTML = '<div class="network-item">No networks found</div>';
-                return;
-            }
-
-            // Sort networks by RSSI
-            networkArray.sort((a, b) => b.rssi - a.rssi);
-
-            networkList.innerHTML = networkArray
-                .map(network => `
-                    <div class="network-item" onclick="showConnectModal('${network.ssid}')">
-                        <div class="network-info">
-                            <div class="ssid">${network.ssid}</div>
-                            <div class="signal">
-                                Signal: ${getSignalStrength(network.rssi)}
-                                ${network.encryptionType > 0 ? '🔒' : ''}
-                            </div>
-                        </div>
-                    </div>
-                `).join('');
-        }
-
-        function getSignalStrength(rssi) {
-            if (rssi >= -50) return 'Excellent';
-            if (rssi >= -60) return 'Very Good';
-            if (rssi >= -70) return 'Good';
-            if (rssi >= -80) return 'Fair';
-            return 'Poor';
-        }
-
-        function showConnectModal(apName = '') {
-            document.getElementById('apName').value = apName;
-            document.getElementById('apName').readOnly = !!apName;
-            document.getElementById('apPass').value = '';
-            document.getElementById('connectModal').style.display = 'flex';
-        }
-
-        function closeModal() {
-            document.getElementById('connectModal').style.display = 'none';
-        }
-
-        async function deleteNetwork(deleteId) {
-            try {
-                const response = await fetch(`${API_BASE}/wifi/id`, {
-                    method: 'DELETE',
-                    headers: {
-                        'Content-Type': 'application/json',
-                    },
-                    body: JSON.stringify({ id: deleteId }),
-                });
-                
-                if (!response.ok) throw new Error(JSON.stringify(response));
-                
-                showStatus('Network deleted successfully', 'success');
-                await loadSavedNetworks(); // Refresh the list
-            } catch (error) {
-                showStatus('Failed to delete network: ' + error.message, 'error');
-            }
-        }
-
-        async function connectToNetwork(event) {
-            event.preventDefault();
-            const apName = document.getElementById('apName').value;
-            const apPass = document.getElementById('apPass').value;
-
-            try {
-                showStatus('Connecting to network...', 'info');
-                const response = await fetch(`${API_BASE}/wifi/add`, {
-                    method: 'POST',
-                    headers: {
-                        'Content-Type': 'application/json',
-                    },
-                    body: JSON.stringify({ apName, apPass }),
-                });
-
-                if (!response.ok) throw new Error('Connection failed');
-
-                closeModal();
-                showStatus('Successfully connected!', 'success');
-                
-                // Refresh saved networks list
-                await loadSavedNetworks();
-            } catch (error) {
-                showStatus(error.message, 'error');
-            }
-        }
-
-        function showStatus(message, type) {
-            const statusElement = document.getElementById('status');
-            statusElement.innerHTML = message;
-            statusElement.className = `status ${type}`;
-        }
-    </script>
-</body>
-</html>
-)html";
-
+  for (const UiAsset &asset : UI_ASSETS) {
 #if ASYNC_WEBSERVER == true
-    request->send(200, "text/html", html);
+    webServer->on((uiPrefix + asset.path).c_str(), HTTP_GET, [&asset](AsyncWebServerRequest* request) {
+      if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == asset.etag) {
+        AsyncWebServerResponse *response = request->beginResponse(304);
+        response->addHeader("ETag", asset.etag);
+        request->send(response);
+        return;
+      }
+      AsyncWebServerResponse *response = request->beginResponse(200, asset.contentType, asset.data, asset.length);
+      response->addHeader("Content-Encoding", "gzip");
+      response->addHeader("Cache-Control", "no-cache");
+      response->addHeader("ETag", asset.etag);
+      request->send(response);
+    });
 #else
-    webServer->send(200, "text/html", html);
+    webServer->on((uiPrefix + asset.path).c_str(), HTTP_GET, [this, &asset]() {
+      webServer->sendHeader("Cache-Control", "no-cache");
+      webServer->sendHeader("ETag", asset.etag);
+      if (webServer->header("If-None-Match") == asset.etag) {
+        webServer->send(304);
+        return;
+      }
+      webServer->sendHeader("Content-Encoding", "gzip");
+      webServer->send_P(200, asset.contentType, (const char *)asset.data, asset.length);
+    });
 #endif
-
-  });
+  }
 }
\ No newline at end of file
@@ -70,9 +70,26 @@ class WIFIMANAGER {
 
     // Get id of the first non empty entry
     uint8_t getApEntry();
+
+    // Cached server or discovery, then websocketSetup()
+    bool connectServer(bool skipCache);
+
+    // Reconnect to the last good BSSID/channel (and IP lease after deep sleep) without a scan
+    bool tryFastConnect();
+    // Remember the association that just succeeded for apList[apIndex]
+    void saveFastConnect(uint8_t apIndex);
+    void clearFastConnect();
+
+    // Station is up: find the server, close the SoftAP
+    bool onStationConnected();
+
+    // wifiTask: start the requested background scan, and collect its results when done
+    void serviceScan();
+    // wifiTask: scan now and wait for it, used by tryConnect() when the cache is too old
+    bool scanNow();
     
-    // Print a log message to Serial, can be overwritten
-    virtual void logMessage(String msg);
+    // Queue a printf style log message for Serial, can be overwritten
+    virtual void logMessage(const char *format, ...) __attribute__((format(printf, 2, 3)));
 
   public:
     // We let the loop run as as Task
@@ -111,6 +128,9 @@ class WIFIMANAGER {
     // Try each known SSID and connect until none is left or one is connected.
     bool tryConnect();
 
+    // Any task: ask wifiTask for a fresh scan, false if one is pending or the cache is recent enough already
+    bool requestScan();
+
     // Check if a SSID is stored in the config
     bool configAvailable();
 
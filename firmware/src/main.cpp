@@ -4,6 +4,12 @@
 #include "Config.h"
 #include "SPIFFS.h"
 #include "WifiManager.h"
+#include "Log.h"
+#include "Memory.h"
+#include "Doze.h"
+#include "Ota.h"
+#include "Prompts.h"
+#include "Scheduling.h"
 #include <driver/touch_sensor.h>
 #include "Button.h"
 #include "soc/soc.h"
@@ -20,45 +26,54 @@ AsyncWebServer webServer(80);
 WIFIMANAGER WifiManager;
 esp_err_t getErr = ESP_OK;
 
+// TASK STACKS (static, priority, core and size come from TASK_PROFILES, see Scheduling.h)
+static ProfiledTask<TASK_LED> ledTaskStack;
+static ProfiledTask<TASK_SPEAKER> speakerTaskStack;
+static ProfiledTask<TASK_MIC> micTaskStack;
+static ProfiledTask<TASK_NETWORK> networkTaskStack;
+#ifdef TOUCH_MODE
+static ProfiledTask<TASK_TOUCH> touchTaskStack;
+#endif
+
+static const unsigned long MEMORY_REPORT_INTERVAL_MS = 5 * 60 * 1000;
+
 
 // Main Thread -> onButtonLongPressUpEventCb -> enterSleep()
 // Main Thread -> onButtonDoubleClickCb -> enterSleep()
 // Touch Task -> touchTask -> enterSleep()
 // Main Thread -> loop() (inactivity timeout) -> enterSleep()
+// (shorter idle periods only doze, see Doze.h)
 void enterSleep()
 {
-    Serial.println("Going to sleep...");
+    LOG_I("Going to sleep...");
     
     // First, change device state to prevent any new data processing
-    deviceState = SLEEP;
+    setDeviceState(SLEEP);
 
     scheduleListeningRestart = false;
     i2sOutputFlushScheduled = true;
     i2sInputFlushScheduled = true;
     vTaskDelay(10);  //let all tasks accept state
 
-    xSemaphoreTake(wsMutex, portMAX_DELAY);
-
     // Stop audio tasks first
     i2s_stop(I2S_PORT_IN);
     i2s_stop(I2S_PORT_OUT);
 
-    // Properly disconnect WebSocket and wait for it to complete
-    if (webSocket.isConnected()) {
-        webSocket.disconnect();
-        // Give some time for the disconnect to process
-        delay(100);
+    // Properly disconnect WebSocket (owned by networkTask) and wait for it to complete
+    wsDisconnectScheduled = true;
+    wakeNetworkTask();
+    unsigned long disconnectStart = millis();
+    while (wsDisconnectScheduled && millis() - disconnectStart < 500) {
+        delay(10);
     }
-
-    xSemaphoreGive(wsMutex);
     delay(100);
     
     // Stop all tasks that might be using I2S or other peripherals
     i2s_driver_uninstall(I2S_PORT_IN);
     i2s_driver_uninstall(I2S_PORT_OUT);
     
-    // Flush any remaining serial output
-    Serial.flush();
+    // Flush any remaining serial output, including the deferred log
+    logFlush();
 
     #ifdef TOUCH_MODE
         touch_pad_intr_disable(TOUCH_PAD_INTR_MASK_ALL);
@@ -85,30 +100,39 @@ void printOutESP32Error(esp_err_t err)
     switch (err)
     {
     case ESP_OK:
-        Serial.println("ESP_OK no errors");
+        LOG_I("ESP_OK no errors");
         break;
     case ESP_ERR_INVALID_ARG:
-        Serial.println("ESP_ERR_INVALID_ARG if the selected GPIO is not an RTC GPIO, or the mode is invalid");
+        LOG_E("ESP_ERR_INVALID_ARG if the selected GPIO is not an RTC GPIO, or the mode is invalid");
         break;
     case ESP_ERR_INVALID_STATE:
-        Serial.println("ESP_ERR_INVALID_STATE if wakeup triggers conflict or wireless not stopped");
+        LOG_E("ESP_ERR_INVALID_STATE if wakeup triggers conflict or wireless not stopped");
         break;
     default:
-        Serial.printf("Unknown error code: %d\n", err);
+        LOG_E("Unknown error code: %d", err);
         break;
     }
 }
 
 static void onButtonLongPressUpEventCb(void *button_handle, void *usr_data)
 {
-    Serial.println("Button long press end");
+    LOG_I("Button long press end");
     delay(10);
     sleepRequested = true;
 }
 
+static void onButtonPressDownCb(void *button_handle, void *usr_data)
+{
+    if (dozing()) {
+        LOG_I("Button press - Waking up to listen...");
+        exitDoze(true);
+        promptScheduleWake();
+    }
+}
+
 static void onButtonDoubleClickCb(void *button_handle, void *usr_data)
 {
-    Serial.println("Button double click");
+    LOG_I("Button double click");
     delay(10);
     sleepRequested = true;
 }
@@ -120,6 +144,63 @@ void getAuthTokenFromNVS()
     preferences.end();
 }
 
+// /api/ota takes the same bearer token the device uses towards the server
+static bool otaRequestAuthorized(AsyncWebServerRequest *request)
+{
+    if (authTokenGlobal.length() == 0 || !request->hasHeader("Authorization")) {
+        return false;
+    }
+    const String &value = request->getHeader("Authorization")->value();
+    return value.startsWith("Bearer ") && strcmp(value.c_str() + 7, authTokenGlobal.c_str()) == 0;
+}
+
+static size_t otaHeaderValue(AsyncWebServerRequest *request, const char *name)
+{
+    return request->hasHeader(name) ? (size_t)request->getHeader(name)->value().toInt() : 0;
+}
+
+static bool httpOtaFailed = false; //access from async_tcp only
+
+// async_tcp -> onOtaBody()
+// the body is the image from X-OTA-Offset on, written chunk by chunk as it arrives
+static void onOtaBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+{
+    if (!otaRequestAuthorized(request)) {
+        return;
+    }
+    size_t offset = otaHeaderValue(request, "X-OTA-Offset");
+    if (index == 0) {
+        const char *sha = request->hasHeader("X-OTA-SHA256") ? request->getHeader("X-OTA-SHA256")->value().c_str() : "";
+        httpOtaFailed = !otaBegin(OTA_SOURCE_HTTP, otaHeaderValue(request, "X-OTA-Size"), sha, offset);
+    }
+    if (httpOtaFailed) {
+        return;
+    }
+    httpOtaFailed = !otaWrite(OTA_SOURCE_HTTP, offset + index, data, len);
+    if (!httpOtaFailed && index + len == total && otaReceived() == otaHeaderValue(request, "X-OTA-Size")) {
+        httpOtaFailed = !otaFinish(OTA_SOURCE_HTTP);
+    }
+}
+
+// Connectivity check URLs of Android, iOS/macOS, Windows and Firefox. Answering them with
+// a redirect is what makes a phone open the portal on its own.
+static const char *const CAPTIVE_PROBES[] = {
+    "/generate_204", "/gen_204",                          // Android, Chrome
+    "/hotspot-detect.html", "/library/test/success.html", // iOS, macOS
+    "/connecttest.txt", "/ncsi.txt", "/redirect",         // Windows
+    "/success.txt", "/canonical.html",                    // Firefox
+};
+
+// async_tcp -> redirectToPortal()
+// the address the client reached us on, so the redirect works on any SoftAP IP
+static void redirectToPortal(AsyncWebServerRequest *request)
+{
+    IPAddress ip = request->client()->localIP();
+    char portalUrl[32];
+    snprintf(portalUrl, sizeof(portalUrl), "http://%u.%u.%u.%u/wifi", ip[0], ip[1], ip[2], ip[3]);
+    request->redirect(portalUrl);
+}
+
 void setupWiFi()
 {
     WifiManager.startBackgroundTask("ELATO");  // Run the background task to take care of our Wifi
@@ -132,21 +213,61 @@ void setupWiFi()
         request->redirect("/wifi");
     });
     
+    // Turn latency records and audio counters, see Metrics.h
+    webServer.on("/api/metrics", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        metrics.writeJson(*response, currentTurnCounters());
+        request->send(response);
+    });
+
+    // Heap per region and stack high-water marks, see Memory.h
+    webServer.on("/api/memory", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        memoryReport(*response);
+        request->send(response);
+    });
+
+    // CPU time, core and priority per task over the last sample window, see Scheduling.h
+    webServer.on("/api/tasks", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        taskStatsReport(*response);
+        request->send(response);
+    });
+
+    // Firmware update, see Ota.h. 200 once the image is in place (the device restarts),
+    // 202 with the offset to resume from when the body ended early
+    webServer.on("/api/ota", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        otaReport(*response);
+        request->send(response);
+    });
+    webServer.on("/api/ota", HTTP_POST, [](AsyncWebServerRequest *request) {
+        if (!otaRequestAuthorized(request)) {
+            request->send(401, "application/json", "{\"error\":\"unauthorized\"}");
+            return;
+        }
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        response->setCode(otaRestartScheduled ? 200 : otaActive() ? 202 : 400);
+        otaReport(*response);
+        request->send(response);
+    }, nullptr, onOtaBody);
+
+    // OS connectivity checks get the portal straight away, before the catch-all below
+    for (const char *path : CAPTIVE_PROBES) {
+        webServer.on(path, HTTP_ANY, redirectToPortal);
+    }
+
     // Catch-all handler for captive portal - redirect everything to WiFi config
     webServer.onNotFound([](AsyncWebServerRequest *request) {
-      String host = request->host();
-      String url = request->url();
-      
-      Serial.printf("[CAPTIVE] Unknown request - Host: %s, URL: %s\n", host.c_str(), url.c_str());
-      
-      // For captive portal, redirect all requests except API calls
-      if (!url.startsWith("/api/")) {
-        Serial.println("[CAPTIVE] Redirecting to /wifi");
-      String portalUrl = "http://" + WiFi.softAPIP().toString() + "/wifi";
-      request->redirect(portalUrl);
-      } else {
-        request->send(404, "application/json", "{\"error\":\"Not found\"}");
-      }
+        const char *url = request->url().c_str();
+        LOG_D("[CAPTIVE] Unknown request - Host: %s, URL: %s", request->host().c_str(), url);
+
+        // For captive portal, redirect all requests except API calls
+        if (strncmp(url, "/api/", 5) != 0) {
+            redirectToPortal(request);
+        } else {
+            request->send(404, "application/json", "{\"error\":\"Not found\"}");
+        }
     });
     
     webServer.begin();
@@ -169,10 +290,14 @@ void touchTask(void* parameter) {
     
     // Detect touch press (not touched -> touched) - SCHEDULE LISTENING
     if (isTouched && !lastTouchState && (currentTime - lastTouchTime > TOUCH_DEBOUNCE_DELAY)) {
-        if (webSocket.isConnected()) {
-            Serial.println("👂 Touch detected - Scheduling listening...");
-            scheduleListeningRestart = true;
-            scheduledTime = millis() + 100; // Start listening in 100ms
+        if (dozing()) {
+            LOG_I("👂 Touch detected - Waking up to listen...");
+            exitDoze(true);
+            promptScheduleWake();
+        } else if (webSocket.isConnected()) {
+            LOG_I("👂 Touch detected - Scheduling listening...");
+            scheduleListeningAt(millis() + 100); // Start listening in 100ms
+            promptScheduleWake();
         }
       
       touched = true;
@@ -183,7 +308,7 @@ void touchTask(void* parameter) {
     // Check for long press while touched - SLEEP
     if (touched && isTouched) {
       if (currentTime - pressStartTime >= LONG_PRESS_DURATION) {
-        Serial.println("Long press detected - Going to sleep...");
+        LOG_I("Long press detected - Going to sleep...");
         sleepRequested = true;
       }
     }
@@ -204,7 +329,7 @@ void setupDeviceMetadata() {
     // quickAuthTokenReset();
     // quickFactoryResetDevice();
 
-    deviceState = IDLE;
+    setDeviceState(IDLE);
 
     getAuthTokenFromNVS();
 }
@@ -215,69 +340,64 @@ void setup()
 
     Serial.begin(115200);
     delay(500);
+    logBegin();
+    otaBootCheck();
 
     // SETUP
     setupDeviceMetadata();
-    wsMutex = xSemaphoreCreateMutex();    
 
     // INTERRUPT
     #ifdef TOUCH_MODE
-        xTaskCreate(touchTask, "Touch Task", 4096, NULL, configMAX_PRIORITIES-2, NULL);
+        touchTaskStack.start(touchTask);
     #else
         getErr = esp_sleep_enable_ext0_wakeup(BUTTON_PIN, LOW);
         printOutESP32Error(getErr);
         Button *btn = new Button(BUTTON_PIN, false);
         btn->attachLongPressUpEventCb(&onButtonLongPressUpEventCb, NULL);
         btn->attachDoubleClickEventCb(&onButtonDoubleClickCb, NULL);
+        btn->attachPressDownEventCb(&onButtonPressDownCb, NULL);
         btn->detachSingleClickEvent();
     #endif
 
-    // Pin audio tasks to Core 1 (application core)
-    xTaskCreatePinnedToCore(
-        ledTask,           // Function
-        "LED Task",        // Name
-        4096,              // Stack size
-        NULL,              // Parameters
-        5,                 // Priority
-        NULL,              // Handle
-        1                  // Core 1 (application core)
-    );
-
-    xTaskCreatePinnedToCore(
-        audioStreamTask,   // Function
-        "Speaker Task",    // Name
-        4096,              // Stack size
-        NULL,              // Parameters
-        3,                 // Priority
-        NULL,              // Handle
-        1                  // Core 1 (application core)
-    );
-
-    xTaskCreatePinnedToCore(
-        micTask,           // Function
-        "Microphone Task", // Name
-        4096,              // Stack size
-        NULL,              // Parameters
-        4,                 // Priority
-        NULL,              // Handle
-        1                  // Core 1 (application core)
-    );
-
-    // Pin network task to Core 0 (protocol core)
-    xTaskCreatePinnedToCore(
-        networkTask,       // Function
-        "Websocket Task",  // Name
-        8192,              // Stack size
-        NULL,              // Parameters
-        configMAX_PRIORITIES-1, // Highest priority
-        &networkTaskHandle,// Handle
-        0                  // Core 0 (protocol core)
-    );
+    // Hot codec state and the deep jitter buffer, before any task can touch them
+    allocateAudioBuffers();
+    promptsBegin();
+
+    // Audio and LED tasks on Core 1 (application core), networkTask on Core 0 (protocol core)
+    ledTaskStack.start(ledTask);
+    speakerTaskHandle = speakerTaskStack.start(audioStreamTask);
+    micTaskHandle = micTaskStack.start(micTask);
+    networkTaskHandle = networkTaskStack.start(networkTask);
 
     // WIFI
     setupWiFi();
 }
 
 void loop(){
+    // a verified update is in the other slot, leave time for the answer to go out
+    if (otaRestartScheduled) {
+        delay(500);
+        wsDisconnectScheduled = true;
+        wakeNetworkTask();
+        delay(200);
+        logFlush();
+        ESP.restart();
+    }
+
     processSleepRequest();
+    dozeCheck();
+    delay(dozing() ? 50 : 10); // don't spin, idle time is what light sleep runs on
+
+    static unsigned long lastTaskSample = 0;
+    if (millis() - lastTaskSample >= TASK_STATS_INTERVAL_MS) {
+        lastTaskSample = millis();
+        taskStatsSample();
+    }
+
+    static unsigned long lastMemoryReport = 0;
+    if (millis() - lastMemoryReport >= MEMORY_REPORT_INTERVAL_MS) {
+        lastMemoryReport = millis();
+        logMemoryReport();
+        logTaskStats();
+    }
 }
\ No newline at end of file
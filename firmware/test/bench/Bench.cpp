@@ -0,0 +1,138 @@
+#include "Bench.h"
+#include <algorithm>
+#include <esp_ota_ops.h>
+#include <math.h>
+
+BenchLine::BenchLine(const char *bench, const char *caseName)
+{
+    printf("{\"bench\":\"%s\"", bench);
+    if (caseName != nullptr) {
+        printf(",\"case\":\"%s\"", caseName);
+    }
+}
+
+size_t BenchLine::write(const uint8_t *data, size_t len)
+{
+    // leave room for the closing brace and the newline
+    size_t n = min(len, sizeof(text) - 2 - length);
+    memcpy(text + length, data, n);
+    length += n;
+    return n;
+}
+
+void BenchLine::emit()
+{
+    text[length++] = '}';
+    text[length++] = '\n';
+    Serial.write((const uint8_t *)text, length);
+}
+
+void BenchSamples::report(const char *bench, const char *caseName, const char *unit, float scale, const char *extra)
+{
+    BenchLine line(bench, caseName);
+    line.printf(",\"unit\":\"%s\",\"n\":%u", unit, (unsigned)count);
+    if (count > 0) {
+        std::sort(values, values + count);
+        uint64_t sum = 0;
+        for (size_t i = 0; i < count; i++) {
+            sum += values[i];
+        }
+        auto at = [&](uint32_t permille) { return values[min(count - 1, (size_t)((uint64_t)count * permille / 1000))] * scale; };
+        line.printf(",\"mean\":%.2f,\"p50\":%.2f,\"p90\":%.2f,\"p99\":%.2f,\"max\":%.2f", (float)sum / count * scale,
+            at(500), at(900), at(990), values[count - 1] * scale);
+    }
+    if (extra != nullptr) {
+        line.printf(",%s", extra);
+    }
+    line.emit();
+}
+
+void BenchHistogram::clear()
+{
+    memset(counts, 0, sizeof(counts));
+    total = 0;
+    maxValue = 0;
+}
+
+void BenchHistogram::add(uint32_t value)
+{
+    size_t bucket = value == 0 ? 0 : 32 - __builtin_clz(value);
+    counts[min(bucket, BUCKETS - 1)]++;
+    total++;
+    maxValue = max(maxValue, value);
+}
+
+uint32_t BenchHistogram::percentile(uint32_t permille) const
+{
+    uint64_t rank = (uint64_t)total * permille / 1000;
+    uint32_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (seen > rank) {
+            return i == BUCKETS - 1 ? maxValue : (1u << i) - 1;
+        }
+    }
+    return maxValue;
+}
+
+void BenchHistogram::report(const char *bench, const char *caseName, const char *unit)
+{
+    BenchLine line(bench, caseName);
+    line.printf(",\"unit\":\"%s\",\"n\":%u", unit, (unsigned)total);
+    if (total > 0) {
+        line.printf(",\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u", (unsigned)percentile(500), (unsigned)percentile(900),
+            (unsigned)percentile(990), (unsigned)maxValue);
+    }
+    // [upper bound (exclusive), count]; the last bucket is open ended
+    line.print(",\"buckets\":[");
+    bool first = true;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        if (counts[i] == 0) {
+            continue;
+        }
+        if (i == BUCKETS - 1) {
+            line.printf("%s[null,%u]", first ? "" : ",", (unsigned)counts[i]);
+        } else {
+            line.printf("%s[%u,%u]", first ? "" : ",", (unsigned)(1u << i), (unsigned)counts[i]);
+        }
+        first = false;
+    }
+    line.print("]");
+    line.emit();
+}
+
+void benchSkip(const char *bench, const char *reason)
+{
+    BenchLine line(bench);
+    line.printf(",\"skipped\":\"%s\"", reason);
+    line.emit();
+}
+
+void benchPrintMeta()
+{
+    const esp_app_desc_t *app = esp_ota_get_app_description();
+    BenchLine line("meta");
+    line.printf(",\"chip\":\"%s\",\"cpu_mhz\":%u,\"idf\":\"%s\",\"app\":\"%s\",\"built\":\"%s %s\"", ESP.getChipModel(),
+        (unsigned)getCpuFrequencyMhz(), esp_get_idf_version(), app->version, app->date, app->time);
+    line.emit();
+}
+
+float benchCyclesPerUs()
+{
+    return (float)getCpuFrequencyMhz();
+}
+
+void benchSignal(int16_t *samples, size_t sampleCount, uint32_t sampleRate, uint32_t &position)
+{
+    static uint32_t noise = 0x12345678;
+    for (size_t i = 0; i < sampleCount; i++, position++) {
+        float t = (float)position / sampleRate;
+        // 120..220 Hz glide over 1.5 s, four harmonics, 4 syllables a second
+        float phase = 2.0f * PI * (170.0f * t - 50.0f * 1.5f / (2.0f * PI) * cosf(2.0f * PI * t / 1.5f));
+        float tone = sinf(phase) + 0.5f * sinf(2.0f * phase) + 0.3f * sinf(3.0f * phase) + 0.2f * sinf(4.0f * phase);
+        float envelope = 0.5f - 0.5f * cosf(2.0f * PI * 4.0f * t);
+        noise = noise * 1664525u + 1013904223u;
+        float hiss = ((int32_t)noise >> 16) / 32768.0f;
+        samples[i] = (int16_t)(6000.0f * envelope * tone + 300.0f * hiss);
+    }
+}
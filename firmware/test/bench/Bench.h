@@ -0,0 +1,87 @@
+#pragma once
+
+#include <Arduino.h>
+
+// BENCH: on-target measurements of the audio path, built by [env:bench] (see README).
+// Every result is one JSON object on its own Serial line:
+//   {"bench":"opus_decode","case":"24k_20ms","unit":"us","n":500,"mean":..,"p50":..,"p90":..,"p99":..,"max":..}
+// All units are lower-is-better, so scripts/bench_compare.py can diff two captures without
+// knowing the benchmarks. Anything that does not start with '{' is ordinary log output.
+
+constexpr size_t BENCH_MAX_SAMPLES = 1000;
+
+// cycles on the calling core; wraps after ~17 s at 240 MHz, so time short sections only
+static inline uint32_t benchCycles() { return ESP.getCycleCount(); }
+
+// One result line, built in memory and written with a single Serial call so the log task
+// (which prints on the other core) cannot split it
+class BenchLine : public Print
+{
+public:
+    explicit BenchLine(const char *bench, const char *caseName = nullptr);
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *data, size_t len) override;
+    void emit();
+
+private:
+    char text[768];
+    size_t length = 0;
+};
+
+// Samples of one case, reported as percentiles. Values are stored as measured (usually
+// cycles) and multiplied by scale when printed, e.g. 1 / MHz for microseconds.
+class BenchSamples
+{
+public:
+    void clear() { count = 0; }
+    void add(uint32_t value)
+    {
+        if (count < BENCH_MAX_SAMPLES) {
+            values[count++] = value;
+        }
+    }
+    size_t size() const { return count; }
+    // extra: more "key":value pairs for the line, without the leading comma
+    void report(const char *bench, const char *caseName, const char *unit, float scale = 1.0f, const char *extra = nullptr);
+
+private:
+    uint32_t values[BENCH_MAX_SAMPLES];
+    size_t count = 0;
+};
+
+// Power of two buckets for hold times: bucket i counts values in [2^(i-1), 2^i), the last one
+// everything above. Reported with the upper bound of each non empty bucket and percentiles
+// rounded up to a bucket bound.
+class BenchHistogram
+{
+public:
+    static constexpr size_t BUCKETS = 22;      // up to ~2 s in microseconds
+
+    void clear();
+    void add(uint32_t value);
+    void report(const char *bench, const char *caseName, const char *unit);
+
+private:
+    uint32_t counts[BUCKETS] = {};
+    uint32_t total = 0;
+    uint32_t maxValue = 0;
+
+    uint32_t percentile(uint32_t permille) const;
+};
+
+// a case that could not run, e.g. no Wi-Fi credentials were built in
+void benchSkip(const char *bench, const char *reason);
+// chip, clock, IDF and build, first line of every run
+void benchPrintMeta();
+// cycles per microsecond of the current CPU clock
+float benchCyclesPerUs();
+
+// deterministic speech-like test signal (a gliding harmonic tone with a syllable envelope
+// and a little noise), continuous across calls through position
+void benchSignal(int16_t *samples, size_t sampleCount, uint32_t sampleRate, uint32_t &position);
+
+// the suites, each runs on the calling task unless it says otherwise
+void benchOpus();
+void benchDsp();
+void benchPacketQueue();
+void benchLoopback();
@@ -0,0 +1,125 @@
+#include "Bench.h"
+#include "DspPipeline.h"
+#include "Memory.h"
+#include "Mixer.h"
+#include "PitchShift.h"
+
+// Playback DSP cost in cycles per input sample, measured block by block on
+// 24 kHz speech as it comes out of the decoder
+static constexpr uint32_t DSP_RATE = 24000;
+static constexpr size_t DSP_FRAME = DSP_RATE / 1000 * 20;  // one decoded packet
+static constexpr size_t DSP_FRAMES = 500;
+static constexpr size_t SPEECH_SAMPLES = DSP_RATE / 2;     // replayed over and over
+static constexpr size_t PITCH_BLOCK = PitchShiftFixedOutput::BLOCK_SIZE;
+
+// stands in for I2S, takes everything at once
+class BenchNullPrint : public Print
+{
+public:
+    size_t write(uint8_t) override { return 1; }
+    size_t write(const uint8_t *, size_t len) override { return len; }
+};
+
+static BenchNullPrint nullOut;
+static PitchShiftFixedOutput pitchShift(nullOut);
+static DspPipeline pipeline(nullOut);
+static AudioMixer mixer;
+static BenchSamples samples;
+alignas(16) static int16_t speech[SPEECH_SAMPLES];
+alignas(16) static int16_t frame[DSP_FRAME];
+
+static void fillSpeech()
+{
+    uint32_t position = 0;
+    benchSignal(speech, SPEECH_SAMPLES, DSP_RATE, position);
+}
+
+static const int16_t *speechAt(size_t index, size_t length)
+{
+    return speech + (index % (SPEECH_SAMPLES / length)) * length;
+}
+
+// the grain based shifter on its own, in the pipeline's 256 sample blocks
+static void benchPitchShift(const char *caseName, float pitch)
+{
+    auto cfg = pitchShift.defaultConfig();
+    cfg.sample_rate = DSP_RATE;
+    cfg.channels = 1;
+    cfg.pitch_shift = pitch;
+    pitchShift.begin(cfg);
+
+    samples.clear();
+    for (size_t i = 0; i < BENCH_MAX_SAMPLES; i++) {
+        memcpy(frame, speechAt(i, PITCH_BLOCK), PITCH_BLOCK * sizeof(int16_t));
+        uint32_t start = benchCycles();
+        pitchShift.process(frame, PITCH_BLOCK);
+        samples.add(benchCycles() - start);
+    }
+    samples.report("pitch_shift", caseName, "cycles_per_sample", 1.0f / PITCH_BLOCK);
+}
+
+// the whole chain per decoded frame, what the AudioTools VolumeStream used to do and then some
+static void benchPipeline(const char *caseName, const DspPipeline::Config &config, bool withMixer)
+{
+    pipeline.configure(config);
+    pipeline.setMixer(withMixer ? &mixer : nullptr);
+    int input = -1;
+    if (withMixer) {
+        // a prompt over the response: one input at unity, the main bus ducked
+        input = mixer.open(1.0f, 0.35f);
+    }
+
+    samples.clear();
+    for (size_t i = 0; i < DSP_FRAMES; i++) {
+        memcpy(frame, speechAt(i, DSP_FRAME), sizeof(frame));
+        if (input >= 0) {
+            mixer.write(input, speechAt(i + 7, DSP_FRAME), DSP_FRAME);
+        }
+        uint32_t start = benchCycles();
+        pipeline.write(frame, DSP_FRAME);
+        samples.add(benchCycles() - start);
+    }
+    if (input >= 0) {
+        mixer.stop(input);
+        while (mixer.active()) {
+            mixer.mixInto(frame, AudioMixer::MAX_BLOCK);
+        }
+        mixer.reset();
+    }
+    samples.report("dsp_pipeline", caseName, "cycles_per_sample", 1.0f / DSP_FRAME);
+}
+
+void benchDsp()
+{
+    fillSpeech();
+
+    benchPitchShift("0.85", 0.85f);
+    benchPitchShift("1.25", 1.25f);
+
+    if (!mixer.begin(memAlloc(AudioMixer::storageBytes(), MEM_INTERNAL, "bench mixer rings"))) {
+        benchSkip("dsp_pipeline", "no memory for the mixer rings");
+        return;
+    }
+
+    DspPipeline::Config config;
+    config.inputRate = DSP_RATE;
+    config.outputRate = DSP_RATE;
+    benchPipeline("bypass", config, false);
+
+    config.gain = 0.5f;
+    benchPipeline("gain_0.5", config, false);
+
+    config.gain = 2.0f;
+    benchPipeline("gain_2.0_limiter", config, false);
+
+    config.gain = 0.8f;
+    config.outputRate = 48000;
+    benchPipeline("gain_0.8_src_48k", config, false);
+
+    config.outputRate = DSP_RATE;
+    config.pitch = 1.2f;
+    benchPipeline("gain_0.8_pitch_1.2", config, false);
+
+    config.pitch = 1.0f;
+    benchPipeline("gain_0.8_mixer", config, true);
+}
@@ -0,0 +1,179 @@
+#include "Bench.h"
+#include "Memory.h"
+#include "Scheduling.h"
+#include <WebSocketsClient.h>
+#include <WiFi.h>
+#include <opus.h>
+
+// End to end: a 20 ms uplink frame is encoded, sent to scripts/bench_echo_server.py, comes back
+// and is decoded. Runs where networkTask runs and owns the socket the same way, so the time
+// spent inside sendBIN() and loop() is what the other tasks would wait for if they had to
+// lock the socket.
+#ifndef BENCH_WIFI_SSID
+#define BENCH_WIFI_SSID ""
+#endif
+#ifndef BENCH_WIFI_PASS
+#define BENCH_WIFI_PASS ""
+#endif
+#ifndef BENCH_WS_HOST
+#define BENCH_WS_HOST ""
+#endif
+#ifndef BENCH_WS_PORT
+#define BENCH_WS_PORT ""
+#endif
+
+static constexpr uint16_t LOOPBACK_DEFAULT_PORT = 8765;
+static constexpr size_t LOOPBACK_FRAMES = 500;                 // 10 s
+static constexpr uint32_t LOOPBACK_RATE = 16000;
+static constexpr size_t LOOPBACK_FRAME = LOOPBACK_RATE / 1000 * 20;
+static constexpr int64_t LOOPBACK_FRAME_US = 20000;
+static constexpr uint32_t LOOPBACK_CONNECT_MS = 20000;
+static constexpr int64_t LOOPBACK_TAIL_US = 2000000;           // wait for stragglers after the last frame
+
+static WebSocketsClient ws;   //access from loopbackTask only
+static OpusEncoder *encoder = nullptr;
+static OpusDecoder *decoder = nullptr;
+static int64_t sentAt[LOOPBACK_FRAMES];                        // 0 once the echo is back
+static volatile bool connected = false;
+static uint32_t received = 0;
+static int16_t decoded[LOOPBACK_FRAME];
+static BenchSamples roundTrip;
+static BenchHistogram sendHold;
+static BenchHistogram loopHold;
+static StaticTask<16384> loopbackTaskStack;
+
+// loopbackTask -> ws.loop() -> onEvent()
+static void onEvent(WStype_t type, uint8_t *payload, size_t length)
+{
+    if (type == WStype_CONNECTED) {
+        connected = true;
+    } else if (type == WStype_DISCONNECTED) {
+        connected = false;
+    } else if (type == WStype_BIN && length > sizeof(uint32_t)) {
+        uint32_t seq;
+        memcpy(&seq, payload, sizeof(seq));
+        if (seq < LOOPBACK_FRAMES && sentAt[seq] != 0) {
+            opus_decode(decoder, payload + sizeof(seq), length - sizeof(seq), decoded, LOOPBACK_FRAME, 0);
+            roundTrip.add((uint32_t)(esp_timer_get_time() - sentAt[seq]));
+            sentAt[seq] = 0;
+            received++;
+        }
+    }
+}
+
+static bool connectWifi()
+{
+    WiFi.mode(WIFI_STA);
+    WiFi.setSleep(false);  // as WifiManager runs it, modem sleep would add its own latency
+    WiFi.begin(BENCH_WIFI_SSID, BENCH_WIFI_PASS);
+    uint32_t start = millis();
+    while (WiFi.status() != WL_CONNECTED && millis() - start < LOOPBACK_CONNECT_MS) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    return WiFi.status() == WL_CONNECTED;
+}
+
+static bool connectSocket()
+{
+    uint16_t port = atoi(BENCH_WS_PORT);
+    ws.begin(BENCH_WS_HOST, port ? port : LOOPBACK_DEFAULT_PORT, "/");
+    ws.onEvent(onEvent);
+    ws.setReconnectInterval(1000);
+    uint32_t start = millis();
+    while (!connected && millis() - start < LOOPBACK_CONNECT_MS) {
+        ws.loop();
+        vTaskDelay(1);
+    }
+    return connected;
+}
+
+static void runLoopback()
+{
+    if (!connectWifi()) {
+        benchSkip("loopback", "wifi did not connect");
+        return;
+    }
+    if (!connectSocket()) {
+        benchSkip("loopback", "echo server did not answer");
+        WiFi.disconnect();
+        return;
+    }
+
+    int16_t pcm[LOOPBACK_FRAME];
+    uint8_t packet[sizeof(uint32_t) + 512];
+    uint32_t position = 0;
+    uint32_t sent = 0;
+    int64_t nextSend = esp_timer_get_time();
+    int64_t lastSend = nextSend;
+
+    // paced like the mic: one frame every 20 ms, the socket is serviced in between
+    while (connected) {
+        int64_t now = esp_timer_get_time();
+        if (sent < LOOPBACK_FRAMES && now >= nextSend) {
+            benchSignal(pcm, LOOPBACK_FRAME, LOOPBACK_RATE, position);
+            int len = opus_encode(encoder, pcm, LOOPBACK_FRAME, packet + sizeof(sent), sizeof(packet) - sizeof(sent));
+            if (len > 0) {
+                memcpy(packet, &sent, sizeof(sent));
+                sentAt[sent] = esp_timer_get_time();
+                uint32_t start = benchCycles();
+                ws.sendBIN(packet, sizeof(sent) + len);
+                sendHold.add((benchCycles() - start) / benchCyclesPerUs());
+                lastSend = sentAt[sent];
+            }
+            sent++;
+            nextSend += LOOPBACK_FRAME_US;
+        } else if (sent == LOOPBACK_FRAMES && (received == sent || now - lastSend > LOOPBACK_TAIL_US)) {
+            break;
+        }
+
+        uint32_t start = benchCycles();
+        ws.loop();
+        loopHold.add((benchCycles() - start) / benchCyclesPerUs());
+        vTaskDelay(1);
+    }
+
+    char extra[64];
+    snprintf(extra, sizeof(extra), "\"sent\":%u,\"lost\":%u", (unsigned)sent, (unsigned)(sent - received));
+    roundTrip.report("loopback", "opus_16k_20ms_rtt", "us", 1.0f, extra);
+    sendHold.report("ws_hold", "send_bin", "us");
+    loopHold.report("ws_hold", "loop", "us");
+
+    ws.disconnect();
+    WiFi.disconnect();
+}
+
+// networkTask's place: core 0 at its priority
+static void loopbackTask(void *parameter)
+{
+    runLoopback();
+    xTaskNotifyGive((TaskHandle_t)parameter);
+    vTaskSuspend(NULL);  // the stack is static, the task is never started again
+}
+
+void benchLoopback()
+{
+    if (strlen(BENCH_WIFI_SSID) == 0 || strlen(BENCH_WS_HOST) == 0) {
+        benchSkip("loopback", "BENCH_WIFI_SSID or BENCH_WS_HOST not set at build time");
+        return;
+    }
+    if (encoder == nullptr) {
+        encoder = (OpusEncoder *)memAlloc(opus_encoder_get_size(1), MEM_INTERNAL, "bench loopback encoder");
+        decoder = (OpusDecoder *)memAlloc(opus_decoder_get_size(1), MEM_INTERNAL, "bench loopback decoder");
+    }
+    if (encoder == nullptr || decoder == nullptr || opus_encoder_init(encoder, LOOPBACK_RATE, 1, OPUS_APPLICATION_VOIP) != OPUS_OK ||
+        opus_decoder_init(decoder, LOOPBACK_RATE, 1) != OPUS_OK) {
+        benchSkip("loopback", "codec init failed");
+        return;
+    }
+    // the defaults of the auth message
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(24000));
+    opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(3));
+    opus_encoder_ctl(encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+
+    const TaskProfile &network = TASK_PROFILES[TASK_NETWORK];
+    if (loopbackTaskStack.start(loopbackTask, "Bench Loopback", xTaskGetCurrentTaskHandle(), network.priority, network.core) == nullptr) {
+        benchSkip("loopback", "loopback task did not start");
+        return;
+    }
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
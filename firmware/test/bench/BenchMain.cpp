@@ -0,0 +1,35 @@
+#include "Bench.h"
+#include "Log.h"
+#include "Scheduling.h"
+
+// setup() -> benchTask: every suite once, then idle. The suites run where audioStreamTask runs
+// (core 1, its priority, its stack size) unless they start their own task.
+static StaticTask<TASK_PROFILES[TASK_SPEAKER].stackBytes> benchTaskStack;
+
+static void benchTask(void *parameter)
+{
+    benchPrintMeta();
+    benchOpus();
+    benchDsp();
+    benchPacketQueue();
+    benchLoopback();
+
+    logFlush();
+    BenchLine("done").emit();  // the capture can stop here
+    vTaskSuspend(NULL);
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    delay(500);
+    logBegin();
+
+    const TaskProfile &speaker = TASK_PROFILES[TASK_SPEAKER];
+    benchTaskStack.start(benchTask, "Bench Task", nullptr, speaker.priority, speaker.core);
+}
+
+void loop()
+{
+    delay(1000);
+}
@@ -0,0 +1,109 @@
+#include "Bench.h"
+#include "Memory.h"
+#include <opus.h>
+
+// Opus encode and decode time per frame, with the states in internal RAM as the firmware
+// keeps them (see audioStreamTask and OpusUplinkEncoder)
+static constexpr size_t OPUS_FRAMES = 500;          // 10 s of 20 ms frames per case
+static constexpr size_t OPUS_MAX_FRAME = 24000 / 1000 * 20;
+static constexpr size_t OPUS_MAX_PACKET = 512;
+
+static OpusEncoder *encoder = nullptr;
+static OpusDecoder *decoder = nullptr;
+static BenchSamples samples;
+
+static bool allocateStates()
+{
+    if (encoder == nullptr) {
+        encoder = (OpusEncoder *)memAlloc(opus_encoder_get_size(1), MEM_INTERNAL, "bench opus encoder");
+    }
+    if (decoder == nullptr) {
+        decoder = (OpusDecoder *)memAlloc(opus_decoder_get_size(1), MEM_INTERNAL, "bench opus decoder");
+    }
+    return encoder != nullptr && decoder != nullptr;
+}
+
+static bool beginEncoder(uint32_t sampleRate, int bitrate, int complexity)
+{
+    if (opus_encoder_init(encoder, sampleRate, 1, OPUS_APPLICATION_VOIP) != OPUS_OK) {
+        return false;
+    }
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate));
+    opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(complexity));
+    opus_encoder_ctl(encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+    return true;
+}
+
+// the uplink: micTask encodes every mic frame
+static void benchEncode(const char *caseName, uint32_t sampleRate, int bitrate, int complexity)
+{
+    int16_t pcm[OPUS_MAX_FRAME];
+    uint8_t packet[OPUS_MAX_PACKET];
+    size_t frame = sampleRate / 1000 * 20;
+    uint32_t position = 0;
+    uint32_t bytes = 0;
+
+    if (!beginEncoder(sampleRate, bitrate, complexity)) {
+        benchSkip("opus_encode", "encoder init failed");
+        return;
+    }
+    samples.clear();
+    for (size_t i = 0; i < OPUS_FRAMES; i++) {
+        benchSignal(pcm, frame, sampleRate, position);
+        uint32_t start = benchCycles();
+        int len = opus_encode(encoder, pcm, frame, packet, sizeof(packet));
+        samples.add(benchCycles() - start);
+        bytes += len > 0 ? len : 0;
+    }
+    char extra[48];
+    snprintf(extra, sizeof(extra), "\"bytes_per_frame\":%u", (unsigned)(bytes / OPUS_FRAMES));
+    samples.report("opus_encode", caseName, "us", 1.0f / benchCyclesPerUs(), extra);
+}
+
+// the downlink: audioStreamTask decodes every packet, and conceals the ones that are late
+static void benchDecode(const char *caseName, uint32_t sampleRate, int bitrate, bool conceal)
+{
+    int16_t pcm[OPUS_MAX_FRAME];
+    uint8_t packet[OPUS_MAX_PACKET];
+    size_t frame = sampleRate / 1000 * 20;
+    uint32_t position = 0;
+
+    // the packets come from our own encoder at the server's settings, only decoding is timed
+    if (!beginEncoder(sampleRate, bitrate, 5) || opus_decoder_init(decoder, sampleRate, 1) != OPUS_OK) {
+        benchSkip("opus_decode", "codec init failed");
+        return;
+    }
+    samples.clear();
+    for (size_t i = 0; i < OPUS_FRAMES; i++) {
+        benchSignal(pcm, frame, sampleRate, position);
+        int len = opus_encode(encoder, pcm, frame, packet, sizeof(packet));
+        if (len <= 0) {
+            continue;
+        }
+        // every other packet is lost for the concealment case, so its history stays realistic
+        bool lost = conceal && (i & 1);
+        uint32_t start = benchCycles();
+        opus_decode(decoder, lost ? nullptr : packet, lost ? 0 : len, pcm, frame, 0);
+        uint32_t cycles = benchCycles() - start;
+        if (lost || !conceal) {
+            samples.add(cycles);
+        }
+    }
+    samples.report("opus_decode", caseName, "us", 1.0f / benchCyclesPerUs());
+}
+
+void benchOpus()
+{
+    if (!allocateStates()) {
+        benchSkip("opus_encode", "no memory for the codec states");
+        return;
+    }
+    // the defaults of the auth message: 16 kHz, 24 kbit/s, complexity 3
+    benchEncode("16k_20ms_24kbps_c0", 16000, 24000, 0);
+    benchEncode("16k_20ms_24kbps_c3", 16000, 24000, 3);
+    benchEncode("16k_20ms_24kbps_c5", 16000, 24000, 5);
+
+    benchDecode("24k_20ms_32kbps", 24000, 32000, false);
+    benchDecode("16k_20ms_24kbps", 16000, 24000, false);
+    benchDecode("24k_20ms_plc", 24000, 32000, true);
+}
@@ -0,0 +1,82 @@
+#include "Audio.h"
+#include "Bench.h"
+#include "Memory.h"
+#include "Scheduling.h"
+
+// PacketQueue across the two cores, as micTask (core 1) hands uplink frames to networkTask
+// (core 0). The calling task pushes as fast as it can, the consumer task copies every packet
+// out and times each round of QUEUE_ROUND packets. Same geometry as wsTxQueue.
+static constexpr size_t QUEUE_ROUND = 200;
+static constexpr size_t QUEUE_ROUNDS = 50;
+
+typedef WsTxQueue BenchQueue;
+
+static BenchQueue queue;
+static BenchSamples samples;
+static StaticTask<4096> consumerTaskStack;
+static TaskHandle_t consumerTaskHandle = nullptr;
+static TaskHandle_t producerTaskHandle = nullptr;
+
+// networkTask's place: one case per notification, notifies the producer when it has all packets
+static void consumerTask(void *parameter)
+{
+    uint8_t copy[WS_TX_SLOT_SIZE];
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        samples.clear();
+        for (size_t round = 0; round < QUEUE_ROUNDS; round++) {
+            uint32_t start = benchCycles();
+            for (size_t received = 0; received < QUEUE_ROUND;) {
+                size_t len;
+                const uint8_t *data = queue.peek(len);
+                if (data != nullptr) {
+                    memcpy(copy, data, len);
+                    queue.pop();
+                    received++;
+                }
+            }
+            samples.add((benchCycles() - start) / QUEUE_ROUND);
+        }
+        xTaskNotifyGive(producerTaskHandle);
+    }
+}
+
+static void benchSpsc(const char *caseName, size_t bytes)
+{
+    uint8_t packet[WS_TX_SLOT_SIZE];
+    for (size_t i = 0; i < bytes; i++) {
+        packet[i] = (uint8_t)i;
+    }
+
+    xTaskNotifyGive(consumerTaskHandle);
+    for (size_t sent = 0; sent < QUEUE_ROUND * QUEUE_ROUNDS;) {
+        if (queue.push(packet, bytes)) {
+            sent++;
+        }
+    }
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    char extra[48];
+    snprintf(extra, sizeof(extra), "\"bytes\":%u", (unsigned)bytes);
+    samples.report("packet_queue", caseName, "ns_per_packet", 1000.0f / benchCyclesPerUs(), extra);
+}
+
+void benchPacketQueue()
+{
+    if (!queue.begin(memAlloc(BenchQueue::storageBytes(), MEM_INTERNAL, "bench queue"))) {
+        benchSkip("packet_queue", "no memory for the queue");
+        return;
+    }
+    producerTaskHandle = xTaskGetCurrentTaskHandle();
+    if (consumerTaskHandle == nullptr) {
+        const TaskProfile &network = TASK_PROFILES[TASK_NETWORK];
+        consumerTaskHandle = consumerTaskStack.start(consumerTask, "Bench Consumer", nullptr, network.priority, network.core);
+    }
+    if (consumerTaskHandle == nullptr) {
+        benchSkip("packet_queue", "consumer task did not start");
+        return;
+    }
+    // 24 kbps Opus and 16 kHz PCM, both behind an uplink header
+    benchSpsc("uplink_opus_20ms", 60 + sizeof(UplinkFrameHeader));
+    benchSpsc("uplink_pcm_20ms", 16000 / 1000 * 20 * sizeof(int16_t) + sizeof(UplinkFrameHeader));
+}